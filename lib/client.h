@@ -0,0 +1,81 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include <stdint.h>
+
+#include "../lib/operations.h"
+#include "../lib/protocol.h"
+
+/*
+ * Client library for a filesystem served by `ha2 --serve <image> <socket>`.
+ * The fsc_* calls mirror operations.h and return what the operation returned
+ * on the server, or FS_PROTO_BAD_REQUEST / -1 on protocol or connection errors.
+ */
+
+typedef struct _fs_client fs_client;
+
+typedef struct _fsc_response{
+	uint32_t id; //id returned by fsc_send
+	int32_t status; //return value of the operation
+	uint8_t* payload; //malloc'd, NULL if len is 0. Free it after use
+	uint32_t len;
+} fsc_response;
+
+/**
+	* Connects to a serving ha2
+	* @return the connection or NULL on failure
+**/
+fs_client* fsc_connect(const char* socket_path);
+
+/*
+	* Closes the connection and frees the client
+*/
+void fsc_close(fs_client* c);
+
+/*
+ * Sends one request without waiting for its response, so many requests can be
+ * pipelined. Responses arrive in request order and are collected with fsc_recv.
+ * @param const char* const* args nargs NUL-terminated strings
+ * @param const void* data raw bytes sent after the strings (may be NULL)
+ * @return the request id, 0 on failure
+ */
+uint32_t fsc_send(fs_client* c, uint16_t op, uint16_t nargs, const char* const* args, const void* data, uint32_t data_len);
+
+/*
+ * Receives the next response
+ * @return 0 on success, -1 else
+ */
+int fsc_recv(fs_client* c, fsc_response* response);
+
+int fsc_mkdir(fs_client* c, const char* path);
+int fsc_mkfile(fs_client* c, const char* path_and_name);
+int fsc_writef(fs_client* c, const char* filename, const char* text);
+int fsc_rm(fs_client* c, const char* path);
+int fsc_import(fs_client* c, const char* int_path, const char* ext_path);
+int fsc_export(fs_client* c, const char* int_path, const char* ext_path);
+int fsc_dump(fs_client* c);
+int fsc_batch_begin(fs_client* c);
+int fsc_batch_commit(fs_client* c);
+
+/*
+ * Same contracts as fs_pwrite and fs_pread
+ */
+int fsc_pwrite(fs_client* c, const char* filename, const void* buf, uint32_t len, uint64_t offset);
+int fsc_pread(fs_client* c, const char* filename, void* buf, uint32_t len, uint64_t offset);
+
+/*
+ * fs_fsck in report mode, run by the server between requests
+ */
+int fsc_fsck(fs_client* c, fs_fsck_report* report);
+
+/*
+ * Same contract as fs_list: a malloc'd listing or NULL if the path was not found
+ */
+char* fsc_list(fs_client* c, const char* path);
+
+/*
+ * Same contract as fs_readf: a malloc'd buffer or NULL, size stored in *file_size
+ */
+uint8_t* fsc_readf(fs_client* c, const char* filename, int* file_size);
+
+#endif //CLIENT_H
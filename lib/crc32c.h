@@ -0,0 +1,14 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC32C (Castagnoli) of len bytes, continuing from crc (0 to start). Uses the
+ * SSE4.2 crc32 instruction where the CPU has it, else slicing-by-8 tables.
+ * Safe to call from several threads
+ */
+uint32_t crc32c(uint32_t crc, const void* data, size_t len);
+
+#endif //CRC32C_H
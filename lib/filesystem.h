@@ -4,11 +4,14 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 #include <stdlib.h>
 
 #define BLOCK_SIZE 1024
 #define NAME_MAX_LENGTH 32
 #define DIRECT_BLOCKS_COUNT 12
+#define MAX_FILE_SIZE (DIRECT_BLOCKS_COUNT * BLOCK_SIZE)
 
 enum node_type{
 	reg_file=1,
@@ -29,21 +32,166 @@ typedef struct _inode {
 	enum node_type n_type;
 	uint16_t size;
 	char name[NAME_MAX_LENGTH];
+	uint8_t flags; //INODE_* flags, kept in what used to be padding: only valid with FS_FEATURE_COMPRESSION
 	int direct_blocks[DIRECT_BLOCKS_COUNT]; //Block numbers. -1 if there is no block
 	int parent; //inode number of parent
 } inode;
 
+#define INODE_COMPRESSED 1 //the file is stored in clusters, possibly compressed (see compress.c)
+
+//a compressed file is stored in clusters of CLUSTER_BLOCKS direct blocks each
+#define CLUSTER_BLOCKS 4
+#define CLUSTER_SIZE (CLUSTER_BLOCKS * BLOCK_SIZE)
+
 typedef struct _superblock{
 	uint32_t num_blocks;
 	uint32_t free_blocks;
 } superblock;
 
+/*
+ * An image written by fs_resize can grow and shrink in place: its free list and inode
+ * table have room for table_capacity entries, the data blocks come last. Such an image
+ * sets SB_TABLE_CAPACITY in the stored num_blocks and stores the capacity right after
+ * the superblock. Images from fs_create keep the plain layout, tables of num_blocks
+ */
+#define SB_TABLE_CAPACITY 0x80000000u
+
+/*
+ * where the regions of the image start
+ */
+typedef struct _image_layout{
+	off_t free_list;
+	off_t inodes;
+	off_t data;
+	off_t trailer;
+} image_layout;
+
+/*
+ * State an open transaction returns to on abort. Operations inside the transaction
+ * work on copies of the free list and the inodes; data blocks still used by this
+ * state are never modified, they are copied on write.
+ */
+typedef struct _fs_txn{
+	superblock s_block;
+	uint8_t* free_list;
+	inode* inodes;
+	int root_node;
+	int dirty;
+	int batch_depth; //batch_depth including the transaction; batches opened inside it are above
+} fs_txn;
+
+/*
+ * Set of inode or block numbers changed since the last persist
+ */
+typedef struct _dirty_set{
+	uint8_t* flags; //bitmap, one bit per number
+	uint32_t* list; //the numbers in the set
+	uint32_t count;
+	uint32_t capacity;
+} dirty_set;
+
+/*
+ * An open file (see fs_open in operations.h). The inode number replaces the path,
+ * its direct_blocks are the block map, so no path is resolved after opening
+ */
+typedef struct _fs_handle{
+	int inode; //inode number of the open file, -1 once the file was removed
+	size_t offset; //position of the next fs_read/fs_write
+	int flags;
+	struct _fs_handle* next; //next open handle of the filesystem
+} fs_handle;
+
+//feature flags stored in the image
+#define FS_FEATURE_DEDUP 1 //identical full blocks are shared (see dedup.c)
+#define FS_FEATURE_GENERATIONS 2 //the generation stamps are stored, for delta backups (see delta.c)
+#define FS_FEATURE_CHECKSUMS 4 //a CRC32C of every inode and block is stored and verified (see checksum.c)
+#define FS_FEATURE_LOG 8 //data blocks are written at the head of a log, never in place (see log.c)
+#define FS_FEATURE_COMPRESSION 16 //files are written compressed, the inode flags are valid (see compress.c)
+
+/*
+ * Index of full data blocks by content hash, used while FS_FEATURE_DEDUP is set
+ */
+typedef struct _dedup_index{
+	uint32_t num_buckets; //power of two
+	int* buckets; //first block of each bucket, -1 if empty
+	int* next; //next block in the same bucket, -1 at the end, -2 if the block isn't indexed
+	uint64_t* hashes; //hash of each indexed block
+} dedup_index;
+
+/*
+ * CRC32C of every inode and data block as last persisted, used while
+ * FS_FEATURE_CHECKSUMS is set. An entry is verified the first time it is read
+ * after loading; a changed entry counts as verified, its checksum is recomputed
+ * on the next persist
+ */
+typedef struct _checksum_table{
+	uint32_t* inodes;
+	uint32_t* blocks;
+	uint8_t* inode_ok; //1 once the inode was verified or changed in memory
+	uint8_t* block_ok;
+} checksum_table;
+
+/*
+ * Appends to a file held back in memory while write buffering is on (see writeback.c).
+ * The inode's size already includes them, its blocks don't yet
+ */
+#define WBUF_SIZE (4 * BLOCK_SIZE) //a buffer this full is flushed
+#define WBUF_MAX_AGE_MS 100 //the next append (or an idle server) persists buffers older than this
+
+typedef struct _write_buffer{
+	int inode;
+	size_t offset; //file offset of data[0], the end of what is in the blocks
+	size_t len;
+	uint32_t reserved; //blocks set aside for the flush
+	struct _write_buffer* next;
+	uint8_t data[WBUF_SIZE];
+} write_buffer;
+
+/*
+ * Named, frozen copy of the inode table. Its file blocks are reference counted
+ * like those of live files, so they are copied on write instead of overwritten
+ */
+typedef struct _fs_snapshot{
+	char name[NAME_MAX_LENGTH];
+	int root_node;
+	inode* inodes; //num_blocks inodes
+	struct _fs_snapshot* next; //next younger snapshot
+} fs_snapshot;
+
 typedef struct _fs{
 	superblock* s_block;
 	uint8_t * free_list; //free == 1
 	inode * inodes;	
 	data_block* data_blocks;
 	int root_node; //inode-number of root node
+	char* path; //image file the filesystem is persisted to
+	int batch_depth; //>0 while persisting is deferred by fs_batch_begin
+	int dirty; //changes were deferred and still have to be persisted
+	fs_txn* txn; //open transaction or NULL
+	dirty_set dirty_inodes; //inodes to write on the next persist
+	dirty_set dirty_blocks; //blocks (data and free list entry) to write on the next persist
+	int dirty_all; //too much changed to track, the next persist dumps everything
+	fs_handle* handles; //open file handles
+	uint32_t features; //FS_FEATURE_* flags, persisted in the trailer after the data blocks
+	int trailer_dirty; //the trailer has to be rewritten on the next persist
+	uint32_t* refs; //number of inode pointers to each data block, rebuilt on load
+	dedup_index* dedup; //NULL unless FS_FEATURE_DEDUP is set
+	fs_snapshot* snapshots; //oldest first, persisted in the trailer
+	uint32_t generation; //stamped on everything changed from now on
+	uint32_t* inode_gen; //generation each inode was last changed in
+	uint32_t* block_gen; //generation each block (and its free list entry) was last changed in
+	uint32_t trailer_gen; //generation the trailer (features, snapshots) was last changed in
+	uint32_t applied_gen; //generation of the last delta applied to this image
+	checksum_table* csum; //NULL unless FS_FEATURE_CHECKSUMS is set
+	uint32_t log_head; //block_alloc searches from here while FS_FEATURE_LOG is set
+	int write_buffering; //small appends are buffered instead of written to blocks right away
+	write_buffer* wbufs; //one per file with buffered appends
+	uint32_t reserved_blocks; //free blocks promised to the buffers, block_alloc leaves them alone
+	uint64_t wbuf_since; //CLOCK_MONOTONIC ms of the first append not persisted yet, 0 if none
+	struct _cluster_cache* zcache; //decompressed clusters, NULL unless FS_FEATURE_COMPRESSION is set
+	uint64_t* free_inodes; //bit i set if inode i is free, built by find_free_inode, NULL until then
+	uint64_t* free_groups; //bit g set if word g of free_inodes has a free inode
+	uint32_t table_capacity; //entries the free list and inode table of the image have room for, 0 in the plain layout
 }file_system ;
 
 /**
@@ -71,15 +219,365 @@ file_system* fs_create(const char* fs_file_path, uint32_t size);
  */
 int fs_dump(file_system* fs, const char* file_path);
 
+/*
+ * dumps the filesystem to a temporary file next to file_path and renames it over
+ * file_path, so the image is either completely old or completely new
+ * @return 0 on success, -1 else
+ */
+int fs_dump_atomic(file_system* fs, const char* file_path);
+
+/*
+ * reallocates the array at *array from old_count to count entries of entry_size bytes.
+ * If that fails, *array is kept, which is only an error when growing
+ * @return 0 on success, -1 else
+ */
+int resize_array(void* array, size_t old_count, size_t count, size_t entry_size);
+
+/*
+ * the offsets of the regions in the image of fs
+ */
+image_layout layout_of(file_system* fs);
+
+/*
+ * writes the entries old_size.. of a filesystem grown in place into its image: their
+ * free list entries and inodes into the room left in the tables, their (empty) data
+ * blocks where the trailer was. The trailer has to be rewritten afterwards
+ * @return 0 on success, -1 else
+ */
+int image_extend(file_system* fs, uint32_t old_size);
+
 
 /*
 	* Initialize an empty inode
 */
 void inode_init(inode* i);
 /*
-	* find free inode and return its number or -1 if there is no free inode
+	* find free inode and return its number or -1 if there is no free inode. Inodes in
+	* the group of 64 around near come first, then the following groups, then the
+	* lowest free one
+*/
+int find_free_inode(file_system* fs, int near);
+
+/*
+	* forgets the free inode bitmap after the inode table changed as a whole, the next
+	* find_free_inode builds it again
+*/
+void inode_index_drop(file_system* fs);
+
+/*
+	* find free data block and return its number or -1 if there is no free block
+*/
+int find_free_block(file_system* fs);
+
+/*
+	* allocate a free data block and return its number or -1 if there is no free block.
+	* Blocks the open transaction may return to are never handed out. In log mode
+	* the first free block at or after the head of the log is taken
+*/
+int block_alloc(file_system* fs);
+
+/*
+	* allocate count contiguous free blocks and return the first one, -1 if there is no
+	* such run. The search starts at block near and wraps around
+*/
+int block_alloc_run(file_system* fs, int count, int near);
+
+/*
+	* drop one reference to a data block, the last one puts it back on the free list
+*/
+void block_release(file_system* fs, int block);
+
+/*
+	* add a reference to a used data block, e.g. for a second file pointing to it
+*/
+void block_share(file_system* fs, int block);
+
+/*
+	* return the data block behind direct_blocks[idx] of a file, ready to be modified
+	* and marked dirty. An empty slot gets a new block, a block that is shared with
+	* other files or that the open transaction may return to is copied first; in log
+	* mode every block is. -1 if there is no free block
+*/
+int block_for_write(file_system* fs, inode* node, int idx);
+
+/*
+	* find the child of directory parent called name and return its inode number or -1
+*/
+int find_inode_by_name(file_system* fs, inode* parent, const char* name);
+
+/*
+	* resolve an absolute path ("/a/b") and return its inode number or -1.
+	* "" and "/" both resolve to the root node
+*/
+int find_inode_by_path(file_system* fs, const char* path);
+
+/*
+	* resolve the directory that contains the last component of path and return
+	* its inode number or -1. The last component is copied to name
+	* (NAME_MAX_LENGTH bytes), it has to be a valid, non-empty name
+*/
+int find_parent_by_path(file_system* fs, const char* path, char* name);
+
+/*
+ * writes the filesystem back to the image it was loaded from or created at.
+ * Only the superblock and the inodes and blocks marked dirty since the last persist
+ * are written. While a batch is open (fs->batch_depth > 0) this only marks the
+ * filesystem dirty
+ * @return 0 on success, -1 else
+ */
+int fs_persist(file_system* fs);
+
+/*
+	* remember that an inode / a data block has to be written on the next persist
+*/
+void mark_inode_dirty(file_system* fs, int inode_number);
+void mark_block_dirty(file_system* fs, int block);
+
+/*
+	* the trailer (features, snapshots) has to be written on the next persist
+*/
+void mark_trailer_dirty(file_system* fs);
+
+/*
+	* everything has to be written on the next persist
+*/
+void mark_all_dirty(file_system* fs);
+
+/*
+	* write len bytes of buf at offset into the regular file inode_number.
+	* Only the blocks covering the range are touched; blocks are allocated only for
+	* the written range, skipped ranges read as zeros.
+	* @return number of written bytes, -2 if the range doesn't fit into the file or
+	* there are no free blocks left
+*/
+int inode_pwrite(file_system* fs, int inode_number, const uint8_t* buf, size_t len, size_t offset);
+
+/*
+	* read up to len bytes at offset of the regular file inode_number into buf
+	* @return number of read bytes (0 at or past the end of the file), -3 if the
+	* inode or a block of the range doesn't match its checksum
+*/
+int inode_pread(file_system* fs, int inode_number, uint8_t* buf, size_t len, size_t offset);
+
+/*
+	* fills iov (at least DIRECT_BLOCKS_COUNT entries) with spans covering the content of an inode,
+	* pointing into data_blocks. Holes point to a shared block of zeros.
+	* The spans are valid until the filesystem is changed
+	* @return number of used entries, -3 if the inode or a block doesn't match its checksum
+*/
+int inode_spans(file_system* fs, int inode_number, struct iovec* iov);
+
+/*
+	* writes all spans to fd, continuing after partial writes
+	* @return 0 on success, -1 else
+*/
+int write_spans(int fd, struct iovec* iov, int count);
+
+/*
+	* fills the spans from fd until they are full or fd ends, continuing after partial reads
+	* @return number of read bytes, -1 on a read error
+*/
+ssize_t read_spans(int fd, struct iovec* iov, int count);
+
+/*
+	* releases all blocks of an inode and sets its size to 0
+*/
+void inode_truncate(file_system* fs, int inode_number);
+
+/*
+	* cuts a file down to size bytes, releasing the blocks past the new end. Returns 0,
+	* or the error of writing the buffered appends of the file
+*/
+int inode_shrink(file_system* fs, int inode_number, size_t size);
+
+/*
+	* add or drop one reference to every file block of an inode table
+*/
+void share_blocks(file_system* fs, inode* inodes);
+void release_blocks(file_system* fs, inode* inodes);
+
+/*
+	* recounts the block references from the inodes and snapshots and rebuilds the dedup index,
+	* after the inode table was replaced as a whole
+*/
+void fs_rebuild_refs(file_system* fs);
+
+/*
+	* dedup.c: builds the hash index over all full file blocks
+	* @return 0 on success, -1 if out of memory
+*/
+int dedup_enable(file_system* fs);
+
+/*
+	* dedup.c: drops the hash index
+*/
+void dedup_disable(file_system* fs);
+
+/*
+	* dedup.c: removes a block from the index before it is changed or freed
+*/
+void dedup_forget(file_system* fs, int block);
+
+/*
+	* dedup.c: block from was moved to the free block to, the index follows it
+*/
+void dedup_move(file_system* fs, int from, int to);
+
+/*
+	* dedup.c: brings the index from old_size to size blocks; the blocks past size must
+	* not be indexed anymore. Does nothing without dedup
+	* @return 0 on success, -1 if out of memory
+*/
+int dedup_resize(file_system* fs, uint32_t old_size, uint32_t size);
+
+/*
+	* dedup.c: if block idx of the inode is full and the same content is already
+	* stored in another block, the inode is pointed to that block instead and its
+	* own block is released. Otherwise the block is indexed. Does nothing without dedup
+*/
+void dedup_block(file_system* fs, int inode_number, int idx);
+
+/*
+	* checksum.c: allocates an empty checksum table, nothing verified yet
+	* @return 0 on success, -1 if out of memory
+*/
+int checksums_alloc(file_system* fs);
+
+/*
+	* checksum.c: computes the checksums of all inodes and blocks as they are in memory
+	* @return 0 on success, -1 if out of memory
+*/
+int checksums_enable(file_system* fs);
+
+/*
+	* checksum.c: drops the checksum table
+*/
+void checksums_disable(file_system* fs);
+
+/*
+	* checksum.c: recomputes the checksums of everything marked dirty, before it is persisted
+*/
+void checksums_update(file_system* fs);
+
+/*
+	* checksum.c: checks an inode / a block against its checksum unless that was done
+	* before or it was changed since loading. Nothing to check without checksums
+	* @return 0 if it matches, -1 else
+*/
+int checksum_verify_inode(file_system* fs, int inode_number);
+int checksum_verify_block(file_system* fs, int block);
+
+/*
+	* checksum.c: brings the table from old_size to size entries. The new inodes and blocks
+	* must be initialized already, their checksums are computed. Nothing to do without
+	* checksums
+	* @return 0 on success, -1 if out of memory
+*/
+int checksums_resize(file_system* fs, uint32_t old_size, uint32_t size);
+
+/*
+	* compress.c: allocates / frees the cache of decompressed clusters
+	* @return 0 on success, -1 if out of memory
+*/
+int cluster_cache_alloc(file_system* fs);
+void cluster_cache_free(file_system* fs);
+
+/*
+	* compress.c: drops the cached clusters stored in a block that is changed / all of them
+*/
+void cluster_cache_forget(file_system* fs, int block);
+void cluster_cache_clear(file_system* fs);
+
+/*
+	* compress.c: whether the file is stored in clusters
+*/
+int inode_compressed(file_system* fs, inode* node);
+
+/*
+	* compress.c: inode_pread, inode_pwrite, inode_spans and inode_shrink of files
+	* stored in clusters. inode_pwrite takes this path for every file while
+	* FS_FEATURE_COMPRESSION is set, a file not stored in clusters yet is converted.
+	* Spans of compressed clusters point into the cluster cache, they are valid until
+	* the filesystem is changed or other compressed files are read
+*/
+int compressed_pread(file_system* fs, int inode_number, uint8_t* buf, size_t len, size_t offset);
+int compressed_pwrite(file_system* fs, int inode_number, const uint8_t* buf, size_t len, size_t offset);
+int compressed_spans(file_system* fs, int inode_number, struct iovec* iov);
+int compressed_shrink(file_system* fs, int inode_number, size_t size);
+
+/*
+	* compress.c: stores a file in compressed clusters / back in plain blocks
+	* @return 0 on success, -2 if there are not enough free blocks, -3 if the file
+	* doesn't match its checksums
+*/
+int compress_inode(file_system* fs, int inode_number);
+int decompress_inode(file_system* fs, int inode_number);
+
+/*
+	* writeback.c: appends len bytes to the regular file inode_number through its write
+	* buffer. A full buffer or one older than WBUF_MAX_AGE_MS is flushed and persisted;
+	* if the blocks for the buffered range can't be set aside, the append is written
+	* and persisted right away
+	* @return number of written bytes, -2 if it doesn't fit into the file, or the error
+	* of flushing the full buffer
+*/
+int wbuf_append(file_system* fs, int inode_number, const uint8_t* buf, size_t len);
+
+/*
+	* writeback.c: writes the buffered appends of one file / of all files into their
+	* blocks. Nothing is persisted. Returns 0, or the error of inode_pwrite (-2 if it
+	* wrote only part); the appends that weren't written stay buffered
+*/
+int wbuf_flush_inode(file_system* fs, int inode_number);
+int wbuf_flush_all(file_system* fs);
+
+/*
+	* writeback.c: forgets the buffered appends of a file that is truncated
+*/
+void wbuf_drop(file_system* fs, int inode_number);
+
+/*
+	* writeback.c: persists the filesystem if buffered appends have waited WBUF_MAX_AGE_MS
+*/
+void wbuf_expire(file_system* fs);
+
+/*
+	* log.c: points the head of the log behind the last used block, where the
+	* log continues after loading
+*/
+void log_rewind(file_system* fs);
+
+/*
+	* the inode * DIRECT_BLOCKS_COUNT + index of the only live pointer to each block,
+	* -1 if there is none, -2 if the block is shared. NULL if out of memory, free() the result
+*/
+int* block_owners(file_system* fs);
+
+/*
+	* serializes the trailer into a malloc'd buffer, NULL if there is none.
+	* The per-entry tables (generations, checksums) are left out unless with_tables is set
+*/
+uint8_t* trailer_serialize(file_system* fs, size_t* len, int with_tables);
+
+/*
+	* reads trailer chunks from fs_file until it ends; snapshots are appended
+*/
+void trailer_parse(file_system* fs, FILE* fs_file);
+
+/*
+	* frees all snapshots
+*/
+void snapshots_free(file_system* fs);
+
+/*
+	* sets root_node to the directory named "/"
+*/
+void find_root(file_system* fs);
+
+/*
+	* invalidate the open handles of an inode that is being freed
 */
-int find_free_inode(file_system* fs);
+void close_handles(file_system* fs, int inode_number);
 
 /*
 	* frees up memory
@@ -0,0 +1,22 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Compresses len bytes of src into dst (cap bytes) with a byte oriented LZ77 codec
+ * in the style of LZ4: sequences of a token, literals, a 2 byte offset and the
+ * length of a match of at least 4 bytes. Safe to call from several threads
+ * @return compressed length, -1 if it doesn't fit into cap bytes
+ */
+int lz_compress(const uint8_t* src, size_t len, uint8_t* dst, size_t cap);
+
+/*
+ * Decompresses len bytes of src into dst (cap bytes). Malformed input is detected,
+ * nothing is read or written out of bounds
+ * @return decompressed length, -1 if src is malformed or doesn't fit into cap bytes
+ */
+int lz_decompress(const uint8_t* src, size_t len, uint8_t* dst, size_t cap);
+
+#endif //LZ_H
@@ -1,7 +1,9 @@
 #ifndef OPERATIONS_H
 
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/uio.h>
 
 #include "../lib/filesystem.h"
 
@@ -43,9 +45,22 @@ int fs_mkfile(file_system *fs, char *path_and_name);
  */
 char *fs_list(file_system *fs, char *path);
 
+/**
+ * Same listing as fs_list, written into a caller-provided buffer of size
+ * bytes (including the terminating zero byte). If it does not fit, nothing
+ * is written, so a caller can grow its buffer to the returned length + 1 and
+ * retry.
+ *
+ * @Returns:
+ * length of the listing without the terminating zero byte
+ * -1 if the given path was not found
+ */
+int fs_list_into(file_system *fs, char *path, char *buffer, size_t size);
+
 /**
  * Write (append, not overwrite) @param text to a file pointed to by @param
- * filename The file must exist before it can be written to
+ * filename The file must exist before it can be written to. Use fs_pwrite for
+ * data that may contain zero bytes.
  *
  * @Returns:
  * number of written chars on success
@@ -57,12 +72,128 @@ int fs_writef(file_system *fs, char *filename, char *text);
 /**
  * Reads a file and allocates memory for a uint8_t buffer (array). Reads this
  * file into the buffer writes the file_size into the memory pointed to by int*
- * file_size
+ * file_size. The buffer is followed by a terminating zero byte.
  *
- * @Returns the buffer or NULL if the file does not exist
+ * @Returns the buffer or NULL if the file does not exist, is empty or
+ * doesn't match its checksums
  */
 uint8_t *fs_readf(file_system *fs, char *filename, int *file_size);
 
+/**
+ * Reads a file into a caller-provided buffer of size bytes. No terminating
+ * zero byte is added. If the file is larger than the buffer, nothing is
+ * written, so a caller can grow its buffer to the returned size and retry.
+ *
+ * @Returns:
+ * size of the file
+ * -1 if the file does not exist
+ * -3 if the file doesn't match its checksums
+ */
+int fs_readf_into(file_system *fs, char *filename, uint8_t *buffer, size_t size);
+
+// number of iovec entries fs_readv may fill
+#define FS_MAX_SPANS DIRECT_BLOCKS_COUNT
+
+/**
+ * Reads a file without copying it: fills iov with up to FS_MAX_SPANS
+ * (pointer, length) spans pointing directly into the data blocks, in file
+ * order. The spans must not be written to and are only valid until the next
+ * change of the filesystem; nothing has to be released. They can be passed
+ * to writev as they are. Spans of compressed files point into a cache of
+ * decompressed data instead, which reading other compressed files may reuse.
+ *
+ * @Returns:
+ * number of used iov entries (0 for an empty file)
+ * -1 if the file is not available
+ * -3 if the file doesn't match its checksums
+ */
+int fs_readv(file_system *fs, char *filename, struct iovec *iov);
+
+/**
+ * Writes len bytes of buf at byte offset of an existing file. The data may
+ * contain zero bytes. Only the blocks covering the range are touched and
+ * blocks are allocated only for the written range; a gap between the old end
+ * of the file and offset reads as zeros.
+ *
+ * @Returns:
+ * number of written bytes on success (less than len if the filesystem ran
+ * out of blocks)
+ * -1 if the file is not available
+ * -2 if the range doesn't fit into the file or no block is left
+ */
+int fs_pwrite(file_system *fs, char *filename, const uint8_t *buf, size_t len, size_t offset);
+
+/**
+ * Reads up to len bytes at byte offset of a file into buf.
+ *
+ * @Returns:
+ * number of read bytes, 0 at or past the end of the file
+ * -1 if the file is not available
+ * -3 if the range doesn't match its checksums
+ */
+int fs_pread(file_system *fs, char *filename, uint8_t *buf, size_t len, size_t offset);
+
+// fs_open flag: every fs_write appends at the current end of the file
+#define FS_O_APPEND 1
+
+/**
+ * Opens an existing file. The path is resolved once; the handle keeps the
+ * inode number and the current offset (starting at 0), so fs_read/fs_write
+ * don't walk the directory tree again.
+ * If the file is removed the handle becomes invalid, but still has to be closed.
+ *
+ * @Returns the handle or NULL if the file is not available
+ */
+fs_handle *fs_open(file_system *fs, char *filename, int flags);
+
+/**
+ * Reads up to len bytes at the offset of the handle and advances it.
+ *
+ * @Returns:
+ * number of read bytes, 0 at the end of the file
+ * -1 if the handle is invalid
+ * -3 if the range doesn't match its checksums
+ */
+int fs_read(file_system *fs, fs_handle *handle, uint8_t *buf, size_t len);
+
+/**
+ * Writes len bytes at the offset of the handle (at the end of the file with
+ * FS_O_APPEND) and advances it. Same semantics as fs_pwrite.
+ *
+ * @Returns:
+ * number of written bytes
+ * -1 if the handle is invalid
+ * -2 if the range doesn't fit into the file or no block is left
+ */
+int fs_write(file_system *fs, fs_handle *handle, const uint8_t *buf, size_t len);
+
+/**
+ * Moves the offset of the handle like lseek. whence is SEEK_SET, SEEK_CUR
+ * or SEEK_END.
+ *
+ * @Returns the new offset or -1 if it would be outside of 0..maximum file size
+ */
+long fs_seek(file_system *fs, fs_handle *handle, long offset, int whence);
+
+/**
+ * Closes a handle returned by fs_open and frees it.
+ *
+ * @Returns: 0 on success, else -1
+ */
+int fs_close(file_system *fs, fs_handle *handle);
+
+/**
+ * Copies the file src to the new file dst without copying data: dst shares
+ * the blocks of src, which are reference counted. A block is copied on the
+ * first write to it from either file.
+ *
+ * @Returns:
+ * 0 on success
+ * -1 if src is not a file or the parent directory of dst was not found or is full
+ * -2 if dst already exists
+ */
+int fs_clone(file_system *fs, char *src, char *dst);
+
 /**
  * Deletes a file or a directory recursively.
  *
@@ -74,7 +205,9 @@ int fs_rm(file_system *fs, char *path);
 
 /**
  * Imports the file and saves it in the current filesystem under the path
- * pointed to by the second parameter
+ * pointed to by the second parameter. An existing file is overwritten,
+ * otherwise the file is created. The file is streamed from the host directly
+ * into the data blocks, without buffering it as a whole.
  *
  * @Param: char* int_path path where the imported file should be saved in the
  * internal file system
@@ -83,19 +216,383 @@ int fs_rm(file_system *fs, char *path);
  * @Returns:
  * 0 on success
  * -1 if the file or directory wasn't found
+ * -2 if the file is too big or not enough blocks are free
  */
 int fs_import(file_system *fs, char *int_path, char *ext_path);
 
+/**
+ * Imports the host directory ext_dir recursively into the existing internal
+ * directory int_dir. Directories are created (or reused), files are created
+ * or overwritten like with fs_import. The namespace is built first, then
+ * nthreads threads read the host files directly into their blocks. The
+ * filesystem is persisted once at the end.
+ * Host entries that are neither directories nor regular files are skipped.
+ *
+ * @Returns:
+ * number of host entries that could not be imported, 0 if all were imported
+ * -1 if int_dir or ext_dir is not a directory or persisting failed
+ */
+int fs_import_tree(file_system *fs, char *int_dir, char *ext_dir, int nthreads);
+
+/**
+ * Makes the internal directory int_dir match the host directory ext_dir,
+ * recursively: missing entries are created, entries missing on the host or
+ * of a different kind are removed, and files are compared block by block so
+ * only blocks that differ are written. The filesystem is persisted once.
+ *
+ * @Returns:
+ * number of entries that could not be synced, 0 if all were synced
+ * -1 if int_dir or ext_dir is not a directory or persisting failed
+ */
+int fs_sync_dir(file_system *fs, char *int_dir, char *ext_dir);
+
 /**
  * Exports the file and saves it in the external filesystem under the path pointed to by the second parameter
+ * An existing external file is overwritten. The blocks are written from where they are, without assembling the
+ * file in a buffer first.
  * @Param: char* int_path path where the exported file lives
  * @Param: char* ext_path path where the file should be saved in the external filesystem
  *
  * @Returns:
  * 0 on success
- * -1 if the file or directory wasn't found
+ * -1 if the file or directory wasn't found or the external file could not be written
+ * -3 if the file doesn't match its checksums (nothing is written)
  */
 int fs_export(file_system *fs, char *int_path, char *ext_path);
 
+/**
+ * Exports the internal directory int_dir recursively to the host directory
+ * ext_dir, which is created if needed. Host directories are created first,
+ * then nthreads threads write the files directly from their blocks. Existing
+ * host files are overwritten.
+ *
+ * @Returns:
+ * number of entries that could not be exported, 0 if all were exported
+ * -1 if int_dir is not a directory
+ */
+int fs_export_tree(file_system *fs, char *int_dir, char *ext_dir, int nthreads);
+
+enum fs_batch_op {
+    FS_BATCH_MKDIR = 1,  // path
+    FS_BATCH_MKFILE = 2, // path
+    FS_BATCH_WRITEF = 3, // path, arg = text
+    FS_BATCH_RM = 4,     // path
+    FS_BATCH_IMPORT = 5, // path = int_path, arg = ext_path
+    FS_BATCH_EXPORT = 6  // path = int_path, arg = ext_path
+};
+
+/**
+ * One operation of fs_batch_exec. status receives the return value of the
+ * corresponding fs_* function.
+ */
+typedef struct _fs_op {
+    enum fs_batch_op op;
+    char *path;
+    char *arg;
+    int status;
+} fs_op;
+
+/**
+ * Starts a batch: until the matching fs_batch_commit the operations only
+ * change the filesystem in memory and are persisted once at the end.
+ * Batches nest, only the outermost commit persists.
+ *
+ * @Returns: 0 on success, else -1
+ */
+int fs_batch_begin(file_system *fs);
+
+/**
+ * Ends a batch started with fs_batch_begin and persists all changes made
+ * during the batch with a single write. A batch started before an open
+ * transaction can't end before it.
+ *
+ * @Returns: 0 on success, else -1 (no open batch, the transaction is still
+ * open or persisting failed)
+ */
+int fs_batch_commit(file_system *fs);
+
+/**
+ * Executes count operations in one batch and persists once.
+ * The result of every operation is stored in its status field.
+ *
+ * @Returns:
+ * the number of operations that failed
+ * -1 if the changes could not be persisted
+ */
+int fs_batch_exec(file_system *fs, fs_op *ops, int count);
+
+/**
+ * Starts a transaction. All following operations are applied to a private
+ * copy of the inodes and the free list; data blocks of the previous state are
+ * copied before they are modified. Nothing is persisted until the commit.
+ * Only one transaction can be open at a time.
+ *
+ * @Returns: 0 on success, else -1
+ */
+int fs_txn_begin(file_system *fs);
+
+/**
+ * Commits the open transaction by replacing the image in a single atomic
+ * step (write to a temporary file, then rename). If that fails the
+ * transaction stays open. Inside a batch the batch commit persists instead.
+ * Batches started inside the transaction have to be committed first.
+ *
+ * @Returns: 0 on success, else -1
+ */
+int fs_txn_commit(file_system *fs);
+
+/**
+ * Discards every change made since fs_txn_begin, including batches started
+ * inside the transaction. Open handles become invalid.
+ *
+ * @Returns: 0 on success, -1 if no transaction is open
+ */
+int fs_txn_abort(file_system *fs);
+
+/**
+ * Switches block deduplication on or off. The setting is stored in the image.
+ * While it is on, every full block written by fs_writef, fs_pwrite, fs_write
+ * or an import is hashed. If another block already has the same content, the
+ * file shares that block instead (reference counted) and the new block is
+ * freed. Writing into a shared block copies it first. Blocks written before
+ * deduplication was switched on are not merged.
+ * Not possible while a transaction is open.
+ *
+ * @Returns: 0 on success, -1 else
+ */
+int fs_set_dedup(file_system *fs, int enabled);
+
+/**
+ * Switches checksums on or off. The setting and the checksums are stored in
+ * the image. While it is on, every inode and block has a CRC32C that is
+ * updated when it is persisted. An inode or block is verified the first time
+ * it is read after loading; reads of data that doesn't match fail with -3.
+ * Switching on takes the current content as correct.
+ * Not possible while a transaction is open.
+ *
+ * @Returns: 0 on success, -1 else
+ */
+int fs_set_checksums(file_system *fs, int enabled);
+
+/**
+ * Switches the log-structured write mode on or off. The setting is stored in
+ * the image. While it is on, data blocks are never overwritten: every write
+ * puts the new content into the next free block at the head of a circular log
+ * and frees the old block, so the writes of a session land one after the
+ * other. The inodes stay in place and point to the newest copies.
+ * Not possible while a transaction is open.
+ *
+ * @Returns: 0 on success, -1 else
+ */
+int fs_set_log(file_system *fs, int enabled);
+
+/**
+ * Switches transparent compression on or off. The setting is stored in the
+ * image. While it is on, files are written in clusters of 4 blocks, and a
+ * cluster that compresses into fewer blocks is stored compressed; reads
+ * decompress it, keeping recently read clusters in a cache. A write rewrites
+ * the clusters from the first one it changes to the end of the file.
+ * Switching on compresses the existing files, switching off stores them
+ * uncompressed again, which fails while a snapshot holds compressed files.
+ *
+ * @Returns: 0 on success, -1 if it can't be switched, -2 if there are not
+ * enough free blocks to decompress every file
+ */
+int fs_set_compression(file_system *fs, int enabled);
+
+/**
+ * Switches write buffering for this session on or off; it isn't stored in
+ * the image. While it is on, appends smaller than a few blocks (fs_writef, and
+ * fs_pwrite or fs_write at the end of a file) are collected in memory per
+ * file. Their blocks are allocated only when the buffer is flushed, as one
+ * contiguous run if possible. A buffer is flushed when it is full, when its
+ * file is read or otherwise changed, and with everything else by fs_flush
+ * and by any operation that persists the filesystem. There is no timer: the
+ * next append persists the buffers once the first one is older than 100 ms,
+ * and only a server (fs_serve) also does so while it is idle. Library callers
+ * that stop appending have to call fs_flush; until then a crash loses the
+ * buffered appends. Switching off flushes.
+ *
+ * @Returns: 0 on success, -1 else
+ */
+int fs_set_write_buffering(file_system *fs, int enabled);
+
+/**
+ * Writes the buffered appends into their blocks and persists the filesystem.
+ * Appends that can't be written stay buffered, nothing is persisted then.
+ *
+ * @Returns: 0 on success, -1 else
+ */
+int fs_flush(file_system *fs);
+
+/**
+ * Cleans the log: segments (runs of 32 blocks) the head of the log has left
+ * behind with at most half of their blocks still in use get those blocks
+ * moved to the head, so the whole segment is free when the log wraps around.
+ * Segments with shared, snapshot-only or damaged blocks are left alone. At
+ * most budget blocks are moved (0: no limit); a server cleans while it is
+ * idle. Spans returned by fs_readv become invalid.
+ *
+ * @Returns: the number of moved blocks, -1 if the log mode is off or on failure
+ */
+int fs_log_clean(file_system *fs, uint32_t budget);
+
+/**
+ * What fs_scrub found
+ */
+typedef struct _fs_scrub_report {
+    uint32_t bad_inodes;
+    uint32_t bad_blocks;
+} fs_scrub_report;
+
+/**
+ * Persists the filesystem, then reads the whole image back with nthreads
+ * threads (< 1: one per CPU) and checks every inode and block against its
+ * checksum. Nothing is changed. report may be NULL.
+ *
+ * @Returns: the number of damaged inodes and blocks, -1 if checksums are off,
+ * a batch is open or the image could not be read
+ */
+int fs_scrub(file_system *fs, int nthreads, fs_scrub_report *report);
+
+/**
+ * Takes a named snapshot of the whole filesystem. Only the inode table is
+ * copied; the snapshot shares all data blocks with the live files and a
+ * block is copied when it is written to, so a snapshot costs the inode table
+ * plus the blocks changed afterwards. Snapshots are stored in the image.
+ * Not possible while a transaction is open.
+ *
+ * @Returns:
+ * 0 on success
+ * -1 if the name is empty or too long or a transaction is open
+ * -2 if a snapshot with this name exists
+ */
+int fs_snapshot_create(file_system *fs, char *name);
+
+/**
+ * Deletes a snapshot. Blocks only it still used become free.
+ *
+ * @Returns: 0 on success, -1 if there is no such snapshot
+ */
+int fs_snapshot_delete(file_system *fs, char *name);
+
+/**
+ * Returns the whole filesystem to the state of a snapshot. The snapshot is
+ * kept. Open handles become invalid.
+ *
+ * @Returns: 0 on success, -1 if there is no such snapshot
+ */
+int fs_snapshot_restore(file_system *fs, char *name);
+
+/**
+ * Lists the snapshots, oldest first, one name per line.
+ *
+ * @Returns a malloc'd string or NULL
+ */
+char *fs_snapshot_list(file_system *fs);
+
+/**
+ * fs_list and fs_readf on the state of a snapshot
+ */
+char *fs_snapshot_ls(file_system *fs, char *name, char *path);
+uint8_t *fs_snapshot_readf(file_system *fs, char *name, char *filename, int *file_size);
+
+/**
+ * Writes a delta of everything changed after generation since to ext_path:
+ * the superblock, the changed inodes and the changed blocks with their free
+ * list entries, and the snapshots if they changed. since 0 writes a full
+ * delta. Changes are stamped with the current generation, which is
+ * increased by every delta export, so the returned generation is the since
+ * of the next delta. From the first export on the stamps are stored in the
+ * image.
+ *
+ * @Returns the generation the delta ends with, or -1 on failure
+ */
+int fs_delta_export(file_system *fs, uint32_t since, char *ext_path);
+
+/**
+ * Applies a delta written by fs_delta_export to a filesystem of the same
+ * size. A full delta can be applied to any image, any other delta only to an
+ * image the delta it follows was applied to last. A damaged or incomplete
+ * delta is rejected before anything is changed.
+ *
+ * @Returns:
+ * 0 on success
+ * -1 if the delta could not be read or does not fit the filesystem
+ * -2 if the delta does not follow the last applied one
+ */
+int fs_delta_apply(file_system *fs, char *ext_path);
+
+/**
+ * What fs_fsck found, one counter per kind of problem
+ */
+typedef struct _fs_fsck_report {
+    uint32_t bad_links;      // directory entries pointing nowhere, to a free or an already linked inode, or with a wrong parent
+    uint32_t orphans;        // used inodes not reachable from the root
+    uint32_t bad_block_refs; // block numbers out of range
+    uint32_t free_but_used;  // blocks in the free list a file still uses
+    uint32_t leaked_blocks;  // blocks no file uses that are not in the free list
+    uint32_t bad_free_count; // 1 if the superblock's free block count is wrong
+} fs_fsck_report;
+
+/**
+ * Checks the directory tree, the inodes' block lists, the free list and the
+ * free block count against each other. The inode table and the block range
+ * are split across nthreads threads (< 1: one per CPU). With repair the
+ * problems are fixed: bad entries are dropped, parent links and the free list
+ * rebuilt from the tree, orphans freed, and the image written. Without repair
+ * nothing is changed, so it can run on a filesystem in use. report may be
+ * NULL.
+ *
+ * @Returns: the number of problems found, -1 on failure
+ */
+int fs_fsck(file_system *fs, int repair, int nthreads, fs_fsck_report *report);
+
+/**
+ * Changes the number of blocks (and inodes) of the filesystem. Growing adds
+ * free blocks and inodes. Shrinking first moves the blocks and inodes
+ * numbered num_blocks and above, of the files and of the snapshots, into free
+ * ones below; open handles follow their file. The first resize writes the
+ * image once as a whole, atomically, in a layout whose free list and inode
+ * table have room for twice the size. From then on the image is changed in
+ * place as long as the tables have room: growing appends empty blocks,
+ * shrinking cuts the image after the last block, and only the moved entries
+ * and the trailer are written. Not possible inside a batch or transaction.
+ *
+ * @Returns:
+ * 0 on success
+ * -1 on failure
+ * -2 if the used blocks or inodes don't fit into num_blocks
+ * -3 if an inode or block that would be moved or changed doesn't match its
+ * checksum
+ */
+int fs_resize(file_system *fs, uint32_t num_blocks);
+
+/**
+ * What fs_defrag did. A score is the per mille of steps from one block of a
+ * file to the next that don't go to the following block: 0 means every file
+ * is contiguous.
+ */
+typedef struct _fs_defrag_report {
+    uint32_t score_before;
+    uint32_t score_after;
+    uint32_t moved_blocks;
+    uint32_t pinned_blocks; // shared, snapshot-only or damaged blocks left in place
+} fs_defrag_report;
+
+/**
+ * Moves the blocks of the files into contiguous runs from the start of the
+ * data blocks, directory by directory, the files of one directory next to
+ * each other. Blocks are swapped, so no free space is needed. At most budget
+ * blocks are moved (0: no limit); the next call continues where a limited
+ * one stopped, so defragmenting can be spread over idle times. Blocks shared
+ * with other files or snapshots stay where they are. Spans returned by
+ * fs_readv become invalid. report may be NULL.
+ *
+ * @Returns: the number of moved blocks, -1 on failure
+ */
+int fs_defrag(file_system *fs, uint32_t budget, fs_defrag_report *report);
+
 #define OPERATIONS_H
+
 #endif /* OPERATIONS_H */
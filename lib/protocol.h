@@ -0,0 +1,65 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+
+/*
+ * Wire format spoken between `ha2 --serve` and its clients (see client.h).
+ * The socket is local, so every integer is sent in host byte order.
+ *
+ * request:  fs_req_header followed by header.len payload bytes. The payload
+ *           starts with header.nargs NUL-terminated strings (the paths); all
+ *           bytes after the last string are the raw data argument (the text
+ *           of WRITEF).
+ * response: fs_resp_header followed by header.len payload bytes (the listing
+ *           of LIST, the file content of READF and PREAD, the report of FSCK). status carries the
+ *           return value of the operation.
+ *
+ * Requests of one connection are answered in the order they were sent, so a
+ * client may pipeline many requests before reading the first response.
+ */
+
+#define FS_PROTO_MAX_PAYLOAD (16 * 1024 * 1024)
+#define FS_PROTO_MAX_ARGS 4
+
+//status of a request the server could not decode
+#define FS_PROTO_BAD_REQUEST -100
+
+enum fs_proto_op{
+	FS_OP_MKDIR=1,   //path
+	FS_OP_MKFILE=2,  //path
+	FS_OP_LIST=3,    //path
+	FS_OP_WRITEF=4,  //path, data=text
+	FS_OP_READF=5,   //path
+	FS_OP_RM=6,      //path
+	FS_OP_IMPORT=7,  //int_path, ext_path
+	FS_OP_EXPORT=8,  //int_path, ext_path
+	FS_OP_DUMP=9,    //-
+	FS_OP_BATCH_BEGIN=10,  //- defer persisting until the matching BATCH_COMMIT
+	FS_OP_BATCH_COMMIT=11, //-
+	FS_OP_PWRITE=12, //path, data=fs_proto_range followed by the bytes to write
+	FS_OP_PREAD=13,  //path, data=fs_proto_range
+	FS_OP_FSCK=14    //- report only, the payload of the response is an fs_fsck_report
+};
+
+//offset (and length for PREAD) of a byte range request
+typedef struct _fs_proto_range{
+	uint64_t offset;
+	uint32_t len;
+	uint32_t reserved;
+} fs_proto_range;
+
+typedef struct _fs_req_header{
+	uint32_t len; //payload bytes following the header
+	uint32_t id; //echoed in the response
+	uint16_t op; //enum fs_proto_op
+	uint16_t nargs; //number of NUL-terminated strings at the start of the payload
+} fs_req_header;
+
+typedef struct _fs_resp_header{
+	uint32_t len; //payload bytes following the header
+	uint32_t id; //id of the answered request
+	int32_t status; //return value of the operation
+} fs_resp_header;
+
+#endif //PROTOCOL_H
@@ -0,0 +1,19 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "../lib/filesystem.h"
+
+/**
+	* Keeps fs resident and serves the operations of operations.h to local
+	* clients over a UNIX domain socket (protocol.h). All clients share the one
+	* loaded filesystem; requests are executed one at a time by a single epoll loop.
+	* Returns after SIGINT/SIGTERM, persisting the filesystem before it does.
+	* @param file_system* fs the filesystem to serve
+	* @param const char* socket_path where to create the socket. A socket left there by
+	* a server that is gone is replaced; if a server still answers on it, or the path
+	* is something else, fs_serve fails
+	* @return 0 on a clean shutdown, -1 if the socket could not be set up
+**/
+int fs_serve(file_system* fs, const char* socket_path);
+
+#endif //SERVER_H
@@ -0,0 +1,269 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../lib/crc32c.h"
+#include "../lib/filesystem.h"
+#include "../lib/operations.h"
+
+//entries read from the image at once by a scrub thread
+#define SCRUB_CHUNK 256
+
+//the checksums cover the whole stored record
+static uint32_t inode_checksum(const void* node){
+	return crc32c(0, node, sizeof(inode));
+}
+
+static uint32_t block_checksum(const void* block){
+	return crc32c(0, block, sizeof(data_block));
+}
+
+
+int checksums_alloc(file_system* fs){
+	if(fs->csum != NULL){
+		return 0;
+	}
+	uint32_t size = fs->s_block->num_blocks;
+	checksum_table* table = malloc(sizeof(checksum_table));
+	if(table == NULL){
+		return -1;
+	}
+	table->inodes = malloc(size * sizeof(uint32_t));
+	table->blocks = malloc(size * sizeof(uint32_t));
+	table->inode_ok = calloc(size, 1);
+	table->block_ok = calloc(size, 1);
+	if(table->inodes == NULL || table->blocks == NULL || table->inode_ok == NULL || table->block_ok == NULL){
+		free(table->inodes);
+		free(table->blocks);
+		free(table->inode_ok);
+		free(table->block_ok);
+		free(table);
+		return -1;
+	}
+	fs->csum = table;
+	return 0;
+}
+
+
+int checksums_enable(file_system* fs){
+	if(checksums_alloc(fs) != 0){
+		return -1;
+	}
+	uint32_t size = fs->s_block->num_blocks;
+	for (uint32_t i=0; i<size; i++) {
+		fs->csum->inodes[i] = inode_checksum(&fs->inodes[i]);
+		fs->csum->blocks[i] = block_checksum(&fs->data_blocks[i]);
+	}
+	memset(fs->csum->inode_ok, 1, size);
+	memset(fs->csum->block_ok, 1, size);
+	return 0;
+}
+
+
+void checksums_disable(file_system* fs){
+	if(fs->csum == NULL){
+		return;
+	}
+	free(fs->csum->inodes);
+	free(fs->csum->blocks);
+	free(fs->csum->inode_ok);
+	free(fs->csum->block_ok);
+	free(fs->csum);
+	fs->csum = NULL;
+}
+
+
+void checksums_update(file_system* fs){
+	if(fs->csum == NULL){
+		return;
+	}
+	if(fs->dirty_all){
+		//entries not verified since loading keep their checksum: it still describes the
+		//image, recomputing it would take a damaged entry as correct
+		for (uint32_t i=0; i<fs->s_block->num_blocks; i++) {
+			if(fs->csum->inode_ok[i]){
+				fs->csum->inodes[i] = inode_checksum(&fs->inodes[i]);
+			}
+			if(fs->csum->block_ok[i]){
+				fs->csum->blocks[i] = block_checksum(&fs->data_blocks[i]);
+			}
+		}
+		return;
+	}
+	for (uint32_t i=0; i<fs->dirty_inodes.count; i++) {
+		uint32_t n = fs->dirty_inodes.list[i];
+		fs->csum->inodes[n] = inode_checksum(&fs->inodes[n]);
+	}
+	for (uint32_t i=0; i<fs->dirty_blocks.count; i++) {
+		uint32_t n = fs->dirty_blocks.list[i];
+		fs->csum->blocks[n] = block_checksum(&fs->data_blocks[n]);
+	}
+}
+
+
+/*
+ * Readers may verify the same entry from several threads (parallel export); all of
+ * them only ever store 1 into the ok flag
+ */
+int checksum_verify_inode(file_system* fs, int inode_number){
+	checksum_table* table = fs->csum;
+	if(table == NULL || table->inode_ok[inode_number]){
+		return 0;
+	}
+	if(inode_checksum(&fs->inodes[inode_number]) != table->inodes[inode_number]){
+		return -1;
+	}
+	table->inode_ok[inode_number] = 1;
+	return 0;
+}
+
+
+int checksum_verify_block(file_system* fs, int block){
+	checksum_table* table = fs->csum;
+	if(table == NULL || table->block_ok[block]){
+		return 0;
+	}
+	if(block_checksum(&fs->data_blocks[block]) != table->blocks[block]){
+		return -1;
+	}
+	table->block_ok[block] = 1;
+	return 0;
+}
+
+
+int checksums_resize(file_system* fs, uint32_t old_size, uint32_t size){
+	checksum_table* table = fs->csum;
+	if(table == NULL){
+		return 0;
+	}
+	if(resize_array(&table->inodes, old_size, size, sizeof(uint32_t)) != 0
+	   || resize_array(&table->blocks, old_size, size, sizeof(uint32_t)) != 0
+	   || resize_array(&table->inode_ok, old_size, size, sizeof(uint8_t)) != 0
+	   || resize_array(&table->block_ok, old_size, size, sizeof(uint8_t)) != 0){
+		return -1;
+	}
+	for (uint32_t i=old_size; i<size; i++) {
+		table->inodes[i] = inode_checksum(&fs->inodes[i]);
+		table->blocks[i] = block_checksum(&fs->data_blocks[i]);
+		table->inode_ok[i] = 1;
+		table->block_ok[i] = 1;
+	}
+	return 0;
+}
+
+
+typedef struct _scrub_part{
+	file_system* fs;
+	int fd;
+	uint32_t start;
+	uint32_t end;
+	int failed; //the image could not be read
+	fs_scrub_report report;
+} scrub_part;
+
+/*
+ * reads the entries start..end of entry_size bytes of the image region at offset in
+ * chunks and counts those not matching their checksum in expected
+ */
+static uint32_t scrub_region(scrub_part* part, off_t offset, size_t entry_size, const uint32_t* expected,
+                             uint32_t (*checksum)(const void*), int* failed){
+	uint32_t bad = 0;
+	uint8_t* buf = malloc(SCRUB_CHUNK * entry_size);
+	if(buf == NULL){
+		*failed = 1;
+		return 0;
+	}
+	for (uint32_t i=part->start; i<part->end; i+=SCRUB_CHUNK) {
+		uint32_t count = part->end - i < SCRUB_CHUNK ? part->end - i : SCRUB_CHUNK;
+		size_t len = count * entry_size;
+		if(pread(part->fd, buf, len, offset + (off_t)i * entry_size) != (ssize_t)len){
+			*failed = 1;
+			break;
+		}
+		for (uint32_t j=0; j<count; j++) {
+			bad += checksum(buf + j * entry_size) != expected[i + j];
+		}
+	}
+	free(buf);
+	return bad;
+}
+
+static void* scrub_worker(void* arg){
+	scrub_part* part = arg;
+	file_system* fs = part->fs;
+	image_layout layout = layout_of(fs);
+	part->report.bad_inodes = scrub_region(part, layout.inodes, sizeof(inode), fs->csum->inodes, inode_checksum, &part->failed);
+	part->report.bad_blocks = scrub_region(part, layout.data, sizeof(data_block), fs->csum->blocks, block_checksum, &part->failed);
+	return NULL;
+}
+
+
+int fs_scrub(file_system *fs, int nthreads, fs_scrub_report *report){
+	//the checksums have to describe what is in the image
+	if(fs == NULL || fs->csum == NULL || fs->batch_depth > 0 || fs_persist(fs) != 0){
+		return -1;
+	}
+	int fd = open(fs->path, O_RDONLY);
+	if(fd < 0){
+		return -1;
+	}
+	if(nthreads < 1){
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if(nthreads < 1){
+		nthreads = 1;
+	}
+	scrub_part* parts = calloc(nthreads, sizeof(scrub_part));
+	pthread_t* threads = malloc(nthreads * sizeof(pthread_t));
+	uint8_t* started = calloc(nthreads, 1);
+	if(parts == NULL || threads == NULL || started == NULL){
+		free(parts);
+		free(threads);
+		free(started);
+		close(fd);
+		return -1;
+	}
+
+	uint32_t size = fs->s_block->num_blocks;
+	uint32_t chunk = (size + nthreads - 1) / nthreads;
+	for (int i=0; i<nthreads; i++) {
+		parts[i].fs = fs;
+		parts[i].fd = fd;
+		parts[i].start = (uint64_t)chunk * i < size ? chunk * i : size;
+		parts[i].end = size - parts[i].start > chunk ? parts[i].start + chunk : size;
+	}
+	//part 0 runs here, as does every part whose thread could not be started
+	for (int i=1; i<nthreads; i++) {
+		if(pthread_create(&threads[i], NULL, scrub_worker, &parts[i]) == 0){
+			started[i] = 1;
+		}else{
+			scrub_worker(&parts[i]);
+		}
+	}
+	scrub_worker(&parts[0]);
+
+	fs_scrub_report total = { 0 };
+	int failed = 0;
+	for (int i=0; i<nthreads; i++) {
+		if(started[i]){
+			pthread_join(threads[i], NULL);
+		}
+		total.bad_inodes += parts[i].report.bad_inodes;
+		total.bad_blocks += parts[i].report.bad_blocks;
+		failed |= parts[i].failed;
+	}
+	free(parts);
+	free(threads);
+	free(started);
+	close(fd);
+	if(failed){
+		return -1;
+	}
+	if(report != NULL){
+		*report = total;
+	}
+	return total.bad_inodes + total.bad_blocks;
+}
@@ -0,0 +1,280 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../lib/client.h"
+#include "../lib/protocol.h"
+
+struct _fs_client{
+	int fd;
+	uint32_t next_id;
+};
+
+
+fs_client* fsc_connect(const char* socket_path){
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(socket_path) >= sizeof(addr.sun_path)){
+		return NULL;
+	}
+	strcpy(addr.sun_path, socket_path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd < 0){
+		return NULL;
+	}
+	if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0){
+		close(fd);
+		return NULL;
+	}
+
+	fs_client* c = malloc(sizeof(fs_client));
+	if(c == NULL){
+		close(fd);
+		return NULL;
+	}
+	c->fd = fd;
+	c->next_id = 1;
+	return c;
+}
+
+
+void fsc_close(fs_client* c){
+	if(c == NULL){
+		return;
+	}
+	close(c->fd);
+	free(c);
+}
+
+
+static int write_all(int fd, struct iovec* iov, int iovcnt){
+	while (iovcnt > 0) {
+		ssize_t written = writev(fd, iov, iovcnt);
+		if(written < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		//skip what has been written, possibly ending in the middle of an iovec
+		while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if(iovcnt > 0){
+			iov->iov_base = (uint8_t*)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	return 0;
+}
+
+
+static int read_all(int fd, void* buf, size_t len){
+	uint8_t* p = buf;
+	while (len > 0) {
+		ssize_t received = read(fd, p, len);
+		if(received < 0 && errno == EINTR){
+			continue;
+		}
+		if(received <= 0){
+			return -1;
+		}
+		p += received;
+		len -= received;
+	}
+	return 0;
+}
+
+
+uint32_t fsc_send(fs_client* c, uint16_t op, uint16_t nargs, const char* const* args, const void* data, uint32_t data_len){
+	if(nargs > FS_PROTO_MAX_ARGS){
+		return 0;
+	}
+
+	struct iovec iov[FS_PROTO_MAX_ARGS + 2];
+	fs_req_header header = { .len = data_len, .id = c->next_id, .op = op, .nargs = nargs };
+	iov[0].iov_base = &header;
+	iov[0].iov_len = sizeof(header);
+	for (int i=0; i<nargs; i++) {
+		iov[i + 1].iov_base = (void*)args[i];
+		iov[i + 1].iov_len = strlen(args[i]) + 1;
+		header.len += iov[i + 1].iov_len;
+	}
+	iov[nargs + 1].iov_base = (void*)data;
+	iov[nargs + 1].iov_len = data_len;
+
+	if(header.len > FS_PROTO_MAX_PAYLOAD || write_all(c->fd, iov, nargs + 2) != 0){
+		return 0;
+	}
+	if(++c->next_id == 0){
+		c->next_id = 1;
+	}
+	return header.id;
+}
+
+
+int fsc_recv(fs_client* c, fsc_response* response){
+	fs_resp_header header;
+	if(read_all(c->fd, &header, sizeof(header)) != 0){
+		return -1;
+	}
+	response->id = header.id;
+	response->status = header.status;
+	response->len = header.len;
+	response->payload = NULL;
+	if(header.len == 0){
+		return 0;
+	}
+	response->payload = malloc(header.len);
+	if(response->payload == NULL || read_all(c->fd, response->payload, header.len) != 0){
+		free(response->payload);
+		response->payload = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+
+/*
+ * Sends one request and waits for its response
+ */
+static int call(fs_client* c, uint16_t op, uint16_t nargs, const char* const* args, const void* data, uint32_t data_len, fsc_response* response){
+	if(fsc_send(c, op, nargs, args, data, data_len) == 0 || fsc_recv(c, response) != 0){
+		return -1;
+	}
+	return 0;
+}
+
+
+static int call_status(fs_client* c, uint16_t op, uint16_t nargs, const char* const* args, const void* data, uint32_t data_len){
+	fsc_response response;
+	if(call(c, op, nargs, args, data, data_len, &response) != 0){
+		return -1;
+	}
+	free(response.payload);
+	return response.status;
+}
+
+
+int fsc_mkdir(fs_client* c, const char* path){
+	return call_status(c, FS_OP_MKDIR, 1, &path, NULL, 0);
+}
+
+int fsc_mkfile(fs_client* c, const char* path_and_name){
+	return call_status(c, FS_OP_MKFILE, 1, &path_and_name, NULL, 0);
+}
+
+int fsc_writef(fs_client* c, const char* filename, const char* text){
+	return call_status(c, FS_OP_WRITEF, 1, &filename, text, strlen(text));
+}
+
+int fsc_rm(fs_client* c, const char* path){
+	return call_status(c, FS_OP_RM, 1, &path, NULL, 0);
+}
+
+int fsc_import(fs_client* c, const char* int_path, const char* ext_path){
+	const char* args[] = { int_path, ext_path };
+	return call_status(c, FS_OP_IMPORT, 2, args, NULL, 0);
+}
+
+int fsc_export(fs_client* c, const char* int_path, const char* ext_path){
+	const char* args[] = { int_path, ext_path };
+	return call_status(c, FS_OP_EXPORT, 2, args, NULL, 0);
+}
+
+int fsc_dump(fs_client* c){
+	return call_status(c, FS_OP_DUMP, 0, NULL, NULL, 0);
+}
+
+int fsc_batch_begin(fs_client* c){
+	return call_status(c, FS_OP_BATCH_BEGIN, 0, NULL, NULL, 0);
+}
+
+int fsc_batch_commit(fs_client* c){
+	return call_status(c, FS_OP_BATCH_COMMIT, 0, NULL, NULL, 0);
+}
+
+
+int fsc_pwrite(fs_client* c, const char* filename, const void* buf, uint32_t len, uint64_t offset){
+	if(len > FS_PROTO_MAX_PAYLOAD - sizeof(fs_proto_range)){
+		return -1;
+	}
+	uint8_t* data = malloc(sizeof(fs_proto_range) + len);
+	if(data == NULL){
+		return -1;
+	}
+	fs_proto_range range = { .offset = offset, .len = len };
+	memcpy(data, &range, sizeof(range));
+	memcpy(data + sizeof(range), buf, len);
+	int status = call_status(c, FS_OP_PWRITE, 1, &filename, data, sizeof(range) + len);
+	free(data);
+	return status;
+}
+
+int fsc_pread(fs_client* c, const char* filename, void* buf, uint32_t len, uint64_t offset){
+	fs_proto_range range = { .offset = offset, .len = len };
+	fsc_response response;
+	if(call(c, FS_OP_PREAD, 1, &filename, &range, sizeof(range), &response) != 0){
+		return -1;
+	}
+	if(response.status > 0){
+		memcpy(buf, response.payload, response.len < len ? response.len : len);
+	}
+	free(response.payload);
+	return response.status;
+}
+
+int fsc_fsck(fs_client* c, fs_fsck_report* report){
+	fsc_response response;
+	if(call(c, FS_OP_FSCK, 0, NULL, NULL, 0, &response) != 0){
+		return -1;
+	}
+	if(response.status >= 0 && response.len == sizeof(fs_fsck_report)){
+		memcpy(report, response.payload, sizeof(fs_fsck_report));
+	}
+	free(response.payload);
+	return response.status;
+}
+
+
+char* fsc_list(fs_client* c, const char* path){
+	fsc_response response;
+	if(call(c, FS_OP_LIST, 1, &path, NULL, 0, &response) != 0){
+		return NULL;
+	}
+	if(response.status != 0){
+		free(response.payload);
+		return NULL;
+	}
+	char* listing = realloc(response.payload, response.len + 1);
+	if(listing == NULL){
+		free(response.payload);
+		return NULL;
+	}
+	listing[response.len] = '\0';
+	return listing;
+}
+
+
+uint8_t* fsc_readf(fs_client* c, const char* filename, int* file_size){
+	fsc_response response;
+	*file_size = 0;
+	if(call(c, FS_OP_READF, 1, &filename, NULL, 0, &response) != 0){
+		return NULL;
+	}
+	if(response.status < 0){
+		free(response.payload);
+		return NULL;
+	}
+	*file_size = response.len;
+	return response.payload;
+}
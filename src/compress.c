@@ -0,0 +1,465 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/filesystem.h"
+#include "../lib/lz.h"
+
+/*
+ * While FS_FEATURE_COMPRESSION is set, files are written in clusters: the direct
+ * blocks of a file are grouped into clusters of CLUSTER_BLOCKS, each holding up to
+ * CLUSTER_SIZE bytes of the file. A cluster that compresses (lz.c) into fewer blocks
+ * than its content needs is stored compressed in its first slots, the rest of its
+ * slots are empty; the size of each of these blocks says how many bytes of the
+ * compressed cluster it holds. Other clusters are stored as plain blocks, without
+ * holes. So a cluster is compressed exactly if it uses fewer slots than its content
+ * needs blocks. A write rewrites the clusters from the first one it changes on.
+ * Decompressed clusters are kept in a small cache, keyed by the blocks they are
+ * stored in; changing a block drops the clusters stored in it (mark_block_dirty).
+ */
+
+#define CLUSTERS (DIRECT_BLOCKS_COUNT / CLUSTER_BLOCKS)
+#define CACHE_CLUSTERS 32
+
+typedef struct _cached_cluster{
+	int blocks[CLUSTER_BLOCKS]; //slots of the compressed cluster, blocks[0] == -1 if the entry is empty
+	uint64_t used; //cache clock at the last use, the entry used longest ago is replaced
+	uint8_t data[CLUSTER_SIZE];
+} cached_cluster;
+
+struct _cluster_cache{
+	pthread_mutex_t lock; //the threads of fs_export_tree read at the same time
+	uint64_t clock;
+	cached_cluster entries[CACHE_CLUSTERS];
+};
+
+//what holes read as
+static const uint8_t zero_block[BLOCK_SIZE];
+
+
+int cluster_cache_alloc(file_system* fs){
+	if(fs->zcache != NULL){
+		return 0;
+	}
+	fs->zcache = malloc(sizeof(struct _cluster_cache));
+	if(fs->zcache == NULL){
+		return -1;
+	}
+	pthread_mutex_init(&fs->zcache->lock, NULL);
+	fs->zcache->clock = 0;
+	for (int i=0; i<CACHE_CLUSTERS; i++) {
+		fs->zcache->entries[i].blocks[0] = -1;
+	}
+	return 0;
+}
+
+
+void cluster_cache_free(file_system* fs){
+	if(fs->zcache == NULL){
+		return;
+	}
+	pthread_mutex_destroy(&fs->zcache->lock);
+	free(fs->zcache);
+	fs->zcache = NULL;
+}
+
+
+void cluster_cache_forget(file_system* fs, int block){
+	struct _cluster_cache* cache = fs->zcache;
+	if(cache == NULL){
+		return;
+	}
+	pthread_mutex_lock(&cache->lock);
+	for (int i=0; i<CACHE_CLUSTERS; i++) {
+		for (int j=0; j<CLUSTER_BLOCKS && cache->entries[i].blocks[0] != -1; j++) {
+			if(cache->entries[i].blocks[j] == block){
+				cache->entries[i].blocks[0] = -1;
+			}
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+
+void cluster_cache_clear(file_system* fs){
+	struct _cluster_cache* cache = fs->zcache;
+	if(cache == NULL){
+		return;
+	}
+	pthread_mutex_lock(&cache->lock);
+	for (int i=0; i<CACHE_CLUSTERS; i++) {
+		cache->entries[i].blocks[0] = -1;
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+
+//the entry of the cluster stored in blocks or NULL, with the lock held
+static cached_cluster* cache_find(struct _cluster_cache* cache, const int* blocks){
+	for (int i=0; i<CACHE_CLUSTERS; i++) {
+		if(cache->entries[i].blocks[0] != -1 && memcmp(cache->entries[i].blocks, blocks, sizeof(cache->entries[i].blocks)) == 0){
+			cache->entries[i].used = ++cache->clock;
+			return &cache->entries[i];
+		}
+	}
+	return NULL;
+}
+
+
+//caches a decompressed cluster in the entry used longest ago
+static cached_cluster* cache_insert(struct _cluster_cache* cache, const int* blocks, const uint8_t* data){
+	pthread_mutex_lock(&cache->lock);
+	cached_cluster* entry = &cache->entries[0];
+	for (int i=1; i<CACHE_CLUSTERS && entry->blocks[0] != -1; i++) {
+		if(cache->entries[i].blocks[0] == -1 || cache->entries[i].used < entry->used){
+			entry = &cache->entries[i];
+		}
+	}
+	memcpy(entry->blocks, blocks, sizeof(entry->blocks));
+	memcpy(entry->data, data, CLUSTER_SIZE);
+	entry->used = ++cache->clock;
+	pthread_mutex_unlock(&cache->lock);
+	return entry;
+}
+
+
+int inode_compressed(file_system* fs, inode* node){
+	return (fs->features & FS_FEATURE_COMPRESSION) && (node->flags & INODE_COMPRESSED);
+}
+
+
+//bytes of the file in cluster c
+static size_t cluster_bytes(size_t size, int c){
+	size_t start = (size_t)c * CLUSTER_SIZE;
+	if(size <= start){
+		return 0;
+	}
+	return size - start < CLUSTER_SIZE ? size - start : CLUSTER_SIZE;
+}
+
+
+//number of slots of cluster c in use, they come first
+static int cluster_used(inode* node, int c){
+	int used = 0;
+	while (used < CLUSTER_BLOCKS && node->direct_blocks[c * CLUSTER_BLOCKS + used] != -1) {
+		used++;
+	}
+	return used;
+}
+
+
+static int cluster_compressed(inode* node, int c){
+	int used = cluster_used(node, c);
+	return used > 0 && (size_t)used * BLOCK_SIZE < cluster_bytes(node->size, c);
+}
+
+
+/*
+ * decompresses compressed cluster c of a file into out (CLUSTER_SIZE bytes)
+ * @return 0 on success, -3 if a block doesn't match its checksum or the cluster is damaged
+ */
+static int decompress_cluster(file_system* fs, inode* node, int c, uint8_t* out){
+	uint8_t packed[CLUSTER_SIZE];
+	size_t len = 0;
+	int used = cluster_used(node, c);
+	for (int j=0; j<used; j++) {
+		int block = node->direct_blocks[c * CLUSTER_BLOCKS + j];
+		size_t n = fs->data_blocks[block].size;
+		if(checksum_verify_block(fs, block) != 0 || n > BLOCK_SIZE){
+			return -3;
+		}
+		memcpy(packed + len, fs->data_blocks[block].block, n);
+		len += n;
+	}
+	size_t bytes = cluster_bytes(node->size, c);
+	return lz_decompress(packed, len, out, CLUSTER_SIZE) == (int)bytes ? 0 : -3;
+}
+
+
+/*
+ * the content of compressed cluster c, in the cache. Only for a single thread: the
+ * entry stays valid until another cluster replaces it
+ */
+static const uint8_t* cluster_view(file_system* fs, inode* node, int c){
+	struct _cluster_cache* cache = fs->zcache;
+	const int* blocks = &node->direct_blocks[c * CLUSTER_BLOCKS];
+	pthread_mutex_lock(&cache->lock);
+	cached_cluster* entry = cache_find(cache, blocks);
+	pthread_mutex_unlock(&cache->lock);
+	if(entry != NULL){
+		return entry->data;
+	}
+	uint8_t data[CLUSTER_SIZE];
+	if(decompress_cluster(fs, node, c, data) != 0){
+		return NULL;
+	}
+	return cache_insert(cache, blocks, data)->data;
+}
+
+
+/*
+ * copies the content of cluster c into out (CLUSTER_SIZE bytes)
+ * @return 0 on success, -3 if the cluster doesn't match its checksums or is damaged
+ */
+static int read_cluster(file_system* fs, inode* node, int c, uint8_t* out){
+	struct _cluster_cache* cache = fs->zcache;
+	const int* blocks = &node->direct_blocks[c * CLUSTER_BLOCKS];
+	if(cluster_compressed(node, c)){
+		pthread_mutex_lock(&cache->lock);
+		cached_cluster* entry = cache_find(cache, blocks);
+		if(entry != NULL){
+			memcpy(out, entry->data, CLUSTER_SIZE);
+		}
+		pthread_mutex_unlock(&cache->lock);
+		if(entry != NULL){
+			return 0;
+		}
+		if(decompress_cluster(fs, node, c, out) != 0){
+			return -3;
+		}
+		cache_insert(cache, blocks, out);
+		return 0;
+	}
+
+	for (int j=0; j<CLUSTER_BLOCKS; j++) {
+		int block = blocks[j];
+		if(block == -1){
+			memset(out + j * BLOCK_SIZE, 0, BLOCK_SIZE);
+		}else if(checksum_verify_block(fs, block) != 0){
+			return -3;
+		}else{
+			memcpy(out + j * BLOCK_SIZE, fs->data_blocks[block].block, BLOCK_SIZE);
+		}
+	}
+	return 0;
+}
+
+
+int compressed_pread(file_system* fs, int inode_number, uint8_t* buf, size_t len, size_t offset){
+	inode* node = &fs->inodes[inode_number];
+	if(offset >= node->size){
+		return 0;
+	}
+	if(len > node->size - offset){
+		len = node->size - offset;
+	}
+
+	uint8_t cluster[CLUSTER_SIZE];
+	size_t done = 0;
+	while (done < len) {
+		size_t pos = offset + done;
+		size_t in_cluster = pos % CLUSTER_SIZE;
+		size_t n = CLUSTER_SIZE - in_cluster < len - done ? CLUSTER_SIZE - in_cluster : len - done;
+		if(read_cluster(fs, node, pos / CLUSTER_SIZE, cluster) != 0){
+			return -3;
+		}
+		memcpy(buf + done, cluster + in_cluster, n);
+		done += n;
+	}
+	return len;
+}
+
+
+int compressed_spans(file_system* fs, int inode_number, struct iovec* iov){
+	inode* node = &fs->inodes[inode_number];
+	const uint8_t* cluster = NULL;
+	int count = 0;
+	for (size_t pos = 0; pos < node->size; pos += BLOCK_SIZE) {
+		int idx = pos / BLOCK_SIZE;
+		int c = idx / CLUSTER_BLOCKS;
+		const uint8_t* base;
+		if(cluster_compressed(node, c)){
+			if(idx % CLUSTER_BLOCKS == 0 && (cluster = cluster_view(fs, node, c)) == NULL){
+				return -3;
+			}
+			base = cluster + (idx % CLUSTER_BLOCKS) * BLOCK_SIZE;
+		}else if(node->direct_blocks[idx] == -1){
+			base = zero_block;
+		}else if(checksum_verify_block(fs, node->direct_blocks[idx]) != 0){
+			return -3;
+		}else{
+			base = fs->data_blocks[node->direct_blocks[idx]].block;
+		}
+		iov[count].iov_base = (void*)base;
+		iov[count].iov_len = node->size - pos < BLOCK_SIZE ? node->size - pos : BLOCK_SIZE;
+		count++;
+	}
+	return count;
+}
+
+
+/*
+ * whether block_for_write has to allocate a new block for a slot
+ */
+static int needs_new_block(file_system* fs, int block){
+	return block == -1 || fs->refs[block] > 1 || (fs->txn != NULL && fs->txn->free_list[block] == 0);
+}
+
+
+/*
+ * whether releasing the block of a slot makes it free for block_for_write: not if it is
+ * shared, or if the state a transaction started from still uses it
+ */
+static int frees_block(file_system* fs, int block){
+	return block != -1 && fs->refs[block] <= 1 && (fs->txn == NULL || fs->txn->free_list[block] == 1);
+}
+
+
+/*
+ * stores content (size bytes) as the file's content from cluster first on; the
+ * clusters before it are left as they are. Nothing is changed if the blocks don't fit
+ * @return 0 on success, -2 if there are not enough free blocks
+ */
+static int store(file_system* fs, int inode_number, const uint8_t* content, size_t size, int first){
+	inode* node = &fs->inodes[inode_number];
+	uint8_t packed[CLUSTERS][CLUSTER_SIZE];
+	const uint8_t* data[CLUSTERS];
+	size_t stored[CLUSTERS];
+	int used[CLUSTERS];
+
+	//compress first, to know the blocks needed before anything is changed
+	uint32_t needed = 0;
+	uint32_t freed = 0;
+	for (int c=first; c<CLUSTERS; c++) {
+		size_t bytes = cluster_bytes(size, c);
+		size_t blocks = (bytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		//worth it only if it saves a block
+		int len = blocks > 1 ? lz_compress(content + (size_t)c * CLUSTER_SIZE, bytes, packed[c], (blocks - 1) * BLOCK_SIZE) : -1;
+		data[c] = len >= 0 ? packed[c] : content + (size_t)c * CLUSTER_SIZE;
+		stored[c] = len >= 0 ? (size_t)len : bytes;
+		used[c] = (stored[c] + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		for (int j=0; j<CLUSTER_BLOCKS; j++) {
+			int block = node->direct_blocks[c * CLUSTER_BLOCKS + j];
+			if(j < used[c]){
+				needed += needs_new_block(fs, block);
+			}else{
+				freed += frees_block(fs, block);
+			}
+		}
+	}
+	if(needed > freed && needed - freed + fs->reserved_blocks > fs->s_block->free_blocks){
+		return -2;
+	}
+
+	//released first, so the blocks can be used again right away
+	for (int c=first; c<CLUSTERS; c++) {
+		for (int j=used[c]; j<CLUSTER_BLOCKS; j++) {
+			int idx = c * CLUSTER_BLOCKS + j;
+			if(node->direct_blocks[idx] != -1){
+				block_release(fs, node->direct_blocks[idx]);
+				node->direct_blocks[idx] = -1;
+			}
+		}
+	}
+	for (int c=first; c<CLUSTERS; c++) {
+		for (int j=0; j<used[c]; j++) {
+			int block = block_for_write(fs, node, c * CLUSTER_BLOCKS + j);
+			if(block == -1){
+				return -2;
+			}
+			size_t n = stored[c] - (size_t)j * BLOCK_SIZE < BLOCK_SIZE ? stored[c] - (size_t)j * BLOCK_SIZE : BLOCK_SIZE;
+			memcpy(fs->data_blocks[block].block, data[c] + (size_t)j * BLOCK_SIZE, n);
+			fs->data_blocks[block].size = n;
+		}
+	}
+	node->size = size;
+	node->flags |= INODE_COMPRESSED;
+	mark_inode_dirty(fs, inode_number);
+	return 0;
+}
+
+
+int compressed_pwrite(file_system* fs, int inode_number, const uint8_t* buf, size_t len, size_t offset){
+	inode* node = &fs->inodes[inode_number];
+	if(offset > MAX_FILE_SIZE || len > MAX_FILE_SIZE - offset){
+		return -2;
+	}
+	if(len == 0){
+		return 0;
+	}
+
+	uint8_t content[MAX_FILE_SIZE];
+	size_t old_size = node->size;
+	int read = inode_pread(fs, inode_number, content, old_size, 0);
+	if(read < 0){
+		return read;
+	}
+	if(offset > old_size){
+		memset(content + old_size, 0, offset - old_size);
+	}
+	memcpy(content + offset, buf, len);
+	size_t size = offset + len > old_size ? offset + len : old_size;
+
+	//a file not stored in clusters yet is converted as a whole
+	size_t unchanged = offset < old_size ? offset : old_size;
+	int first = inode_compressed(fs, node) ? unchanged / CLUSTER_SIZE : 0;
+	int status = store(fs, inode_number, content, size, first);
+	return status == 0 ? (int)len : status;
+}
+
+
+int compressed_shrink(file_system* fs, int inode_number, size_t size){
+	inode* node = &fs->inodes[inode_number];
+	if(size >= node->size){
+		return 0;
+	}
+	uint8_t content[MAX_FILE_SIZE];
+	int read = compressed_pread(fs, inode_number, content, size, 0);
+	if(read < 0){
+		return read;
+	}
+	return store(fs, inode_number, content, size, size / CLUSTER_SIZE);
+}
+
+
+int compress_inode(file_system* fs, int inode_number){
+	inode* node = &fs->inodes[inode_number];
+	if(inode_compressed(fs, node)){
+		return 0;
+	}
+	uint8_t content[MAX_FILE_SIZE];
+	int read = inode_pread(fs, inode_number, content, node->size, 0);
+	if(read < 0){
+		return read;
+	}
+	return store(fs, inode_number, content, node->size, 0);
+}
+
+
+int decompress_inode(file_system* fs, int inode_number){
+	inode* node = &fs->inodes[inode_number];
+	if(!inode_compressed(fs, node)){
+		return 0;
+	}
+	uint8_t content[MAX_FILE_SIZE];
+	size_t size = node->size;
+	int read = compressed_pread(fs, inode_number, content, size, 0);
+	if(read < 0){
+		return read;
+	}
+
+	uint32_t needed = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	uint32_t freed = 0;
+	for (int i=0; i<DIRECT_BLOCKS_COUNT; i++) {
+		freed += frees_block(fs, node->direct_blocks[i]);
+	}
+	if(needed > freed && needed - freed + fs->reserved_blocks > fs->s_block->free_blocks){
+		return -2;
+	}
+
+	//plain blocks, written like a new file
+	inode_truncate(fs, inode_number);
+	for (uint32_t i=0; i<needed; i++) {
+		int block = block_for_write(fs, node, i);
+		if(block == -1){
+			return -2;
+		}
+		size_t n = size - (size_t)i * BLOCK_SIZE < BLOCK_SIZE ? size - (size_t)i * BLOCK_SIZE : BLOCK_SIZE;
+		memcpy(fs->data_blocks[block].block, content + (size_t)i * BLOCK_SIZE, n);
+		fs->data_blocks[block].size = n;
+	}
+	node->size = size;
+	mark_inode_dirty(fs, inode_number);
+	return 0;
+}
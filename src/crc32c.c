@@ -0,0 +1,89 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../lib/crc32c.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLY 0x82F63B78 //reflected Castagnoli polynomial
+
+//table[k][b]: crc of byte b followed by k zero bytes
+static uint32_t table[8][256];
+static int use_sse42;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void init(void){
+	for (uint32_t b=0; b<256; b++) {
+		uint32_t crc = b;
+		for (int bit=0; bit<8; bit++) {
+			crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+		}
+		table[0][b] = crc;
+	}
+	for (uint32_t b=0; b<256; b++) {
+		for (int k=1; k<8; k++) {
+			table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xFF];
+		}
+	}
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	use_sse42 = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+
+/*
+ * 8 bytes per step through 8 tables, for little endian CPUs without the instruction
+ */
+static uint32_t crc32c_sliced(uint32_t crc, const uint8_t* p, size_t len){
+	while (len >= 8) {
+		uint64_t word;
+		memcpy(&word, p, sizeof(word));
+		word ^= crc;
+		crc = table[7][word & 0xFF] ^ table[6][(word >> 8) & 0xFF]
+			^ table[5][(word >> 16) & 0xFF] ^ table[4][(word >> 24) & 0xFF]
+			^ table[3][(word >> 32) & 0xFF] ^ table[2][(word >> 40) & 0xFF]
+			^ table[1][(word >> 48) & 0xFF] ^ table[0][word >> 56];
+		p += 8;
+		len -= 8;
+	}
+	while (len-- > 0) {
+		crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xFF];
+	}
+	return crc;
+}
+
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t* p, size_t len){
+	uint64_t crc64 = crc;
+	while (len >= 8) {
+		uint64_t word;
+		memcpy(&word, p, sizeof(word));
+		crc64 = _mm_crc32_u64(crc64, word);
+		p += 8;
+		len -= 8;
+	}
+	crc = (uint32_t)crc64;
+	while (len-- > 0) {
+		crc = _mm_crc32_u8(crc, *p++);
+	}
+	return crc;
+}
+#endif
+
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t len){
+	pthread_once(&init_once, init);
+	crc = ~crc;
+#if defined(__x86_64__)
+	if(use_sse42){
+		return ~crc32c_sse42(crc, data, len);
+	}
+#endif
+	return ~crc32c_sliced(crc, data, len);
+}
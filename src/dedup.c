@@ -0,0 +1,155 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/filesystem.h"
+
+#define NOT_INDEXED -2
+
+/*
+ * 64 bit hash over a whole block, 8 bytes per step. Collisions are resolved by
+ * comparing the blocks, so it only has to spread well, not resist attacks
+ */
+static uint64_t block_hash(const uint8_t* data){
+	uint64_t h = 0x9E3779B97F4A7C15ULL;
+	for (size_t i=0; i<BLOCK_SIZE; i+=sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, data + i, sizeof(word));
+		h = (h ^ word) * 0xFF51AFD7ED558CCDULL;
+		h ^= h >> 32;
+	}
+	return h;
+}
+
+static int is_indexed(dedup_index* index, int block){
+	return index->next[block] != NOT_INDEXED;
+}
+
+static void index_insert(dedup_index* index, int block, uint64_t hash){
+	uint32_t bucket = hash & (index->num_buckets - 1);
+	index->hashes[block] = hash;
+	index->next[block] = index->buckets[bucket];
+	index->buckets[bucket] = block;
+}
+
+
+int dedup_enable(file_system* fs){
+	if(fs->dedup != NULL){
+		return 0;
+	}
+	uint32_t size = fs->s_block->num_blocks;
+	dedup_index* index = malloc(sizeof(dedup_index));
+	if(index == NULL){
+		return -1;
+	}
+	index->num_buckets = 1;
+	while (index->num_buckets < size) {
+		index->num_buckets *= 2;
+	}
+	index->buckets = malloc(index->num_buckets * sizeof(int));
+	index->next = malloc(size * sizeof(int));
+	index->hashes = malloc(size * sizeof(uint64_t));
+	if(index->buckets == NULL || index->next == NULL || index->hashes == NULL){
+		free(index->buckets);
+		free(index->next);
+		free(index->hashes);
+		free(index);
+		return -1;
+	}
+	memset(index->buckets, -1, index->num_buckets * sizeof(int));
+	for (uint32_t i=0; i<size; i++) {
+		index->next[i] = NOT_INDEXED;
+	}
+
+	//index the full blocks of all files. Existing duplicates stay as they are
+	for (uint32_t i=0; i<size; i++) {
+		if(fs->inodes[i].n_type != reg_file){
+			continue;
+		}
+		for (int j=0; j<DIRECT_BLOCKS_COUNT; j++) {
+			int block = fs->inodes[i].direct_blocks[j];
+			if(block >= 0 && !is_indexed(index, block) && fs->data_blocks[block].size == BLOCK_SIZE){
+				index_insert(index, block, block_hash(fs->data_blocks[block].block));
+			}
+		}
+	}
+	fs->dedup = index;
+	return 0;
+}
+
+
+void dedup_disable(file_system* fs){
+	if(fs->dedup == NULL){
+		return;
+	}
+	free(fs->dedup->buckets);
+	free(fs->dedup->next);
+	free(fs->dedup->hashes);
+	free(fs->dedup);
+	fs->dedup = NULL;
+}
+
+
+void dedup_forget(file_system* fs, int block){
+	dedup_index* index = fs->dedup;
+	if(index == NULL || !is_indexed(index, block)){
+		return;
+	}
+	int* link = &index->buckets[index->hashes[block] & (index->num_buckets - 1)];
+	while (*link != block) {
+		link = &index->next[*link];
+	}
+	*link = index->next[block];
+	index->next[block] = NOT_INDEXED;
+}
+
+
+void dedup_move(file_system* fs, int from, int to){
+	dedup_index* index = fs->dedup;
+	if(index == NULL || !is_indexed(index, from)){
+		return;
+	}
+	uint64_t hash = index->hashes[from];
+	dedup_forget(fs, from);
+	index_insert(index, to, hash);
+}
+
+
+int dedup_resize(file_system* fs, uint32_t old_size, uint32_t size){
+	dedup_index* index = fs->dedup;
+	if(index == NULL){
+		return 0;
+	}
+	//the number of buckets stays, only the chains get longer
+	if(resize_array(&index->next, old_size, size, sizeof(int)) != 0
+	   || resize_array(&index->hashes, old_size, size, sizeof(uint64_t)) != 0){
+		return -1;
+	}
+	for (uint32_t i=old_size; i<size; i++) {
+		index->next[i] = NOT_INDEXED;
+	}
+	return 0;
+}
+
+
+void dedup_block(file_system* fs, int inode_number, int idx){
+	dedup_index* index = fs->dedup;
+	inode* node = &fs->inodes[inode_number];
+	int block = node->direct_blocks[idx];
+	if(index == NULL || block == -1 || is_indexed(index, block) || fs->data_blocks[block].size != BLOCK_SIZE){
+		return;
+	}
+
+	uint64_t hash = block_hash(fs->data_blocks[block].block);
+	for (int other = index->buckets[hash & (index->num_buckets - 1)]; other != -1; other = index->next[other]) {
+		if(index->hashes[other] == hash && memcmp(fs->data_blocks[other].block, fs->data_blocks[block].block, BLOCK_SIZE) == 0){
+			//share the stored block, a later write copies it again (block_for_write)
+			block_share(fs, other);
+			node->direct_blocks[idx] = other;
+			block_release(fs, block);
+			mark_inode_dirty(fs, inode_number);
+			return;
+		}
+	}
+	index_insert(index, block, hash);
+}
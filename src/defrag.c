@@ -0,0 +1,193 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/filesystem.h"
+#include "../lib/operations.h"
+
+/*
+ * The target layout puts the blocks of all files one after the other from block 0
+ * on, directory by directory (breadth first from the root), the files of a directory
+ * next to each other. Each block is brought to its place by swapping it with what is
+ * there, so no free space is needed and every swap leaves a valid filesystem; a pass
+ * stopped by its budget is continued by the next one.
+ * Blocks that can't be moved by rewriting one pointer stay where they are and are
+ * skipped by the layout: shared blocks (dedup, clones, snapshots), blocks only a
+ * snapshot uses and blocks failing their checksum.
+ */
+
+typedef struct _defrag_state{
+	file_system* fs;
+	int* owner; //inode * DIRECT_BLOCKS_COUNT + index of the only pointer to each block, -1 if none, -2 if several
+	uint8_t* pinned; //used blocks that stay where they are
+	uint32_t next; //next place of the layout
+	uint32_t budget; //moves left, 0 without limit
+	int limited;
+	fs_defrag_report* report;
+} defrag_state;
+
+
+/*
+ * per mille of the steps from one block of a file to the next that aren't to the
+ * following block
+ */
+static uint32_t fragmentation(file_system* fs){
+	uint64_t steps = 0;
+	uint64_t jumps = 0;
+	for (uint32_t i=0; i<fs->s_block->num_blocks; i++) {
+		if(fs->inodes[i].n_type != reg_file){
+			continue;
+		}
+		int last = -1;
+		for (int j=0; j<DIRECT_BLOCKS_COUNT; j++) {
+			int block = fs->inodes[i].direct_blocks[j];
+			if(block == -1){
+				continue;
+			}
+			if(last != -1){
+				steps++;
+				jumps += block != last + 1;
+			}
+			last = block;
+		}
+	}
+	return steps == 0 ? 0 : (uint32_t)(jumps * 1000 / steps);
+}
+
+
+/*
+ * points the owner of a block to the block's (new) number
+ */
+static void repoint(defrag_state* state, int block){
+	file_system* fs = state->fs;
+	if(state->owner[block] >= 0){
+		int inode_number = state->owner[block] / DIRECT_BLOCKS_COUNT;
+		fs->inodes[inode_number].direct_blocks[state->owner[block] % DIRECT_BLOCKS_COUNT] = block;
+		mark_inode_dirty(fs, inode_number);
+	}
+	mark_block_dirty(fs, block);
+}
+
+
+static void swap_blocks(defrag_state* state, int a, int b){
+	file_system* fs = state->fs;
+	data_block tmp = fs->data_blocks[a];
+	fs->data_blocks[a] = fs->data_blocks[b];
+	fs->data_blocks[b] = tmp;
+	uint8_t free_entry = fs->free_list[a];
+	fs->free_list[a] = fs->free_list[b];
+	fs->free_list[b] = free_entry;
+	uint32_t refs = fs->refs[a];
+	fs->refs[a] = fs->refs[b];
+	fs->refs[b] = refs;
+	int owner = state->owner[a];
+	state->owner[a] = state->owner[b];
+	state->owner[b] = owner;
+	repoint(state, a);
+	repoint(state, b);
+}
+
+
+/*
+ * gives the blocks of a file the next places of the layout, 0 once the budget is used up
+ */
+static int place_file(defrag_state* state, int inode_number){
+	file_system* fs = state->fs;
+	uint32_t size = fs->s_block->num_blocks;
+	for (int j=0; j<DIRECT_BLOCKS_COUNT; j++) {
+		int block = fs->inodes[inode_number].direct_blocks[j];
+		if(block == -1 || state->pinned[block]){
+			continue;
+		}
+		while (state->next < size && state->pinned[state->next]) {
+			state->next++;
+		}
+		int target = state->next;
+		if(target != block){
+			if(state->limited && state->budget == 0){
+				return 0;
+			}
+			//neither block may stay in the dedup index under its old number
+			dedup_forget(fs, block);
+			dedup_forget(fs, target);
+			swap_blocks(state, block, target);
+			state->budget--;
+			state->report->moved_blocks++;
+		}
+		state->next++;
+	}
+	return 1;
+}
+
+
+/*
+ * pins the used blocks without a single live pointer and those failing their checksum
+ */
+static void find_pinned(defrag_state* state){
+	file_system* fs = state->fs;
+	for (uint32_t i=0; i<fs->s_block->num_blocks; i++) {
+		if(fs->free_list[i] == 0 && (state->owner[i] < 0 || checksum_verify_block(fs, i) != 0)){
+			state->pinned[i] = 1;
+			state->report->pinned_blocks++;
+		}
+	}
+}
+
+
+int fs_defrag(file_system *fs, uint32_t budget, fs_defrag_report *report){
+	if(fs == NULL || fs->txn != NULL){
+		return -1;
+	}
+	fs_defrag_report unused;
+	if(report == NULL){
+		report = &unused;
+	}
+	memset(report, 0, sizeof(fs_defrag_report));
+	report->score_before = fragmentation(fs);
+
+	uint32_t size = fs->s_block->num_blocks;
+	defrag_state state = { .fs = fs, .next = 0, .budget = budget, .limited = budget > 0, .report = report };
+	state.owner = block_owners(fs);
+	state.pinned = calloc(size, 1);
+	uint32_t* dirs = malloc(size * sizeof(uint32_t));
+	uint8_t* reached = calloc(size, 1);
+	if(state.owner == NULL || state.pinned == NULL || dirs == NULL || reached == NULL){
+		free(state.owner);
+		free(state.pinned);
+		free(dirs);
+		free(reached);
+		return -1;
+	}
+	find_pinned(&state);
+
+	//breadth first over the directories, the files of each one in entry order
+	uint32_t count = 0;
+	dirs[count++] = fs->root_node;
+	reached[fs->root_node] = 1;
+	int more = 1;
+	for (uint32_t i=0; more && i<count; i++) {
+		inode* dir = &fs->inodes[dirs[i]];
+		for (int j=0; more && j<DIRECT_BLOCKS_COUNT; j++) {
+			int child = dir->direct_blocks[j];
+			if(child < 0 || (uint32_t)child >= size || reached[child]){
+				continue;
+			}
+			reached[child] = 1;
+			if(fs->inodes[child].n_type == directory){
+				dirs[count++] = child;
+			}else if(fs->inodes[child].n_type == reg_file){
+				more = place_file(&state, child);
+			}
+		}
+	}
+	free(state.owner);
+	free(state.pinned);
+	free(dirs);
+	free(reached);
+
+	report->score_after = fragmentation(fs);
+	if(report->moved_blocks > 0 && fs_persist(fs) != 0){
+		return -1;
+	}
+	return report->moved_blocks;
+}
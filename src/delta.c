@@ -0,0 +1,248 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/filesystem.h"
+#include "../lib/operations.h"
+
+/*
+ * Delta stream: a delta_header, then records (delta_record followed by len bytes)
+ * up to a DELTA_END record:
+ *  DELTA_SUPERBLOCK  the superblock
+ *  DELTA_INODE       inode number index
+ *  DELTA_BLOCK       block index: its free list entry, followed by the data_block
+ *                    unless the block is free
+ *  DELTA_TRAILER     the trailer chunks (features, snapshots) without generations
+ */
+#define DELTA_MAGIC 0x4C445346 //"FSDL"
+
+enum delta_record_type{
+	DELTA_SUPERBLOCK=1,
+	DELTA_INODE=2,
+	DELTA_BLOCK=3,
+	DELTA_TRAILER=4,
+	DELTA_END=5
+};
+
+typedef struct _delta_header{
+	uint32_t magic;
+	uint32_t num_blocks;
+	uint32_t since; //changes after this generation are contained
+	uint32_t generation; //up to this one
+} delta_header;
+
+typedef struct _delta_record{
+	uint32_t type;
+	uint32_t index;
+	uint64_t len;
+} delta_record;
+
+static int write_record(FILE* out, uint32_t type, uint32_t index, const void* data, uint64_t len){
+	delta_record record = { .type = type, .index = index, .len = len };
+	return fwrite(&record, sizeof(record), 1, out) == 1 && (len == 0 || fwrite(data, len, 1, out) == 1);
+}
+
+
+int fs_delta_export(file_system *fs, uint32_t since, char *ext_path){
+	if(fs == NULL || ext_path == NULL || fs->txn != NULL){
+		return -1;
+	}
+	//buffered appends get their blocks and stamps first
+	if(wbuf_flush_all(fs) != 0){
+		return -1;
+	}
+	//from now on the stamps are stored, so the next delta can start where this one ends
+	if(!(fs->features & FS_FEATURE_GENERATIONS)){
+		fs->features |= FS_FEATURE_GENERATIONS;
+		mark_trailer_dirty(fs);
+	}
+
+	FILE* out = fopen(ext_path, "w");
+	if(out == NULL){
+		return -1;
+	}
+	uint32_t size = fs->s_block->num_blocks;
+	delta_header header = { .magic = DELTA_MAGIC, .num_blocks = size, .since = since, .generation = fs->generation };
+	int ok = fwrite(&header, sizeof(header), 1, out) == 1
+		&& write_record(out, DELTA_SUPERBLOCK, 0, fs->s_block, sizeof(superblock));
+
+	for (uint32_t i=0; ok && i<size; i++) {
+		if(fs->inode_gen[i] > since){
+			ok = write_record(out, DELTA_INODE, i, &fs->inodes[i], sizeof(inode));
+		}
+	}
+	for (uint32_t i=0; ok && i<size; i++) {
+		if(fs->block_gen[i] <= since){
+			continue;
+		}
+		//a free block only needs its free list entry
+		delta_record record = { .type = DELTA_BLOCK, .index = i, .len = 1 };
+		if(fs->free_list[i] == 0){
+			record.len += sizeof(data_block);
+		}
+		ok = fwrite(&record, sizeof(record), 1, out) == 1
+			&& fwrite(&fs->free_list[i], 1, 1, out) == 1
+			&& (fs->free_list[i] != 0 || fwrite(&fs->data_blocks[i], sizeof(data_block), 1, out) == 1);
+	}
+	if(ok && fs->trailer_gen > since){
+		size_t len;
+		uint8_t* trailer = trailer_serialize(fs, &len, 0);
+		ok = write_record(out, DELTA_TRAILER, 0, trailer, len);
+		free(trailer);
+	}
+	ok = ok && write_record(out, DELTA_END, 0, NULL, 0);
+	ok = fclose(out) == 0 && ok;
+	if(!ok){
+		return -1;
+	}
+
+	//later changes belong to the next delta
+	uint32_t generation = fs->generation++;
+	if(fs_persist(fs) != 0){
+		return -1;
+	}
+	return generation;
+}
+
+
+/*
+ * checks that every record fits the filesystem and that the stream is complete
+ */
+static int validate(file_system* fs, FILE* in){
+	uint32_t size = fs->s_block->num_blocks;
+	delta_record record;
+	while (fread(&record, sizeof(record), 1, in) == 1) {
+		switch (record.type) {
+			case DELTA_END:
+				return 0;
+			case DELTA_SUPERBLOCK:
+				if(record.len != sizeof(superblock)){
+					return -1;
+				}
+				break;
+			case DELTA_INODE:
+				if(record.index >= size || record.len != sizeof(inode)){
+					return -1;
+				}
+				break;
+			case DELTA_BLOCK:
+				if(record.index >= size || (record.len != 1 && record.len != 1 + sizeof(data_block))){
+					return -1;
+				}
+				break;
+			case DELTA_TRAILER:
+				break;
+			default:
+				return -1;
+		}
+		if(fseek(in, record.len, SEEK_CUR) != 0){
+			return -1;
+		}
+	}
+	return -1;
+}
+
+
+static int apply_trailer(file_system* fs, FILE* in, uint64_t len){
+	uint8_t* trailer = malloc(len ? len : 1);
+	if(trailer == NULL || (len > 0 && fread(trailer, len, 1, in) != 1)){
+		free(trailer);
+		return -1;
+	}
+	snapshots_free(fs);
+	fs->features = 0;
+	if(len > 0){
+		FILE* chunks = fmemopen(trailer, len, "r");
+		if(chunks == NULL){
+			free(trailer);
+			return -1;
+		}
+		trailer_parse(fs, chunks);
+		fclose(chunks);
+	}
+	free(trailer);
+	return 0;
+}
+
+
+int fs_delta_apply(file_system *fs, char *ext_path){
+	if(fs == NULL || ext_path == NULL || fs->txn != NULL){
+		return -1;
+	}
+	FILE* in = fopen(ext_path, "r");
+	if(in == NULL){
+		return -1;
+	}
+	delta_header header;
+	if(fread(&header, sizeof(header), 1, in) != 1 || header.magic != DELTA_MAGIC
+	   || header.num_blocks != fs->s_block->num_blocks || validate(fs, in) != 0){
+		fclose(in);
+		return -1;
+	}
+	//a delta only fits the state the previous one left behind
+	if(header.since != 0 && header.since != fs->applied_gen){
+		fclose(in);
+		return -2;
+	}
+
+	//buffered appends belong to the state that is replaced
+	if(wbuf_flush_all(fs) != 0){
+		fclose(in);
+		return -1;
+	}
+	fseek(in, sizeof(header), SEEK_SET);
+	delta_record record;
+	int ok = 1;
+	while (ok && fread(&record, sizeof(record), 1, in) == 1 && record.type != DELTA_END) {
+		switch (record.type) {
+			case DELTA_SUPERBLOCK:
+				ok = fread(fs->s_block, sizeof(superblock), 1, in) == 1;
+				break;
+			case DELTA_INODE:
+				ok = fread(&fs->inodes[record.index], sizeof(inode), 1, in) == 1;
+				mark_inode_dirty(fs, record.index);
+				break;
+			case DELTA_BLOCK:
+				ok = fread(&fs->free_list[record.index], 1, 1, in) == 1
+					&& (record.len == 1 || fread(&fs->data_blocks[record.index], sizeof(data_block), 1, in) == 1);
+				mark_block_dirty(fs, record.index);
+				break;
+			case DELTA_TRAILER:
+				ok = apply_trailer(fs, in, record.len) == 0;
+				break;
+		}
+	}
+	fclose(in);
+
+	//everything derived from the inodes and the trailer
+	find_root(fs);
+	if((fs->features & FS_FEATURE_DEDUP) && fs->dedup == NULL){
+		dedup_enable(fs);
+	}else if(!(fs->features & FS_FEATURE_DEDUP)){
+		dedup_disable(fs);
+	}
+	if(!(fs->features & FS_FEATURE_COMPRESSION)){
+		cluster_cache_free(fs);
+	}else if(cluster_cache_alloc(fs) != 0){
+		ok = 0;
+	}
+	if(!(fs->features & FS_FEATURE_CHECKSUMS)){
+		checksums_disable(fs);
+	}else if(fs->csum == NULL && checksums_enable(fs) != 0){
+		ok = 0;
+	}
+	fs_rebuild_refs(fs);
+	for (fs_handle* handle = fs->handles; handle != NULL; handle = handle->next) {
+		handle->inode = -1;
+	}
+
+	fs->features |= FS_FEATURE_GENERATIONS;
+	fs->applied_gen = header.generation;
+	mark_trailer_dirty(fs);
+	if(fs_persist(fs) != 0 || !ok){
+		return -1;
+	}
+	return 0;
+}
@@ -1,15 +1,397 @@
+#include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
+#include <unistd.h>
 #include "../lib/filesystem.h"
 #include "../lib/utils.h"
 
+//past this many entries tracking changes costs more than dumping everything
+#define DIRTY_TRACK_MIN 1024
+
+int resize_array(void* array, size_t old_count, size_t count, size_t entry_size){
+	void** p = array;
+	void* resized = realloc(*p, count * entry_size);
+	if(resized == NULL){
+		return count > old_count ? -1 : 0;
+	}
+	*p = resized;
+	return 0;
+}
+
+static void dirty_set_init(dirty_set* set, uint32_t size){
+	set->flags = calloc((size + 7) / 8, 1);
+	if(set->flags == NULL){
+		exit(1);
+	}
+	set->list = NULL;
+	set->count = 0;
+	set->capacity = 0;
+}
+
+static void dirty_set_clear(dirty_set* set){
+	for (uint32_t i=0; i<set->count; i++) {
+		set->flags[set->list[i] / 8] &= ~(1 << (set->list[i] % 8));
+	}
+	set->count = 0;
+}
+
+static void dirty_set_add(file_system* fs, dirty_set* set, uint32_t n){
+	if(fs->dirty_all || (set->flags[n / 8] & (1 << (n % 8)))){
+		return;
+	}
+	if(set->count == set->capacity){
+		if(set->count >= DIRTY_TRACK_MIN && set->count >= fs->s_block->num_blocks / 4){
+			fs->dirty_all = 1;
+			return;
+		}
+		uint32_t capacity = set->capacity ? set->capacity * 2 : 64;
+		uint32_t* list = realloc(set->list, capacity * sizeof(uint32_t));
+		if(list == NULL){
+			fs->dirty_all = 1;
+			return;
+		}
+		set->list = list;
+		set->capacity = capacity;
+	}
+	set->flags[n / 8] |= 1 << (n % 8);
+	set->list[set->count++] = n;
+}
+
+/*
+ * Optional trailer after the data blocks: a sequence of chunks, each a chunk_header
+ * followed by len bytes. Images without features have no trailer, so they keep the
+ * plain format. Unknown chunks are skipped on load.
+ * A GENS chunk always comes first and a CSUM chunk second, so their per-entry tables
+ * sit at fixed offsets and can be updated in place like the inodes and blocks they
+ * belong to
+ */
+#define CHUNK_GENERATIONS 0x534E4547 //"GENS": gens_header, num_blocks inode stamps, num_blocks block stamps
+#define CHUNK_CHECKSUMS 0x4D555343 //"CSUM": num_blocks inode checksums, num_blocks block checksums
+#define CHUNK_FEATURES 0x54414546 //"FEAT": uint32_t feature flags
+#define CHUNK_SNAPSHOT 0x50414E53 //"SNAP": snapshot_header followed by num_blocks inodes
+
+typedef struct _chunk_header{
+	uint32_t magic;
+	uint32_t reserved;
+	uint64_t len;
+} chunk_header;
+
+typedef struct _gens_header{
+	uint32_t generation;
+	uint32_t trailer_gen;
+	uint32_t applied_gen;
+	uint32_t reserved;
+} gens_header;
+
+typedef struct _snapshot_header{
+	char name[NAME_MAX_LENGTH];
+	int32_t root_node;
+	uint32_t reserved;
+} snapshot_header;
+
+static size_t gens_chunk_len(file_system* fs){
+	return sizeof(gens_header) + 2 * (size_t)fs->s_block->num_blocks * sizeof(uint32_t);
+}
+
+static size_t csum_chunk_len(file_system* fs){
+	return 2 * (size_t)fs->s_block->num_blocks * sizeof(uint32_t);
+}
+
+uint8_t* trailer_serialize(file_system* fs, size_t* len, int with_tables){
+	*len = 0;
+	uint32_t size = fs->s_block->num_blocks;
+	size_t inodes_len = (size_t)size * sizeof(inode);
+	int with_generations = with_tables && (fs->features & FS_FEATURE_GENERATIONS);
+	int with_checksums = with_tables && fs->csum != NULL;
+	size_t total = fs->features ? sizeof(chunk_header) + sizeof(fs->features) : 0;
+	if(with_generations){
+		total += sizeof(chunk_header) + gens_chunk_len(fs);
+	}
+	if(with_checksums){
+		total += sizeof(chunk_header) + csum_chunk_len(fs);
+	}
+	for (fs_snapshot* snap = fs->snapshots; snap != NULL; snap = snap->next) {
+		total += sizeof(chunk_header) + sizeof(snapshot_header) + inodes_len;
+	}
+	if(total == 0){
+		return NULL;
+	}
+	uint8_t* trailer = malloc(total);
+	if(trailer == NULL){
+		return NULL;
+	}
+
+	uint8_t* p = trailer;
+	if(with_generations){
+		chunk_header header = { .magic = CHUNK_GENERATIONS, .reserved = 0, .len = gens_chunk_len(fs) };
+		gens_header gens = { .generation = fs->generation, .trailer_gen = fs->trailer_gen,
+		                     .applied_gen = fs->applied_gen, .reserved = 0 };
+		memcpy(p, &header, sizeof(header));
+		memcpy(p + sizeof(header), &gens, sizeof(gens));
+		p += sizeof(header) + sizeof(gens);
+		memcpy(p, fs->inode_gen, size * sizeof(uint32_t));
+		memcpy(p + size * sizeof(uint32_t), fs->block_gen, size * sizeof(uint32_t));
+		p += 2 * (size_t)size * sizeof(uint32_t);
+	}
+	if(with_checksums){
+		chunk_header header = { .magic = CHUNK_CHECKSUMS, .reserved = 0, .len = csum_chunk_len(fs) };
+		memcpy(p, &header, sizeof(header));
+		p += sizeof(header);
+		memcpy(p, fs->csum->inodes, size * sizeof(uint32_t));
+		memcpy(p + size * sizeof(uint32_t), fs->csum->blocks, size * sizeof(uint32_t));
+		p += csum_chunk_len(fs);
+	}
+	if(fs->features){
+		chunk_header header = { .magic = CHUNK_FEATURES, .reserved = 0, .len = sizeof(fs->features) };
+		memcpy(p, &header, sizeof(header));
+		memcpy(p + sizeof(header), &fs->features, sizeof(fs->features));
+		p += sizeof(header) + sizeof(fs->features);
+	}
+	for (fs_snapshot* snap = fs->snapshots; snap != NULL; snap = snap->next) {
+		chunk_header header = { .magic = CHUNK_SNAPSHOT, .reserved = 0, .len = sizeof(snapshot_header) + inodes_len };
+		snapshot_header snap_header = { .root_node = snap->root_node, .reserved = 0 };
+		memcpy(snap_header.name, snap->name, NAME_MAX_LENGTH);
+		memcpy(p, &header, sizeof(header));
+		memcpy(p + sizeof(header), &snap_header, sizeof(snap_header));
+		memcpy(p + sizeof(header) + sizeof(snap_header), snap->inodes, inodes_len);
+		p += sizeof(header) + header.len;
+	}
+	*len = total;
+	return trailer;
+}
+
+/*
+ * reads a snapshot chunk and appends the snapshot, 0 if the chunk was consumed
+ */
+static int load_snapshot(file_system* fs, FILE* fs_file, uint64_t len, fs_snapshot*** tail){
+	size_t inodes_len = (size_t)fs->s_block->num_blocks * sizeof(inode);
+	if(len != sizeof(snapshot_header) + inodes_len){
+		return -1;
+	}
+	snapshot_header header;
+	fs_snapshot* snap = malloc(sizeof(fs_snapshot));
+	if(snap == NULL || (snap->inodes = malloc(inodes_len)) == NULL){
+		exit(1);
+	}
+	if(fread(&header, sizeof(header), 1, fs_file) != 1 || fread(snap->inodes, inodes_len, 1, fs_file) != 1){
+		free(snap->inodes);
+		free(snap);
+		return 0;
+	}
+	memcpy(snap->name, header.name, NAME_MAX_LENGTH);
+	snap->root_node = header.root_node;
+	snap->next = NULL;
+	**tail = snap;
+	*tail = &snap->next;
+	return 0;
+}
+
+/*
+ * reads a generations chunk, 0 if the chunk was consumed
+ */
+static int load_generations(file_system* fs, FILE* fs_file, uint64_t len){
+	uint32_t size = fs->s_block->num_blocks;
+	gens_header gens;
+	if(len != gens_chunk_len(fs) || fread(&gens, sizeof(gens), 1, fs_file) != 1){
+		return -1;
+	}
+	if(fread(fs->inode_gen, sizeof(uint32_t), size, fs_file) != size
+	   || fread(fs->block_gen, sizeof(uint32_t), size, fs_file) != size){
+		return 0;
+	}
+	fs->generation = gens.generation;
+	fs->trailer_gen = gens.trailer_gen;
+	fs->applied_gen = gens.applied_gen;
+	return 0;
+}
+
+/*
+ * reads a checksums chunk, 0 if the chunk was consumed
+ */
+static int load_checksums(file_system* fs, FILE* fs_file, uint64_t len){
+	uint32_t size = fs->s_block->num_blocks;
+	if(len != csum_chunk_len(fs) || (fs->csum == NULL && checksums_alloc(fs) != 0)){
+		return -1;
+	}
+	if(fread(fs->csum->inodes, sizeof(uint32_t), size, fs_file) != size
+	   || fread(fs->csum->blocks, sizeof(uint32_t), size, fs_file) != size){
+		//incomplete, computed again from what was loaded
+		checksums_disable(fs);
+	}
+	return 0;
+}
+
+void trailer_parse(file_system* fs, FILE* fs_file){
+	chunk_header header;
+	fs_snapshot** tail = &fs->snapshots;
+	while (*tail != NULL) {
+		tail = &(*tail)->next;
+	}
+	while (fread(&header, sizeof(header), 1, fs_file) == 1) {
+		if(header.magic == CHUNK_SNAPSHOT && load_snapshot(fs, fs_file, header.len, &tail) == 0){
+			continue;
+		}
+		if(header.magic == CHUNK_GENERATIONS && load_generations(fs, fs_file, header.len) == 0){
+			continue;
+		}
+		if(header.magic == CHUNK_CHECKSUMS && load_checksums(fs, fs_file, header.len) == 0){
+			continue;
+		}
+		if(header.magic == CHUNK_FEATURES && header.len >= sizeof(fs->features)){
+			if(fread(&fs->features, sizeof(fs->features), 1, fs_file) != 1){
+				return;
+			}
+			header.len -= sizeof(fs->features);
+		}
+		if(fseek(fs_file, header.len, SEEK_CUR) != 0){
+			return;
+		}
+	}
+}
+
+/*
+ * writes the trailer after the data blocks of a FILE written from the start
+ */
+static int write_trailer(file_system* fs, FILE* fs_file){
+	size_t len;
+	uint8_t* trailer = trailer_serialize(fs, &len, 1);
+	int ok = len == 0 || fwrite(trailer, 1, len, fs_file) == len;
+	free(trailer);
+	return ok;
+}
+
+static const uint8_t zero_block[BLOCK_SIZE];
+
+static int write_zeros(FILE* fs_file, size_t len){
+	while (len > 0) {
+		size_t chunk = len < BLOCK_SIZE ? len : BLOCK_SIZE;
+		if(fwrite(zero_block, 1, chunk, fs_file) != chunk){
+			return 0;
+		}
+		len -= chunk;
+	}
+	return 1;
+}
+
+/*
+ * the superblock as stored, followed by the table capacity in the growable layout
+ * @return its length in bytes
+ */
+static size_t header_serialize(file_system* fs, uint32_t header[3]){
+	header[0] = fs->s_block->num_blocks;
+	header[1] = fs->s_block->free_blocks;
+	if(fs->table_capacity == 0){
+		return sizeof(superblock);
+	}
+	header[0] |= SB_TABLE_CAPACITY;
+	header[2] = fs->table_capacity;
+	return sizeof(superblock) + sizeof(uint32_t);
+}
+
+image_layout layout_of(file_system* fs){
+	uint32_t size = fs->s_block->num_blocks;
+	uint32_t tables = fs->table_capacity != 0 ? fs->table_capacity : size;
+	image_layout layout;
+	layout.free_list = sizeof(superblock) + (fs->table_capacity != 0 ? sizeof(uint32_t) : 0);
+	layout.inodes = layout.free_list + tables;
+	layout.data = layout.inodes + (off_t)tables * sizeof(inode);
+	layout.trailer = layout.data + (off_t)size * sizeof(data_block);
+	return layout;
+}
+
+/*
+ * writes the whole image to a FILE written from the start. The room left in the
+ * tables is filled with zeros
+ */
+static int write_image(file_system* fs, FILE* fs_file){
+	uint32_t size = fs->s_block->num_blocks;
+	uint32_t headroom = fs->table_capacity > size ? fs->table_capacity - size : 0;
+	uint32_t header[3];
+	size_t header_len = header_serialize(fs, header);
+	return fwrite(header, 1, header_len, fs_file) == header_len
+		&& fwrite(fs->free_list, sizeof(uint8_t), size, fs_file) == size
+		&& write_zeros(fs_file, headroom)
+		&& fwrite(fs->inodes, sizeof(inode), size, fs_file) == size
+		&& write_zeros(fs_file, (size_t)headroom * sizeof(inode))
+		&& fwrite(fs->data_blocks, sizeof(data_block), size, fs_file) == size
+		&& write_trailer(fs, fs_file);
+}
+
+/*
+ * everything that isn't part of the image: where it lives, open batches and transactions
+ */
+static void init_state(file_system* fs, const char* fs_file_path){
+	fs->path = strdup(fs_file_path);
+	if(fs->path == NULL){
+		exit(1);
+	}
+	fs->batch_depth = 0;
+	fs->dirty = 0;
+	fs->txn = NULL;
+	dirty_set_init(&fs->dirty_inodes, fs->s_block->num_blocks);
+	dirty_set_init(&fs->dirty_blocks, fs->s_block->num_blocks);
+	fs->dirty_all = 0;
+	fs->handles = NULL;
+	fs->features = 0;
+	fs->trailer_dirty = 0;
+	fs->refs = calloc(fs->s_block->num_blocks, sizeof(uint32_t));
+	if(fs->refs == NULL){
+		exit(1);
+	}
+	fs->dedup = NULL;
+	fs->snapshots = NULL;
+	fs->csum = NULL;
+	fs->log_head = 0;
+	fs->write_buffering = 0;
+	fs->wbufs = NULL;
+	fs->reserved_blocks = 0;
+	fs->wbuf_since = 0;
+	fs->zcache = NULL;
+	fs->free_inodes = NULL;
+	fs->free_groups = NULL;
+
+	//without recorded generations everything counts as written in generation 1
+	fs->generation = 1;
+	fs->trailer_gen = 1;
+	fs->applied_gen = 0;
+	fs->inode_gen = malloc(fs->s_block->num_blocks * sizeof(uint32_t));
+	fs->block_gen = malloc(fs->s_block->num_blocks * sizeof(uint32_t));
+	if(fs->inode_gen == NULL || fs->block_gen == NULL){
+		exit(1);
+	}
+	for (uint32_t i=0; i<fs->s_block->num_blocks; i++) {
+		fs->inode_gen[i] = 1;
+		fs->block_gen[i] = 1;
+	}
+}
+
+/*
+ * memory and image are in sync again
+ */
+static void clear_dirty(file_system* fs){
+	dirty_set_clear(&fs->dirty_inodes);
+	dirty_set_clear(&fs->dirty_blocks);
+	fs->dirty_all = 0;
+	fs->trailer_dirty = 0;
+}
+
+void find_root(file_system* fs){
+	for (int i = 0; i<fs->s_block->num_blocks; i++) {
+		if(fs->inodes[i].n_type==directory && strncmp(fs->inodes[i].name,"/",NAME_MAX_LENGTH)==0){
+			fs->root_node = i;
+			break;
+		}
+	}
+}
+
 file_system* fs_load(const char* fs_file_path){
-	//TODO:
-	// * check if file exists -> if not abort
-	// find root_node and set it to new_fs->root_node
 	FILE* fs_file = fopen(fs_file_path,"r");
+	if(fs_file == NULL){
+		return NULL;
+	}
 	file_system* new_fs = malloc(sizeof(file_system));
 	if(new_fs == NULL){
 		exit(1);
@@ -22,6 +404,13 @@ file_system* fs_load(const char* fs_file_path){
 
 	//read size from superblock
 	fread(new_fs->s_block, sizeof(superblock), 1, fs_file);
+	uint32_t capacity = 0;
+	if(new_fs->s_block->num_blocks & SB_TABLE_CAPACITY){
+		new_fs->s_block->num_blocks &= ~SB_TABLE_CAPACITY;
+		fread(&capacity, sizeof(capacity), 1, fs_file);
+	}
+	//room left in the tables for growing
+	uint32_t headroom = capacity > new_fs->s_block->num_blocks ? capacity - new_fs->s_block->num_blocks : 0;
 
 	//allocate memory for the free list and load the free list from file
 	new_fs->free_list = malloc(new_fs->s_block->num_blocks);
@@ -29,6 +418,7 @@ file_system* fs_load(const char* fs_file_path){
 		exit(1);
 	}
 	fread(new_fs->free_list,sizeof(uint8_t), new_fs->s_block->num_blocks, fs_file);
+	fseek(fs_file, headroom, SEEK_CUR);
 
 	//allocate memory for the inodes and read them from file
 	new_fs->inodes = malloc(sizeof(inode) * new_fs->s_block->num_blocks);
@@ -36,6 +426,7 @@ file_system* fs_load(const char* fs_file_path){
 		exit(1);
 	}
 	fread(new_fs->inodes,sizeof(inode), new_fs->s_block->num_blocks, fs_file);
+	fseek(fs_file, (long)headroom * sizeof(inode), SEEK_CUR);
 
 	//allocate memory for the data blocks and read them from file
 	new_fs->data_blocks = malloc(sizeof(data_block)* new_fs->s_block->num_blocks);
@@ -44,14 +435,32 @@ file_system* fs_load(const char* fs_file_path){
 	}
 	fread(new_fs->data_blocks,sizeof(data_block), new_fs->s_block->num_blocks, fs_file);
 
-	//find root node
-	for (int i = 0; i<new_fs->s_block->num_blocks; i++) {
-		if(new_fs->inodes[i].n_type==directory && strncmp(new_fs->inodes[i].name,"/",NAME_MAX_LENGTH)==0){
-			new_fs->root_node = i;
-			break;
+	init_state(new_fs, fs_file_path);
+	new_fs->table_capacity = capacity;
+	trailer_parse(new_fs, fs_file);
+
+	find_root(new_fs);
+
+	fs_rebuild_refs(new_fs);
+	if(new_fs->features & FS_FEATURE_LOG){
+		log_rewind(new_fs);
+	}
+	if((new_fs->features & FS_FEATURE_DEDUP) && dedup_enable(new_fs) != 0){
+		exit(1);
+	}
+	if((new_fs->features & FS_FEATURE_COMPRESSION) && cluster_cache_alloc(new_fs) != 0){
+		exit(1);
+	}
+	if(!(new_fs->features & FS_FEATURE_CHECKSUMS)){
+		checksums_disable(new_fs);
+	}else if(new_fs->csum == NULL){
+		//no usable checksums in the image: trust what was loaded and store new ones
+		if(checksums_enable(new_fs) != 0){
+			exit(1);
 		}
+		new_fs->trailer_dirty = 1;
 	}
-	
+
 	LOG("Loaded filesystem from file\n");
 
 	fclose(fs_file);
@@ -100,12 +509,13 @@ file_system* fs_create(const char* fs_file_path, uint32_t size){
 	strncpy(new_fs->inodes[0].name,"/",NAME_MAX_LENGTH);
 	new_fs->root_node = 0;
 
-	
 	new_fs->data_blocks = calloc(size,sizeof(data_block));
 	if(new_fs->data_blocks == NULL){
 		exit(1);
 	}
-	
+
+	init_state(new_fs, fs_file_path);
+	new_fs->table_capacity = 0;
 
 	//write the components to file
 	fs_dump(new_fs, fs_file_path);
@@ -119,29 +529,200 @@ void inode_init(inode *i){
 	i->n_type=free_block;
 	i->size=0;
 	memset(i->name,0,NAME_MAX_LENGTH);
+	i->flags = 0;
 	memset(i->direct_blocks, -1, DIRECT_BLOCKS_COUNT*sizeof(int));
 	i->parent = -1; //meaning it has no parent
 }
 
 
 int fs_dump(file_system *fs, const char *file_path){
-	uint32_t size = fs->s_block->num_blocks;
-
+	if(wbuf_flush_all(fs) != 0){
+		return -1;
+	}
 	FILE* fs_file = fopen(file_path,"w");
-	fwrite(fs->s_block, sizeof(superblock), 1, fs_file);
-	fwrite(fs->free_list, sizeof(uint8_t),size,fs_file);
-	fwrite(fs->inodes, sizeof(inode),size,fs_file);
-	fwrite(fs->data_blocks, sizeof(data_block),size,fs_file);
+	if(fs_file == NULL){
+		return -1;
+	}
+	checksums_update(fs);
+	write_image(fs, fs_file);
 	fclose(fs_file);
 
+	if(fs->path != NULL && strcmp(file_path, fs->path) == 0){
+		clear_dirty(fs);
+	}
 	return 0;
 
 }
 
 
-int find_free_inode(file_system* fs){
+int fs_dump_atomic(file_system* fs, const char* file_path){
+	size_t len = strlen(file_path);
+	char* tmp_path = malloc(len + sizeof(".tmp"));
+	if(tmp_path == NULL){
+		return -1;
+	}
+	memcpy(tmp_path, file_path, len);
+	memcpy(tmp_path + len, ".tmp", sizeof(".tmp"));
+
+	if(wbuf_flush_all(fs) != 0){
+		free(tmp_path);
+		return -1;
+	}
+	FILE* fs_file = fopen(tmp_path,"w");
+	if(fs_file == NULL){
+		free(tmp_path);
+		return -1;
+	}
+	checksums_update(fs);
+	int ok = write_image(fs, fs_file)
+		&& fflush(fs_file) == 0
+		&& fsync(fileno(fs_file)) == 0;
+	ok = fclose(fs_file) == 0 && ok;
+
+	if(!ok || rename(tmp_path, file_path) != 0){
+		unlink(tmp_path);
+		free(tmp_path);
+		return -1;
+	}
+	free(tmp_path);
+
+	if(fs->path != NULL && strcmp(file_path, fs->path) == 0){
+		clear_dirty(fs);
+	}
+	return 0;
+}
+
+
+/*
+ * Free inodes are kept in a bitmap with a summary bit per word, so an inode is found
+ * without scanning the table. mark_inode_dirty keeps it up to date; an inode taken
+ * without it is noticed by its type and dropped from the bitmap
+ */
+static void inode_index_set(file_system* fs, uint32_t inode_number, int free){
+	uint32_t group = inode_number / 64;
+	uint64_t bit = (uint64_t)1 << (inode_number % 64);
+	if(free){
+		fs->free_inodes[group] |= bit;
+		fs->free_groups[group / 64] |= (uint64_t)1 << (group % 64);
+	}else if((fs->free_inodes[group] &= ~bit) == 0){
+		fs->free_groups[group / 64] &= ~((uint64_t)1 << (group % 64));
+	}
+}
+
+
+static int inode_index_build(file_system* fs){
+	uint32_t size = fs->s_block->num_blocks;
+	uint32_t groups = (size + 63) / 64;
+	fs->free_inodes = calloc(groups, sizeof(uint64_t));
+	fs->free_groups = calloc((groups + 63) / 64, sizeof(uint64_t));
+	if(fs->free_inodes == NULL || fs->free_groups == NULL){
+		inode_index_drop(fs);
+		return -1;
+	}
+	for (uint32_t i=0; i<size; i++) {
+		if(fs->inodes[i].n_type == free_block){
+			inode_index_set(fs, i, 1);
+		}
+	}
+	return 0;
+}
+
+
+void inode_index_drop(file_system* fs){
+	free(fs->free_inodes);
+	free(fs->free_groups);
+	fs->free_inodes = NULL;
+	fs->free_groups = NULL;
+}
+
+
+//first group from group on with a free inode, -1 if there is none
+static int next_free_group(file_system* fs, uint32_t group){
+	uint32_t words = ((fs->s_block->num_blocks + 63) / 64 + 63) / 64;
+	for (uint32_t w=group / 64; w<words; w++) {
+		uint64_t bits = fs->free_groups[w];
+		if(w == group / 64){
+			bits &= ~(uint64_t)0 << (group % 64);
+		}
+		if(bits != 0){
+			return w * 64 + __builtin_ctzll(bits);
+		}
+	}
+	return -1;
+}
+
+
+int find_free_inode(file_system* fs, int near){
+	uint32_t size = fs->s_block->num_blocks;
+	if(fs->free_inodes == NULL && inode_index_build(fs) != 0){
+		//without memory for the bitmap the table is searched
+		for (uint32_t i=0; i<size; i++) {
+			if(fs->inodes[i].n_type == free_block){
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	uint32_t start = near >= 0 && (uint32_t)near < size ? near / 64 : 0;
+	for (;;) {
+		int group = next_free_group(fs, start);
+		if(group == -1){
+			if(start == 0){
+				return -1;
+			}
+			start = 0;
+			continue;
+		}
+		int inode_number = group * 64 + __builtin_ctzll(fs->free_inodes[group]);
+		if(fs->inodes[inode_number].n_type == free_block){
+			return inode_number;
+		}
+		inode_index_set(fs, inode_number, 0);
+	}
+}
+
+int find_free_block(file_system* fs){
 	for (int i=0; i<fs->s_block->num_blocks; i++) {
-		if(fs->inodes[i].n_type==free_block){
+		if(fs->free_list[i]==1){
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+//whether block i may be handed out
+static int block_allocatable(file_system* fs, uint32_t i){
+	return fs->free_list[i]==1 && (fs->txn == NULL || fs->txn->free_list[i]==1);
+}
+
+
+static void claim_block(file_system* fs, uint32_t i){
+	fs->free_list[i] = 0;
+	fs->log_head = i + 1;
+	if(fs->s_block->free_blocks > 0){
+		fs->s_block->free_blocks--;
+	}
+	//nothing of a previous file may show through the parts that aren't written
+	memset(&fs->data_blocks[i], 0, sizeof(data_block));
+	fs->refs[i] = 1;
+	mark_block_dirty(fs, i);
+}
+
+
+int block_alloc(file_system* fs){
+	uint32_t size = fs->s_block->num_blocks;
+	//blocks promised to buffered appends are only handed out to their flush
+	if(fs->reserved_blocks > 0 && fs->s_block->free_blocks <= fs->reserved_blocks){
+		return -1;
+	}
+	//in log mode the search starts at the head of the log instead of block 0
+	uint32_t start = (fs->features & FS_FEATURE_LOG) && size > 0 ? fs->log_head % size : 0;
+	for (uint32_t k=0; k<size; k++) {
+		uint32_t i = start + k < size ? start + k : start + k - size;
+		if(block_allocatable(fs, i)){
+			claim_block(fs, i);
 			return i;
 		}
 	}
@@ -149,8 +730,690 @@ int find_free_inode(file_system* fs){
 }
 
 
+int block_alloc_run(file_system* fs, int count, int near){
+	uint32_t size = fs->s_block->num_blocks;
+	if(count <= 0 || (uint32_t)count > size || fs->s_block->free_blocks < fs->reserved_blocks + count){
+		return -1;
+	}
+	uint32_t start = near >= 0 ? (uint32_t)near % size : 0;
+	uint32_t run = 0;
+	//one more round than blocks, so a run crossing start is found as well
+	for (uint32_t k=0; k<size + count; k++) {
+		uint32_t i = (start + k) % size;
+		//a run doesn't wrap around the end
+		run = i == 0 || !block_allocatable(fs, i) ? block_allocatable(fs, i) : run + 1;
+		if(run == (uint32_t)count){
+			for (uint32_t j=i + 1 - count; j<=i; j++) {
+				claim_block(fs, j);
+			}
+			return i + 1 - count;
+		}
+	}
+	return -1;
+}
+
+
+void block_release(file_system* fs, int block){
+	if(fs->refs[block] > 1){
+		fs->refs[block]--;
+		return;
+	}
+	fs->refs[block] = 0;
+	dedup_forget(fs, block);
+	if(fs->free_list[block] == 0){
+		fs->free_list[block] = 1;
+		fs->s_block->free_blocks++;
+		mark_block_dirty(fs, block);
+	}
+}
+
+
+void block_share(file_system* fs, int block){
+	//a used block nobody counted yet (set up from outside) has one reference
+	fs->refs[block] = (fs->refs[block] ? fs->refs[block] : 1) + 1;
+}
+
+
+int block_for_write(file_system* fs, inode* node, int idx){
+	int block = node->direct_blocks[idx];
+	if(block == -1){
+		block = block_alloc(fs);
+		node->direct_blocks[idx] = block;
+		mark_inode_dirty(fs, node - fs->inodes);
+		return block;
+	}
+
+	int log = (fs->features & FS_FEATURE_LOG) != 0;
+	if(log || fs->refs[block] > 1 || (fs->txn != NULL && fs->txn->free_list[block] == 0)){
+		//the block is shared or belongs to the state an abort returns to: copy on write.
+		//In log mode every write goes to the head of the log
+		int copy = block_alloc(fs);
+		if(copy == -1 && log && fs->refs[block] <= 1 && (fs->txn == NULL || fs->txn->free_list[block] == 1)){
+			//log full: a block nobody else uses can still be written in place
+			dedup_forget(fs, block);
+			mark_block_dirty(fs, block);
+			return block;
+		}
+		if(copy == -1){
+			return -1;
+		}
+		fs->data_blocks[copy] = fs->data_blocks[block];
+		block_release(fs, block);
+		node->direct_blocks[idx] = copy;
+		mark_inode_dirty(fs, node - fs->inodes);
+		return copy;
+	}
+	dedup_forget(fs, block);
+	mark_block_dirty(fs, block);
+	return block;
+}
+
+
+int inode_pwrite(file_system* fs, int inode_number, const uint8_t* buf, size_t len, size_t offset){
+	inode* node = &fs->inodes[inode_number];
+	int flushed = wbuf_flush_inode(fs, inode_number);
+	if(flushed != 0){
+		return flushed;
+	}
+	if(offset > MAX_FILE_SIZE || len > MAX_FILE_SIZE - offset){
+		return -2;
+	}
+	if(len == 0){
+		return 0;
+	}
+	if(fs->features & FS_FEATURE_COMPRESSION){
+		return compressed_pwrite(fs, inode_number, buf, len, offset);
+	}
+
+	//a partial last block the file now grows past is filled up with zeros
+	size_t old_size = node->size;
+	int last = old_size / BLOCK_SIZE;
+	if(old_size % BLOCK_SIZE != 0 && offset >= (size_t)(last + 1) * BLOCK_SIZE && node->direct_blocks[last] != -1){
+		int block = block_for_write(fs, node, last);
+		if(block == -1){
+			return -2;
+		}
+		data_block* tail = &fs->data_blocks[block];
+		if(tail->size < BLOCK_SIZE){
+			memset(tail->block + tail->size, 0, BLOCK_SIZE - tail->size);
+			tail->size = BLOCK_SIZE;
+		}
+	}
+
+	size_t written = 0;
+	while (written < len) {
+		size_t pos = offset + written;
+		int idx = pos / BLOCK_SIZE;
+		size_t in_block = pos % BLOCK_SIZE;
+		size_t n = BLOCK_SIZE - in_block < len - written ? BLOCK_SIZE - in_block : len - written;
+
+		int block = block_for_write(fs, node, idx);
+		if(block == -1){
+			break;
+		}
+		data_block* target = &fs->data_blocks[block];
+		if(target->size < in_block){
+			memset(target->block + target->size, 0, in_block - target->size);
+		}
+		memcpy(target->block + in_block, buf + written, n);
+		if(target->size < in_block + n){
+			target->size = in_block + n;
+		}
+		written += n;
+	}
+
+	if(offset + written > node->size){
+		node->size = offset + written;
+	}
+	for (size_t pos = offset - offset % BLOCK_SIZE; pos < offset + written; pos += BLOCK_SIZE) {
+		dedup_block(fs, inode_number, pos / BLOCK_SIZE);
+	}
+	mark_inode_dirty(fs, inode_number);
+	return written > 0 ? (int)written : -2;
+}
+
+
+int inode_pread(file_system* fs, int inode_number, uint8_t* buf, size_t len, size_t offset){
+	inode* node = &fs->inodes[inode_number];
+	int flushed = wbuf_flush_inode(fs, inode_number);
+	if(flushed != 0){
+		return flushed;
+	}
+	if(checksum_verify_inode(fs, inode_number) != 0){
+		return -3;
+	}
+	if(inode_compressed(fs, node)){
+		return compressed_pread(fs, inode_number, buf, len, offset);
+	}
+	if(offset >= node->size){
+		return 0;
+	}
+	if(len > node->size - offset){
+		len = node->size - offset;
+	}
+
+	size_t done = 0;
+	while (done < len) {
+		size_t pos = offset + done;
+		int block = node->direct_blocks[pos / BLOCK_SIZE];
+		size_t in_block = pos % BLOCK_SIZE;
+		size_t n = BLOCK_SIZE - in_block < len - done ? BLOCK_SIZE - in_block : len - done;
+		if(block == -1){
+			memset(buf + done, 0, n);
+		}else if(checksum_verify_block(fs, block) != 0){
+			return -3;
+		}else{
+			memcpy(buf + done, fs->data_blocks[block].block + in_block, n);
+		}
+		done += n;
+	}
+	return len;
+}
+
+
+//what holes in a file read as
+int inode_spans(file_system* fs, int inode_number, struct iovec* iov){
+	inode* node = &fs->inodes[inode_number];
+	int flushed = wbuf_flush_inode(fs, inode_number);
+	if(flushed != 0){
+		return flushed;
+	}
+	if(checksum_verify_inode(fs, inode_number) != 0){
+		return -3;
+	}
+	if(inode_compressed(fs, node)){
+		return compressed_spans(fs, inode_number, iov);
+	}
+	int count = 0;
+	for (size_t pos = 0; pos < node->size; pos += BLOCK_SIZE) {
+		int block = node->direct_blocks[pos / BLOCK_SIZE];
+		if(block != -1 && checksum_verify_block(fs, block) != 0){
+			return -3;
+		}
+		iov[count].iov_base = block == -1 ? (void*)zero_block : (void*)fs->data_blocks[block].block;
+		iov[count].iov_len = node->size - pos < BLOCK_SIZE ? node->size - pos : BLOCK_SIZE;
+		count++;
+	}
+	return count;
+}
+
+
+int write_spans(int fd, struct iovec* iov, int count){
+	while (count > 0) {
+		ssize_t written = writev(fd, iov, count);
+		if(written < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		//skip what has been written, possibly ending in the middle of a span
+		while (count > 0 && (size_t)written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if(count > 0){
+			iov->iov_base = (uint8_t*)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	return 0;
+}
+
+
+ssize_t read_spans(int fd, struct iovec* iov, int count){
+	ssize_t total = 0;
+	while (count > 0) {
+		ssize_t received = readv(fd, iov, count);
+		if(received < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		if(received == 0){
+			break;
+		}
+		total += received;
+		while (count > 0 && (size_t)received >= iov->iov_len) {
+			received -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if(count > 0){
+			iov->iov_base = (uint8_t*)iov->iov_base + received;
+			iov->iov_len -= received;
+		}
+	}
+	return total;
+}
+
+
+void inode_truncate(file_system* fs, int inode_number){
+	inode* node = &fs->inodes[inode_number];
+	wbuf_drop(fs, inode_number);
+	for (int i=0; i<DIRECT_BLOCKS_COUNT; i++) {
+		if(node->direct_blocks[i] != -1){
+			block_release(fs, node->direct_blocks[i]);
+			node->direct_blocks[i] = -1;
+		}
+	}
+	node->size = 0;
+	node->flags = 0;
+	mark_inode_dirty(fs, inode_number);
+}
+
+
+int inode_shrink(file_system* fs, int inode_number, size_t size){
+	inode* node = &fs->inodes[inode_number];
+	int flushed = wbuf_flush_inode(fs, inode_number);
+	if(flushed != 0){
+		return flushed;
+	}
+	if(size >= node->size){
+		return 0;
+	}
+	if(inode_compressed(fs, node)){
+		compressed_shrink(fs, inode_number, size);
+		return 0;
+	}
+	for (int i=(size + BLOCK_SIZE - 1) / BLOCK_SIZE; i<DIRECT_BLOCKS_COUNT; i++) {
+		if(node->direct_blocks[i] != -1){
+			block_release(fs, node->direct_blocks[i]);
+			node->direct_blocks[i] = -1;
+		}
+	}
+	int last = size / BLOCK_SIZE;
+	if(size % BLOCK_SIZE != 0 && node->direct_blocks[last] != -1){
+		int block = block_for_write(fs, node, last);
+		if(block != -1 && fs->data_blocks[block].size > size % BLOCK_SIZE){
+			fs->data_blocks[block].size = size % BLOCK_SIZE;
+		}
+	}
+	node->size = size;
+	mark_inode_dirty(fs, inode_number);
+	return 0;
+}
+
+
+int find_inode_by_name(file_system* fs, inode* parent, const char* name){
+	for (int i=0; i<DIRECT_BLOCKS_COUNT; i++) {
+		int child = parent->direct_blocks[i];
+		if(child != -1 && strncmp(fs->inodes[child].name, name, NAME_MAX_LENGTH)==0){
+			return child;
+		}
+	}
+	return -1;
+}
+
+
+/*
+ * resolves the first len characters of path
+ */
+static int resolve_path(file_system* fs, const char* path, size_t len){
+	int current = fs->root_node;
+	const char* p = path;
+	const char* path_end = path + len;
+	while (p < path_end) {
+		//skip the separator(s) in front of the next component
+		while (p < path_end && *p == '/') {
+			p++;
+		}
+		if(p == path_end){
+			break;
+		}
+
+		const char* end = memchr(p, '/', path_end - p);
+		size_t component_len = end ? (size_t)(end - p) : (size_t)(path_end - p);
+		if(component_len >= NAME_MAX_LENGTH || fs->inodes[current].n_type != directory){
+			return -1;
+		}
+
+		char name[NAME_MAX_LENGTH];
+		memcpy(name, p, component_len);
+		name[component_len] = '\0';
+
+		current = find_inode_by_name(fs, &fs->inodes[current], name);
+		if(current == -1){
+			return -1;
+		}
+		p += component_len;
+	}
+	return current;
+}
+
+
+int find_inode_by_path(file_system* fs, const char* path){
+	if(path == NULL){
+		return -1;
+	}
+	return resolve_path(fs, path, strlen(path));
+}
+
+
+int find_parent_by_path(file_system* fs, const char* path, char* name){
+	if(path == NULL || path[0] != '/'){
+		return -1;
+	}
+	const char* last_slash = strrchr(path, '/');
+	size_t name_len = strlen(last_slash + 1);
+	if(name_len == 0 || name_len >= NAME_MAX_LENGTH){
+		return -1;
+	}
+
+	int parent = resolve_path(fs, path, last_slash - path);
+	if(parent == -1 || fs->inodes[parent].n_type != directory){
+		return -1;
+	}
+	memset(name, 0, NAME_MAX_LENGTH);
+	memcpy(name, last_slash + 1, name_len);
+	return parent;
+}
+
+
+void mark_inode_dirty(file_system* fs, int inode_number){
+	if(fs->free_inodes != NULL){
+		inode_index_set(fs, inode_number, fs->inodes[inode_number].n_type == free_block);
+	}
+	fs->inode_gen[inode_number] = fs->generation;
+	if(fs->csum != NULL){
+		fs->csum->inode_ok[inode_number] = 1;
+	}
+	dirty_set_add(fs, &fs->dirty_inodes, inode_number);
+}
+
+
+void mark_block_dirty(file_system* fs, int block){
+	fs->block_gen[block] = fs->generation;
+	if(fs->csum != NULL){
+		fs->csum->block_ok[block] = 1;
+	}
+	if(fs->zcache != NULL){
+		cluster_cache_forget(fs, block);
+	}
+	dirty_set_add(fs, &fs->dirty_blocks, block);
+}
+
+
+void mark_trailer_dirty(file_system* fs){
+	fs->trailer_gen = fs->generation;
+	fs->trailer_dirty = 1;
+}
+
+
+void mark_all_dirty(file_system* fs){
+	for (uint32_t i=0; i<fs->s_block->num_blocks; i++) {
+		fs->inode_gen[i] = fs->generation;
+		fs->block_gen[i] = fs->generation;
+	}
+	cluster_cache_clear(fs);
+	inode_index_drop(fs);
+	fs->dirty_all = 1;
+}
+
+
+static int write_at(int fd, const void* buf, size_t len, off_t offset){
+	const uint8_t* p = buf;
+	while (len > 0) {
+		ssize_t written = pwrite(fd, p, len, offset);
+		if(written <= 0){
+			return -1;
+		}
+		p += written;
+		len -= written;
+		offset += written;
+	}
+	return 0;
+}
+
+
+static int compare_numbers(const void* a, const void* b){
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+
+/*
+ * writes the entries of a sorted dirty set from the in-memory array base into the
+ * image region starting at region_offset. Consecutive entries are written at once
+ */
+static int write_runs(int fd, const dirty_set* set, const void* base, size_t entry_size, off_t region_offset){
+	uint32_t i = 0;
+	while (i < set->count) {
+		uint32_t first = set->list[i];
+		uint32_t last = first;
+		while (i + 1 < set->count && set->list[i + 1] == last + 1) {
+			last = set->list[++i];
+		}
+		i++;
+		if(write_at(fd, (const uint8_t*)base + (size_t)first * entry_size, (size_t)(last - first + 1) * entry_size,
+		            region_offset + (off_t)first * entry_size) != 0){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+/*
+ * writes only the dirty parts into the existing image
+ */
+static int sync_dirty(file_system* fs){
+	int fd = open(fs->path, O_WRONLY);
+	if(fd < 0){
+		return fs_dump(fs, fs->path);
+	}
+	uint32_t size = fs->s_block->num_blocks;
+	image_layout layout = layout_of(fs);
+	uint32_t header[3];
+	size_t header_len = header_serialize(fs, header);
+
+	qsort(fs->dirty_inodes.list, fs->dirty_inodes.count, sizeof(uint32_t), compare_numbers);
+	qsort(fs->dirty_blocks.list, fs->dirty_blocks.count, sizeof(uint32_t), compare_numbers);
+	checksums_update(fs);
+
+	int ok = write_at(fd, header, header_len, 0) == 0
+		&& write_runs(fd, &fs->dirty_blocks, fs->free_list, sizeof(uint8_t), layout.free_list) == 0
+		&& write_runs(fd, &fs->dirty_inodes, fs->inodes, sizeof(inode), layout.inodes) == 0
+		&& write_runs(fd, &fs->dirty_blocks, fs->data_blocks, sizeof(data_block), layout.data) == 0;
+	off_t trailer_offset = layout.trailer;
+	if(ok && fs->trailer_dirty){
+		size_t len;
+		uint8_t* trailer = trailer_serialize(fs, &len, 1);
+		ok = (len == 0 || write_at(fd, trailer, len, trailer_offset) == 0) && ftruncate(fd, trailer_offset + len) == 0;
+		free(trailer);
+	}else if(ok){
+		//the stamps and checksums of the written inodes and blocks, in place
+		off_t chunk_offset = trailer_offset;
+		if(fs->features & FS_FEATURE_GENERATIONS){
+			off_t gens_offset = chunk_offset + sizeof(chunk_header);
+			off_t inode_gen_offset = gens_offset + sizeof(gens_header);
+			off_t block_gen_offset = inode_gen_offset + (off_t)size * sizeof(uint32_t);
+			gens_header gens = { .generation = fs->generation, .trailer_gen = fs->trailer_gen,
+			                     .applied_gen = fs->applied_gen, .reserved = 0 };
+			ok = write_at(fd, &gens, sizeof(gens), gens_offset) == 0
+				&& write_runs(fd, &fs->dirty_inodes, fs->inode_gen, sizeof(uint32_t), inode_gen_offset) == 0
+				&& write_runs(fd, &fs->dirty_blocks, fs->block_gen, sizeof(uint32_t), block_gen_offset) == 0;
+			chunk_offset += sizeof(chunk_header) + gens_chunk_len(fs);
+		}
+		if(ok && fs->csum != NULL){
+			off_t inode_csum_offset = chunk_offset + sizeof(chunk_header);
+			off_t block_csum_offset = inode_csum_offset + (off_t)size * sizeof(uint32_t);
+			ok = write_runs(fd, &fs->dirty_inodes, fs->csum->inodes, sizeof(uint32_t), inode_csum_offset) == 0
+				&& write_runs(fd, &fs->dirty_blocks, fs->csum->blocks, sizeof(uint32_t), block_csum_offset) == 0;
+		}
+	}
+	ok = close(fd) == 0 && ok;
+	if(!ok){
+		return -1;
+	}
+	clear_dirty(fs);
+	return 0;
+}
+
+
+int image_extend(file_system* fs, uint32_t old_size){
+	int fd = open(fs->path, O_WRONLY);
+	if(fd < 0){
+		return -1;
+	}
+	uint32_t size = fs->s_block->num_blocks;
+	image_layout layout = layout_of(fs);
+	//the old trailer is cut off; the file extended again reads as empty blocks
+	int ok = ftruncate(fd, layout.data + (off_t)old_size * sizeof(data_block)) == 0
+		&& ftruncate(fd, layout.trailer) == 0
+		&& write_at(fd, fs->free_list + old_size, size - old_size, layout.free_list + old_size) == 0
+		&& write_at(fd, fs->inodes + old_size, (size_t)(size - old_size) * sizeof(inode),
+		            layout.inodes + (off_t)old_size * sizeof(inode)) == 0;
+	ok = close(fd) == 0 && ok;
+	return ok ? 0 : -1;
+}
+
+
+int fs_persist(file_system* fs){
+	if(fs->batch_depth > 0){
+		fs->dirty = 1;
+		return 0;
+	}
+	if(fs->path == NULL){
+		return -1;
+	}
+	//buffered appends get their blocks before anything is written. Without them the
+	//sizes of their files would point past their blocks
+	if(wbuf_flush_all(fs) != 0){
+		return -1;
+	}
+	fs->wbuf_since = 0;
+	if(fs->dirty_all){
+		return fs_dump(fs, fs->path);
+	}
+	return sync_dirty(fs);
+}
+
+
+/*
+ * calls fn for every file block of an inode table
+ */
+static void for_each_block(file_system* fs, inode* inodes, void (*fn)(file_system*, int)){
+	for (uint32_t i=0; i<fs->s_block->num_blocks; i++) {
+		if(inodes[i].n_type != reg_file){
+			continue;
+		}
+		for (int j=0; j<DIRECT_BLOCKS_COUNT; j++) {
+			int block = inodes[i].direct_blocks[j];
+			if(block >= 0 && (uint32_t)block < fs->s_block->num_blocks){
+				fn(fs, block);
+			}
+		}
+	}
+}
+
+
+static void count_ref(file_system* fs, int block){
+	fs->refs[block]++;
+}
+
+
+void share_blocks(file_system* fs, inode* inodes){
+	for_each_block(fs, inodes, block_share);
+}
+
+
+void release_blocks(file_system* fs, inode* inodes){
+	for_each_block(fs, inodes, block_release);
+}
+
+
+void fs_rebuild_refs(file_system* fs){
+	inode_index_drop(fs);
+	memset(fs->refs, 0, fs->s_block->num_blocks * sizeof(uint32_t));
+	for_each_block(fs, fs->inodes, count_ref);
+	for (fs_snapshot* snap = fs->snapshots; snap != NULL; snap = snap->next) {
+		for_each_block(fs, snap->inodes, count_ref);
+	}
+	if(fs->dedup != NULL){
+		dedup_disable(fs);
+		if(dedup_enable(fs) != 0){
+			exit(1);
+		}
+	}
+}
+
+
+int* block_owners(file_system* fs){
+	uint32_t size = fs->s_block->num_blocks;
+	int* owner = malloc(size * sizeof(int));
+	if(owner == NULL){
+		return NULL;
+	}
+	for (uint32_t i=0; i<size; i++) {
+		owner[i] = -1;
+	}
+	for (uint32_t i=0; i<size; i++) {
+		if(fs->inodes[i].n_type != reg_file){
+			continue;
+		}
+		for (int j=0; j<DIRECT_BLOCKS_COUNT; j++) {
+			int block = fs->inodes[i].direct_blocks[j];
+			if(block < 0 || (uint32_t)block >= size){
+				continue;
+			}
+			owner[block] = owner[block] == -1 && fs->refs[block] <= 1 ? (int)(i * DIRECT_BLOCKS_COUNT + j) : -2;
+		}
+	}
+	return owner;
+}
+
+
+void snapshots_free(file_system* fs){
+	while (fs->snapshots != NULL) {
+		fs_snapshot* next = fs->snapshots->next;
+		free(fs->snapshots->inodes);
+		free(fs->snapshots);
+		fs->snapshots = next;
+	}
+}
+
+
+void close_handles(file_system* fs, int inode_number){
+	for (fs_handle* h = fs->handles; h != NULL; h = h->next) {
+		if(h->inode == inode_number){
+			h->inode = -1;
+		}
+	}
+}
+
+
 void cleanup(file_system *fs){
 	
+	if(fs->txn != NULL){
+		free(fs->txn->free_list);
+		free(fs->txn->inodes);
+		free(fs->txn);
+	}
+	while (fs->handles != NULL) {
+		fs_handle* next = fs->handles->next;
+		free(fs->handles);
+		fs->handles = next;
+	}
+	snapshots_free(fs);
+	dedup_disable(fs);
+	checksums_disable(fs);
+	cluster_cache_free(fs);
+	inode_index_drop(fs);
+	while (fs->wbufs != NULL) {
+		wbuf_drop(fs, fs->wbufs->inode);
+	}
+	free(fs->refs);
+	free(fs->inode_gen);
+	free(fs->block_gen);
+	free(fs->path);
+	free(fs->dirty_inodes.flags);
+	free(fs->dirty_inodes.list);
+	free(fs->dirty_blocks.flags);
+	free(fs->dirty_blocks.list);
 	free(fs->s_block);
 	free(fs->inodes);
 	free(fs->free_list);
@@ -0,0 +1,283 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../lib/filesystem.h"
+#include "../lib/operations.h"
+
+/*
+ * Consistency check in three passes:
+ *  1. walk the tree from the root (sequential, touches directories only): entries
+ *     pointing nowhere, to free inodes or to an inode already seen, and children
+ *     whose parent link is wrong
+ *  2. inode table and snapshots, split across threads: used inodes the walk didn't
+ *     reach, block numbers out of range; every referenced block is set in an atomic
+ *     bitmap
+ *  3. block range, split across threads: the free list against that bitmap, and the
+ *     number of free blocks
+ */
+
+typedef struct _fsck_state{
+	file_system* fs;
+	int repair;
+	uint8_t* reached; //inodes reached from the root
+	_Atomic uint64_t* referenced; //blocks referenced by a reached file or a snapshot
+	fs_fsck_report report; //filled by pass 1, the passes 2 and 3 add their part
+} fsck_state;
+
+typedef struct _fsck_part{
+	fsck_state* state;
+	uint32_t start;
+	uint32_t end;
+	fs_fsck_report report; //what this part found
+	uint32_t free_blocks; //free blocks in this part (pass 3)
+} fsck_part;
+
+
+//a repaired inode counts as changed, its checksum is recomputed instead of kept
+static void repaired(file_system* fs, uint32_t inode_number){
+	if(fs->csum != NULL){
+		fs->csum->inode_ok[inode_number] = 1;
+	}
+}
+
+
+static void check_tree(fsck_state* state){
+	file_system* fs = state->fs;
+	uint32_t size = fs->s_block->num_blocks;
+	uint32_t root = fs->root_node;
+	if(root >= size || fs->inodes[root].n_type != directory){
+		state->report.bad_links++;
+		return;
+	}
+
+	//the list of reached directories doubles as the work stack
+	uint32_t* dirs = malloc(size * sizeof(uint32_t));
+	if(dirs == NULL){
+		return;
+	}
+	uint32_t count = 0;
+	dirs[count++] = root;
+	state->reached[root] = 1;
+	for (uint32_t i=0; i<count; i++) {
+		inode* dir = &fs->inodes[dirs[i]];
+		for (int j=0; j<DIRECT_BLOCKS_COUNT; j++) {
+			int child = dir->direct_blocks[j];
+			if(child == -1){
+				continue;
+			}
+			if(child < 0 || (uint32_t)child >= size || fs->inodes[child].n_type == free_block || state->reached[child]){
+				state->report.bad_links++;
+				if(state->repair){
+					dir->direct_blocks[j] = -1;
+					repaired(fs, dirs[i]);
+				}
+				continue;
+			}
+			state->reached[child] = 1;
+			if(fs->inodes[child].parent != (int)dirs[i]){
+				state->report.bad_links++;
+				if(state->repair){
+					fs->inodes[child].parent = dirs[i];
+					repaired(fs, child);
+				}
+			}
+			if(fs->inodes[child].n_type == directory){
+				dirs[count++] = child;
+			}
+		}
+	}
+	free(dirs);
+}
+
+
+//@return number of bad block references
+static int reference_blocks(fsck_part* part, inode* node){
+	fsck_state* state = part->state;
+	uint32_t size = state->fs->s_block->num_blocks;
+	int bad = 0;
+	for (int j=0; j<DIRECT_BLOCKS_COUNT; j++) {
+		int block = node->direct_blocks[j];
+		if(block == -1){
+			continue;
+		}
+		if(block < 0 || (uint32_t)block >= size){
+			part->report.bad_block_refs++;
+			bad++;
+			if(state->repair){
+				node->direct_blocks[j] = -1;
+			}
+			continue;
+		}
+		atomic_fetch_or_explicit(&state->referenced[block / 64], (uint64_t)1 << (block % 64), memory_order_relaxed);
+	}
+	return bad;
+}
+
+
+static void* check_inodes(void* arg){
+	fsck_part* part = arg;
+	fsck_state* state = part->state;
+	file_system* fs = state->fs;
+	for (uint32_t i=part->start; i<part->end; i++) {
+		inode* node = &fs->inodes[i];
+		if(node->n_type == free_block){
+			continue;
+		}
+		if(!state->reached[i]){
+			//its blocks aren't referenced, pass 3 frees them
+			part->report.orphans++;
+			if(state->repair){
+				inode_init(node);
+				repaired(fs, i);
+			}
+			continue;
+		}
+		if(node->n_type == reg_file && reference_blocks(part, node) > 0 && state->repair){
+			repaired(fs, i);
+		}
+	}
+	for (fs_snapshot* snap = fs->snapshots; snap != NULL; snap = snap->next) {
+		for (uint32_t i=part->start; i<part->end; i++) {
+			if(snap->inodes[i].n_type == reg_file){
+				reference_blocks(part, &snap->inodes[i]);
+			}
+		}
+	}
+	return NULL;
+}
+
+
+static void* check_free_list(void* arg){
+	fsck_part* part = arg;
+	fsck_state* state = part->state;
+	file_system* fs = state->fs;
+	for (uint32_t i=part->start; i<part->end; i++) {
+		int referenced = (atomic_load_explicit(&state->referenced[i / 64], memory_order_relaxed) >> (i % 64)) & 1;
+		int marked_free = fs->free_list[i] != 0;
+		if(referenced && marked_free){
+			part->report.free_but_used++;
+		}else if(!referenced && !marked_free){
+			part->report.leaked_blocks++;
+		}
+		if(state->repair){
+			fs->free_list[i] = !referenced;
+		}
+		part->free_blocks += !referenced;
+	}
+	return NULL;
+}
+
+
+/*
+ * runs fn on nthreads parts of 0..count and adds up what they found
+ */
+static uint32_t run_parts(fsck_state* state, int nthreads, uint32_t count, void* (*fn)(void*)){
+	fsck_part* parts = calloc(nthreads, sizeof(fsck_part));
+	pthread_t* threads = malloc(nthreads * sizeof(pthread_t));
+	uint8_t* started = calloc(nthreads, 1);
+	if(parts == NULL || threads == NULL || started == NULL){
+		free(parts);
+		free(threads);
+		free(started);
+		//one part, checked on this thread
+		nthreads = 1;
+		parts = calloc(1, sizeof(fsck_part));
+		threads = NULL;
+		started = NULL;
+		if(parts == NULL){
+			return 0;
+		}
+	}
+
+	uint32_t chunk = (count + nthreads - 1) / nthreads;
+	for (int i=0; i<nthreads; i++) {
+		parts[i].state = state;
+		parts[i].start = (uint64_t)chunk * i < count ? chunk * i : count;
+		parts[i].end = count - parts[i].start > chunk ? parts[i].start + chunk : count;
+	}
+	//part 0 runs here, as does every part whose thread could not be started
+	for (int i=1; i<nthreads; i++) {
+		if(pthread_create(&threads[i], NULL, fn, &parts[i]) == 0){
+			started[i] = 1;
+		}else{
+			fn(&parts[i]);
+		}
+	}
+	fn(&parts[0]);
+
+	uint32_t free_blocks = 0;
+	for (int i=0; i<nthreads; i++) {
+		if(started != NULL && started[i]){
+			pthread_join(threads[i], NULL);
+		}
+		state->report.orphans += parts[i].report.orphans;
+		state->report.bad_block_refs += parts[i].report.bad_block_refs;
+		state->report.free_but_used += parts[i].report.free_but_used;
+		state->report.leaked_blocks += parts[i].report.leaked_blocks;
+		free_blocks += parts[i].free_blocks;
+	}
+	free(parts);
+	free(threads);
+	free(started);
+	return free_blocks;
+}
+
+
+int fs_fsck(file_system *fs, int repair, int nthreads, fs_fsck_report *report){
+	if(fs == NULL || fs->txn != NULL){
+		return -1;
+	}
+	uint32_t size = fs->s_block->num_blocks;
+	if(nthreads < 1){
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if(nthreads < 1){
+		nthreads = 1;
+	}
+	//no check looks at file sizes, so buffered appends don't matter: their blocks are
+	//still free, counted in free_blocks and only set aside. A repair persists the
+	//whole image, they get their blocks first
+	if(repair && wbuf_flush_all(fs) != 0){
+		return -1;
+	}
+
+	fsck_state state = { .fs = fs, .repair = repair };
+	state.reached = calloc(size, 1);
+	state.referenced = calloc((size + 63) / 64, sizeof(uint64_t));
+	if(state.reached == NULL || state.referenced == NULL){
+		free(state.reached);
+		free((void*)state.referenced);
+		return -1;
+	}
+
+	check_tree(&state);
+	run_parts(&state, nthreads, size, check_inodes);
+	uint32_t free_blocks = run_parts(&state, nthreads, size, check_free_list);
+	if(free_blocks != fs->s_block->free_blocks){
+		state.report.bad_free_count = 1;
+		if(repair){
+			fs->s_block->free_blocks = free_blocks;
+		}
+	}
+	free(state.reached);
+	free((void*)state.referenced);
+
+	fs_fsck_report* r = &state.report;
+	int problems = r->bad_links + r->orphans + r->bad_block_refs + r->free_but_used + r->leaked_blocks + r->bad_free_count;
+	if(report != NULL){
+		*report = *r;
+	}
+	if(repair && problems > 0){
+		//everything derived from the inodes and the free list, then the whole image
+		fs_rebuild_refs(fs);
+		mark_all_dirty(fs);
+		if(fs_persist(fs) != 0){
+			return -1;
+		}
+	}
+	return problems;
+}
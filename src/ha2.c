@@ -2,12 +2,148 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include "../lib/filesystem.h"
 #include "../lib/linenoise.h"
 #include "../lib/operations.h"
+#include "../lib/server.h"
 #include "../lib/utils.h"
 
+/*
+ * Executes a script with one command per line (same syntax as the interactive
+ * commands) as a single batch, so the filesystem is persisted only once.
+ */
+static void
+run_batch(file_system *fs, const char *script_path)
+{
+	static const struct {
+		const char *name;
+		enum fs_batch_op op;
+	} commands[] = {
+		{ "mkdir", FS_BATCH_MKDIR },   { "mkfile", FS_BATCH_MKFILE },
+		{ "writef", FS_BATCH_WRITEF }, { "rm", FS_BATCH_RM },
+		{ "import", FS_BATCH_IMPORT }, { "export", FS_BATCH_EXPORT },
+	};
+
+	if (script_path == NULL) {
+		fprintf(stderr, "Usage: batch <script>\n");
+		return;
+	}
+	FILE *script = fopen(script_path, "r");
+	if (script == NULL) {
+		fprintf(stderr, "Could not open %s\n", script_path);
+		return;
+	}
+
+	fs_op *ops        = NULL;
+	int *line_numbers = NULL;
+	int count = 0, capacity = 0, line_number = 0;
+	char *line      = NULL;
+	size_t line_cap = 0;
+	while (getline(&line, &line_cap, script) != -1) {
+		line_number++;
+		char *command = strtok(line, " \n");
+		if (command == NULL) {
+			continue;
+		}
+
+		int known = 0;
+		fs_op op  = { 0 };
+		for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+			if (!strcmp(command, commands[i].name)) {
+				op.op = commands[i].op;
+				known = 1;
+			}
+		}
+		if (!known) {
+			fprintf(stderr, "line %d: unknown command %s\n", line_number, command);
+			continue;
+		}
+
+		char *path = strtok(NULL, " \n");
+		char *arg  = strtok(NULL, "\n");
+		op.path    = path ? strdup(path) : NULL;
+		op.arg     = arg ? strdup(arg) : NULL;
+
+		if (count == capacity) {
+			capacity     = capacity ? capacity * 2 : 64;
+			ops          = realloc(ops, capacity * sizeof(fs_op));
+			line_numbers = realloc(line_numbers, capacity * sizeof(int));
+			if (ops == NULL || line_numbers == NULL) {
+				exit(1);
+			}
+		}
+		line_numbers[count] = line_number;
+		ops[count++]        = op;
+	}
+	free(line);
+	fclose(script);
+
+	int failed = fs_batch_exec(fs, ops, count);
+	for (int i = 0; i < count; i++) {
+		if (ops[i].status < 0) {
+			fprintf(stderr, "line %d: failed with %d\n", line_numbers[i], ops[i].status);
+		}
+		free(ops[i].path);
+		free(ops[i].arg);
+	}
+	if (failed == -1) {
+		fprintf(stderr, "Could not persist the batch\n");
+	}
+	free(ops);
+	free(line_numbers);
+}
+
+/*
+ * snapshot create|delete|restore <name>, snapshot list,
+ * snapshot ls <name> <path>, snapshot readf <name> <file>
+ */
+static void
+run_snapshot(file_system *fs)
+{
+	char *action = strtok(NULL, " \n");
+	char *name   = strtok(NULL, " \n");
+	char *path   = strtok(NULL, " \n");
+	int ret      = 0;
+
+	if (action != NULL && !strcmp(action, "list")) {
+		char *list = fs_snapshot_list(fs);
+		if (list != NULL) {
+			printf("%s", list);
+			free(list);
+		}
+	} else if (action == NULL || name == NULL) {
+		ret = -1;
+	} else if (!strcmp(action, "create")) {
+		ret = fs_snapshot_create(fs, name);
+	} else if (!strcmp(action, "delete")) {
+		ret = fs_snapshot_delete(fs, name);
+	} else if (!strcmp(action, "restore")) {
+		ret = fs_snapshot_restore(fs, name);
+	} else if (!strcmp(action, "ls") && path != NULL) {
+		char *list = fs_snapshot_ls(fs, name, path);
+		ret = list == NULL ? -1 : 0;
+		if (list != NULL) {
+			printf("%s", list);
+			free(list);
+		}
+	} else if (!strcmp(action, "readf") && path != NULL) {
+		int file_size  = 0;
+		uint8_t *data = fs_snapshot_readf(fs, name, path, &file_size);
+		fwrite(data, file_size, 1, stdout);
+		free(data);
+	} else {
+		ret = -1;
+	}
+	fflush(stdout);
+	if (ret != 0) {
+		fprintf(stderr, "snapshot failed. Usage: snapshot create|delete|restore <name>, snapshot list, "
+		                "snapshot ls <name> <path>, snapshot readf <name> <file>\n");
+	}
+}
+
 int
 main(int argc, const char *argv[])
 {
@@ -27,6 +163,20 @@ main(int argc, const char *argv[])
 		}
 	} else if (strcmp(argv[1], "-l") == 0 || strcmp(argv[1], "--load") == 0) {
 		fs = fs_load(argv[2]);
+	} else if (strcmp(argv[1], "-s") == 0 || strcmp(argv[1], "--serve") == 0) {
+		if (argc < 4) {
+			fprintf(stderr, "Not enough arguments given\n");
+			printhelp();
+			exit(1);
+		}
+		fs = fs_load(argv[2]);
+		if (fs == NULL) {
+			fprintf(stderr, "Could not load filesystem %s\n", argv[2]);
+			exit(1);
+		}
+		int ret = fs_serve(fs, argv[3]);
+		cleanup(fs);
+		exit(ret == 0 ? 0 : 1);
 	} else if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
 		printhelp();
 	} 
@@ -39,9 +189,18 @@ main(int argc, const char *argv[])
 		if (input_buf != NULL) {
 			linenoiseHistoryAdd(input_buf);
 		} else {
-			//TODO: error handling
+			//end of input
+			if (fs->wbufs != NULL) {
+				fs_flush(fs);
+			}
+			cleanup(fs);
+			exit(0);
 		}
 		char *command = strtok(input_buf, " \n");
+		if (command == NULL) {
+			free(input_buf);
+			continue;
+		}
 
 		//determine which command to execute (only our build in commands are possible)
 		if (!strcmp(command, "mkdir")) {
@@ -62,32 +221,214 @@ main(int argc, const char *argv[])
 			LOG("Chosen writef\n");
 		} else if (!strcmp(command, "readf")) {
 			LOG("Chosen readf\n");
-			int file_size = 0;
-			char *output  = (char *)fs_readf(fs, strtok(NULL, " \n"), &file_size);
-			fwrite(output, file_size, 1, stdout);
-			fflush(stdout);
-			free(output);
+			//hand the blocks to the kernel as they are instead of copying the file
+			struct iovec spans[FS_MAX_SPANS];
+			int count = fs_readv(fs, strtok(NULL, " \n"), spans);
+			if(count > 0){
+				fflush(stdout);
+				write_spans(STDOUT_FILENO, spans, count);
+			}
+		} else if (!strcmp(command, "cp")) {
+			LOG("Chosen cp\n");
+			char *src = strtok(NULL, " \n");
+			char *dst = strtok(NULL, " \n");
+			if (src == NULL || dst == NULL) {
+				fprintf(stderr, "Usage: cp <src> <dst>\n");
+			} else if (fs_clone(fs, src, dst) != 0) {
+				fprintf(stderr, "cp failed\n");
+			}
 		} else if (!strcmp(command, "rm")) {
 			LOG("Chosen rm\n");
 			fs_rm(fs, strtok(NULL, " \n"));
 		} else if (!strcmp(command, "export")) {
 			char *int_path = strtok(NULL, " \n");
-			char *ext_path = strtok(NULL, "\0");
-			fs_export(fs, int_path, ext_path);
+			if (int_path != NULL && !strcmp(int_path, "-r")) {
+				//export -r <int_dir> <ext_dir>: whole internal directory tree
+				int_path = strtok(NULL, " \n");
+				char *ext_path = strtok(NULL, "\0");
+				int failed = fs_export_tree(fs, int_path, ext_path, sysconf(_SC_NPROCESSORS_ONLN));
+				if (failed != 0) {
+					fprintf(stderr, "export -r: %d entries failed\n", failed);
+				}
+			} else {
+				char *ext_path = strtok(NULL, "\0");
+				fs_export(fs, int_path, ext_path);
+			}
 			LOG("Chosen export\n");
 		} else if (!strcmp(command, "import")) {
 			char *int_path = strtok(NULL, " \n");
-			char *ext_path = strtok(NULL, "\0");
-			fs_import(fs, int_path, ext_path);
+			if (int_path != NULL && !strcmp(int_path, "-r")) {
+				//import -r <int_dir> <ext_dir>: whole host directory tree
+				int_path = strtok(NULL, " \n");
+				char *ext_path = strtok(NULL, "\0");
+				int failed = fs_import_tree(fs, int_path, ext_path, sysconf(_SC_NPROCESSORS_ONLN));
+				if (failed != 0) {
+					fprintf(stderr, "import -r: %d entries failed\n", failed);
+				}
+			} else {
+				char *ext_path = strtok(NULL, "\0");
+				fs_import(fs, int_path, ext_path);
+			}
+		} else if (!strcmp(command, "sync")) {
+			LOG("Chosen sync\n");
+			char *int_dir = strtok(NULL, " \n");
+			char *ext_dir = strtok(NULL, "\n");
+			int failed    = fs_sync_dir(fs, int_dir, ext_dir);
+			if (failed != 0) {
+				fprintf(stderr, "sync: %d entries failed\n", failed);
+			}
+		} else if (!strcmp(command, "batch")) {
+			LOG("Chosen batch\n");
+			run_batch(fs, strtok(NULL, "\n"));
+		} else if (!strcmp(command, "begin")) {
+			LOG("Starting batch\n");
+			fs_batch_begin(fs);
+		} else if (!strcmp(command, "commit")) {
+			LOG("Committing batch\n");
+			fs_batch_commit(fs);
+		} else if (!strcmp(command, "txn")) {
+			LOG("Chosen txn\n");
+			char *action = strtok(NULL, " \n");
+			int ret      = -1;
+			if (action == NULL) {
+				fprintf(stderr, "Usage: txn begin|commit|abort\n");
+			} else if (!strcmp(action, "begin")) {
+				ret = fs_txn_begin(fs);
+			} else if (!strcmp(action, "commit")) {
+				ret = fs_txn_commit(fs);
+			} else if (!strcmp(action, "abort")) {
+				ret = fs_txn_abort(fs);
+			}
+			if (ret != 0) {
+				fprintf(stderr, "txn failed\n");
+			}
+		} else if (!strcmp(command, "snapshot")) {
+			LOG("Chosen snapshot\n");
+			run_snapshot(fs);
+		} else if (!strcmp(command, "delta")) {
+			LOG("Chosen delta\n");
+			char *action = strtok(NULL, " \n");
+			if (action != NULL && !strcmp(action, "export")) {
+				char *since = strtok(NULL, " \n");
+				char *path  = strtok(NULL, "\n");
+				int generation = since == NULL ? -1 : fs_delta_export(fs, strtoul(since, NULL, 10), path);
+				if (generation < 0) {
+					fprintf(stderr, "delta export failed\n");
+				} else {
+					printf("%d\n", generation);
+					fflush(stdout);
+				}
+			} else if (action != NULL && !strcmp(action, "apply")) {
+				if (fs_delta_apply(fs, strtok(NULL, "\n")) != 0) {
+					fprintf(stderr, "delta apply failed\n");
+				}
+			} else {
+				fprintf(stderr, "Usage: delta export <since> <file>, delta apply <file>\n");
+			}
+		} else if (!strcmp(command, "dedup")) {
+			char *mode = strtok(NULL, " \n");
+			if (mode == NULL || (strcmp(mode, "on") && strcmp(mode, "off"))) {
+				fprintf(stderr, "Usage: dedup on|off\n");
+			} else if (fs_set_dedup(fs, !strcmp(mode, "on")) != 0) {
+				fprintf(stderr, "dedup failed\n");
+			}
+		} else if (!strcmp(command, "checksum")) {
+			char *mode = strtok(NULL, " \n");
+			if (mode == NULL || (strcmp(mode, "on") && strcmp(mode, "off"))) {
+				fprintf(stderr, "Usage: checksum on|off\n");
+			} else if (fs_set_checksums(fs, !strcmp(mode, "on")) != 0) {
+				fprintf(stderr, "checksum failed\n");
+			}
+		} else if (!strcmp(command, "scrub")) {
+			LOG("Chosen scrub\n");
+			fs_scrub_report report;
+			if (fs_scrub(fs, 0, &report) < 0) {
+				fprintf(stderr, "scrub failed\n");
+			} else {
+				printf("bad inodes: %u\nbad blocks: %u\n", report.bad_inodes, report.bad_blocks);
+				fflush(stdout);
+			}
+		} else if (!strcmp(command, "resize")) {
+			LOG("Chosen resize\n");
+			char *blocks = strtok(NULL, " \n");
+			int ret = blocks == NULL ? -1 : fs_resize(fs, strtoul(blocks, NULL, 10));
+			if (ret == -2) {
+				fprintf(stderr, "resize failed: the data doesn't fit\n");
+			} else if (ret == -3) {
+				fprintf(stderr, "resize failed: checksum mismatch\n");
+			} else if (ret != 0) {
+				fprintf(stderr, "Usage: resize <blocks>\n");
+			}
+		} else if (!strcmp(command, "defrag")) {
+			LOG("Chosen defrag\n");
+			char *budget = strtok(NULL, " \n");
+			fs_defrag_report report;
+			if (fs_defrag(fs, budget == NULL ? 0 : strtoul(budget, NULL, 10), &report) < 0) {
+				fprintf(stderr, "defrag failed\n");
+			} else {
+				printf("fragmentation before: %u\nfragmentation after: %u\nmoved blocks: %u\npinned blocks: %u\n",
+				       report.score_before, report.score_after, report.moved_blocks, report.pinned_blocks);
+				fflush(stdout);
+			}
+		} else if (!strcmp(command, "log")) {
+			char *mode = strtok(NULL, " \n");
+			if (mode != NULL && !strcmp(mode, "clean")) {
+				char *budget = strtok(NULL, " \n");
+				int moved = fs_log_clean(fs, budget == NULL ? 0 : strtoul(budget, NULL, 10));
+				if (moved < 0) {
+					fprintf(stderr, "log clean failed\n");
+				} else {
+					printf("moved blocks: %d\n", moved);
+					fflush(stdout);
+				}
+			} else if (mode == NULL || (strcmp(mode, "on") && strcmp(mode, "off"))) {
+				fprintf(stderr, "Usage: log on|off|clean [budget]\n");
+			} else if (fs_set_log(fs, !strcmp(mode, "on")) != 0) {
+				fprintf(stderr, "log failed\n");
+			}
+		} else if (!strcmp(command, "compress")) {
+			char *mode = strtok(NULL, " \n");
+			if (mode == NULL || (strcmp(mode, "on") && strcmp(mode, "off"))) {
+				fprintf(stderr, "Usage: compress on|off\n");
+			} else if (fs_set_compression(fs, !strcmp(mode, "on")) != 0) {
+				fprintf(stderr, "compress failed\n");
+			}
+		} else if (!strcmp(command, "buffer")) {
+			char *mode = strtok(NULL, " \n");
+			if (mode == NULL || (strcmp(mode, "on") && strcmp(mode, "off"))) {
+				fprintf(stderr, "Usage: buffer on|off\n");
+			} else if (fs_set_write_buffering(fs, !strcmp(mode, "on")) != 0) {
+				fprintf(stderr, "buffer failed\n");
+			}
+		} else if (!strcmp(command, "flush")) {
+			if (fs_flush(fs) != 0) {
+				fprintf(stderr, "flush failed\n");
+			}
+		} else if (!strcmp(command, "fsck")) {
+			LOG("Chosen fsck\n");
+			char *mode = strtok(NULL, " \n");
+			fs_fsck_report report;
+			int problems = fs_fsck(fs, mode != NULL && !strcmp(mode, "repair"), 0, &report);
+			if (problems < 0) {
+				fprintf(stderr, "fsck failed\n");
+			} else {
+				printf("bad links: %u\norphans: %u\nbad block refs: %u\nfree but used: %u\nleaked blocks: %u\nbad free count: %u\n",
+				       report.bad_links, report.orphans, report.bad_block_refs,
+				       report.free_but_used, report.leaked_blocks, report.bad_free_count);
+				fflush(stdout);
+			}
 		} else if (!strcmp(command, "dump")) {
 			LOG("Saving filesystem to disk\n");
 			fs_dump(fs, argv[2]);
 		} else if (!strcmp(command, "exit") || !strcmp(command, "quit")) {
+			if (fs->wbufs != NULL) {
+				fs_flush(fs);
+			}
 			cleanup(fs);
 			free(input_buf);
 			exit(0);
 		} else {
-			LOG("Unknown command\nValid commands:\nlist\nmkfile\nmakedir\nrm\nexport\nimport\nwritef\nreadf\ndump\n");
+			LOG("Unknown command\nValid commands:\nlist\nmkfile\nmakedir\nrm\nexport\nimport\nsync\nwritef\nreadf\ncp\nbatch\nbegin\ncommit\ntxn\nsnapshot\ndelta\ndedup\nchecksum\nscrub\nfsck\nresize\ndefrag\nlog\ncompress\nbuffer\nflush\ndump\n");
 		}
 		free(input_buf);
 	}
@@ -0,0 +1,140 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/filesystem.h"
+#include "../lib/operations.h"
+
+/*
+ * In log mode the data blocks form a circular log: block_alloc hands out the first
+ * free block at or after the head and block_for_write copies every block it is
+ * asked for, so rewriting a file appends its new blocks at the head and frees the
+ * old ones behind it. The inodes are the map from a file to the newest copy of its
+ * blocks; they keep their fixed places in the image.
+ * The log is cut into segments of LOG_SEGMENT_BLOCKS blocks. Overwrites leave holes
+ * in the segments the head has passed; the cleaner moves the few live blocks of
+ * such segments to the head, so they are free as a whole when the head comes back.
+ */
+
+#define LOG_SEGMENT_BLOCKS 32
+#define LOG_CLEAN_LIVENESS 50 //percent of live blocks up to which a segment is cleaned
+
+
+void log_rewind(file_system* fs){
+	fs->log_head = 0;
+	for (uint32_t i=fs->s_block->num_blocks; i>0; i--) {
+		if(fs->free_list[i - 1] == 0){
+			fs->log_head = i;
+			break;
+		}
+	}
+}
+
+
+/*
+ * moves used block from to the free block to, keeping its references and its owner
+ */
+static void move_block(file_system* fs, int* owner, int from, int to){
+	fs->data_blocks[to] = fs->data_blocks[from];
+	fs->free_list[to] = 0;
+	fs->free_list[from] = 1;
+	fs->refs[to] = fs->refs[from];
+	fs->refs[from] = 0;
+	dedup_forget(fs, from);
+	mark_block_dirty(fs, from);
+	mark_block_dirty(fs, to);
+
+	owner[to] = owner[from];
+	owner[from] = -1;
+	int inode_number = owner[to] / DIRECT_BLOCKS_COUNT;
+	fs->inodes[inode_number].direct_blocks[owner[to] % DIRECT_BLOCKS_COUNT] = to;
+	mark_inode_dirty(fs, inode_number);
+}
+
+
+/*
+ * the first free block at or after the head of the log outside [start, end), -1 if none
+ */
+static int next_free(file_system* fs, uint32_t start, uint32_t end){
+	uint32_t size = fs->s_block->num_blocks;
+	for (uint32_t k=0; k<size; k++) {
+		uint32_t i = (fs->log_head + k) % size;
+		if(fs->free_list[i] == 1 && (i < start || i >= end)){
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+/*
+ * empties the segment [start, end) if few enough of its blocks are live and all of
+ * them can be moved
+ * @return number of moved blocks, 0 if the segment was left alone
+ */
+static uint32_t clean_segment(file_system* fs, int* owner, uint32_t start, uint32_t end, uint32_t budget, int limited){
+	uint32_t live = 0;
+	uint32_t free_inside = 0;
+	for (uint32_t i=start; i<end; i++) {
+		if(fs->free_list[i] != 0){
+			free_inside++;
+			continue;
+		}
+		//blocks without a single owner and damaged blocks stay where they are
+		if(owner[i] < 0 || checksum_verify_block(fs, i) != 0){
+			return 0;
+		}
+		live++;
+	}
+	if(live == 0 || live * 100 > (end - start) * LOG_CLEAN_LIVENESS
+		|| fs->s_block->free_blocks - free_inside < live){
+		return 0;
+	}
+
+	uint32_t moved = 0;
+	for (uint32_t i=start; i<end && (!limited || moved < budget); i++) {
+		if(fs->free_list[i] != 0){
+			continue;
+		}
+		int to = next_free(fs, start, end);
+		if(to == -1){
+			break;
+		}
+		move_block(fs, owner, i, to);
+		fs->log_head = to + 1;
+		moved++;
+	}
+	return moved;
+}
+
+
+int fs_log_clean(file_system *fs, uint32_t budget){
+	if(fs == NULL || !(fs->features & FS_FEATURE_LOG) || fs->txn != NULL){
+		return -1;
+	}
+	int* owner = block_owners(fs);
+	if(owner == NULL){
+		return -1;
+	}
+
+	//oldest segment first: the one after the head
+	uint32_t size = fs->s_block->num_blocks;
+	uint32_t segments = (size + LOG_SEGMENT_BLOCKS - 1) / LOG_SEGMENT_BLOCKS;
+	uint32_t first = (fs->log_head % size) / LOG_SEGMENT_BLOCKS + 1;
+	uint32_t moved = 0;
+	for (uint32_t k=0; k+1<segments && (budget == 0 || moved < budget); k++) {
+		uint32_t start = (first + k) % segments * LOG_SEGMENT_BLOCKS;
+		uint32_t end = start + LOG_SEGMENT_BLOCKS < size ? start + LOG_SEGMENT_BLOCKS : size;
+		//the head may have moved into the segment while cleaning the last one
+		if(fs->log_head % size >= start && fs->log_head % size < end){
+			continue;
+		}
+		moved += clean_segment(fs, owner, start, end, budget - moved, budget > 0);
+	}
+	free(owner);
+
+	if(moved > 0 && fs_persist(fs) != 0){
+		return -1;
+	}
+	return moved;
+}
@@ -0,0 +1,169 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "../lib/lz.h"
+
+/*
+ * A sequence is a token byte, the literals, a little endian 2 byte offset back into
+ * the output and the match. The high nibble of the token is the number of literals,
+ * the low nibble the match length minus LZ_MIN_MATCH; 15 means more length follows
+ * in bytes that are added up until one is below 255. The last sequence has only
+ * literals and ends the input.
+ */
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+
+
+static uint32_t read32(const uint8_t* p){
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+
+static uint32_t hash(uint32_t v){
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+
+//writes the part of a length past the token, NULL if out is full
+static uint8_t* put_length(uint8_t* out, const uint8_t* end, size_t len){
+	for (; len >= 255; len -= 255) {
+		if(out == end){
+			return NULL;
+		}
+		*out++ = 255;
+	}
+	if(out == end){
+		return NULL;
+	}
+	*out++ = len;
+	return out;
+}
+
+
+/*
+ * writes one sequence, without a match if match_len is 0
+ * @return the end of the sequence, NULL if out is full
+ */
+static uint8_t* put_sequence(uint8_t* out, const uint8_t* end, const uint8_t* literals, size_t literal_len, size_t offset, size_t match_len){
+	if(out == end){
+		return NULL;
+	}
+	size_t match_code = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+	uint8_t* token = out++;
+	*token = (literal_len < 15 ? literal_len : 15) << 4 | (match_code < 15 ? match_code : 15);
+	if(literal_len >= 15 && (out = put_length(out, end, literal_len - 15)) == NULL){
+		return NULL;
+	}
+	if(literal_len > (size_t)(end - out)){
+		return NULL;
+	}
+	memcpy(out, literals, literal_len);
+	out += literal_len;
+	if(match_len == 0){
+		return out;
+	}
+	if(end - out < 2){
+		return NULL;
+	}
+	*out++ = offset & 0xFF;
+	*out++ = offset >> 8;
+	if(match_code >= 15 && (out = put_length(out, end, match_code - 15)) == NULL){
+		return NULL;
+	}
+	return out;
+}
+
+
+int lz_compress(const uint8_t* src, size_t len, uint8_t* dst, size_t cap){
+	//position + 1 of the last 4 bytes with each hash, 0 if none
+	uint32_t table[1 << LZ_HASH_BITS];
+	memset(table, 0, sizeof(table));
+	uint8_t* out = dst;
+	const uint8_t* end = dst + cap;
+	size_t anchor = 0;
+	size_t i = 0;
+	while (i + LZ_MIN_MATCH <= len) {
+		uint32_t h = hash(read32(src + i));
+		size_t candidate = table[h];
+		table[h] = i + 1;
+		if(candidate == 0 || i - (candidate - 1) > LZ_MAX_OFFSET || read32(src + candidate - 1) != read32(src + i)){
+			i++;
+			continue;
+		}
+		size_t match = candidate - 1;
+		size_t match_len = LZ_MIN_MATCH;
+		while (i + match_len < len && src[match + match_len] == src[i + match_len]) {
+			match_len++;
+		}
+		out = put_sequence(out, end, src + anchor, i - anchor, i - match, match_len);
+		if(out == NULL){
+			return -1;
+		}
+		i += match_len;
+		anchor = i;
+	}
+	out = put_sequence(out, end, src + anchor, len - anchor, 0, 0);
+	return out == NULL ? -1 : (int)(out - dst);
+}
+
+
+//reads the part of a length past the token, -1 if the input ends first
+static int get_length(const uint8_t** in, const uint8_t* end, size_t* len){
+	uint8_t byte;
+	do {
+		if(*in == end){
+			return -1;
+		}
+		byte = *(*in)++;
+		*len += byte;
+	} while (byte == 255);
+	return 0;
+}
+
+
+int lz_decompress(const uint8_t* src, size_t len, uint8_t* dst, size_t cap){
+	const uint8_t* in = src;
+	const uint8_t* in_end = src + len;
+	uint8_t* out = dst;
+	while (in < in_end) {
+		uint8_t token = *in++;
+		size_t literal_len = token >> 4;
+		if(literal_len == 15 && get_length(&in, in_end, &literal_len) != 0){
+			return -1;
+		}
+		if(literal_len > (size_t)(in_end - in) || literal_len > cap - (size_t)(out - dst)){
+			return -1;
+		}
+		memcpy(out, in, literal_len);
+		in += literal_len;
+		out += literal_len;
+		if(in == in_end){
+			break;
+		}
+
+		if(in_end - in < 2){
+			return -1;
+		}
+		size_t offset = in[0] | in[1] << 8;
+		in += 2;
+		size_t match_len = token & 15;
+		if(match_len == 15 && get_length(&in, in_end, &match_len) != 0){
+			return -1;
+		}
+		match_len += LZ_MIN_MATCH;
+		if(offset == 0 || offset > (size_t)(out - dst) || match_len > cap - (size_t)(out - dst)){
+			return -1;
+		}
+		//byte by byte: the match may overlap what it produces
+		const uint8_t* from = out - offset;
+		for (size_t k=0; k<match_len; k++) {
+			out[k] = from[k];
+		}
+		out += match_len;
+	}
+	return out - dst;
+}
@@ -5,396 +5,1641 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-int fs_mkdir(file_system* fs, char* path) {
+// Vergleicht zwei INode-Nummern für qsort
+static int compare_elements(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * Legt unter path einen neuen Knoten vom Typ type an.
+ * Rückgabe: INode-Nummer, -1 bei ungültigem Pfad oder vollem Verzeichnis,
+ * -2 wenn der Name im Verzeichnis schon existiert
+ */
+static int create_node(file_system *fs, char *path, enum node_type type) {
     // Überprüfen, ob das Dateisystem gültig ist
     if (fs == NULL) {
         return -1;
     }
     
-    // Überprüfen, ob der Pfad gültig ist
-    if (path == NULL || strlen(path) == 0 || path[0] != '/') {
+    // Den übergeordneten Ordner und den Namen des neuen Knotens bestimmen
+    char name[NAME_MAX_LENGTH];
+    int parent_inode_index = find_parent_by_path(fs, path, name);
+    if (parent_inode_index == -1) {
         return -1;
     }
     
-    // Analyse des Pfads, um den übergeordneten Ordner und den Namen des neuen Ordners zu extrahieren
-    char parent_path[NAME_MAX_LENGTH];
-    char dir_name[NAME_MAX_LENGTH];
-    int path_length = strlen(path);
-    int last_slash_index = -1;
+    inode *parent_inode = &(fs->inodes[parent_inode_index]);
+    if (find_inode_by_name(fs, parent_inode, name) != -1) {
+        return -2;
+    }
     
-    for (int i = path_length - 1; i >= 0; i--) {
-        if (path[i] == '/') {
-            last_slash_index = i;
+    // Einen freien Eintrag im übergeordneten Ordner suchen
+    int free_entry = -1;
+    for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
+        if (parent_inode->direct_blocks[i] == -1) {
+            free_entry = i;
             break;
         }
     }
     
-    if (last_slash_index == -1) {
+    if (free_entry == -1) {
         return -1;
     }
     
-    strncpy(parent_path, path, last_slash_index);
-    parent_path[last_slash_index] = '\0';
-    strncpy(dir_name, path + last_slash_index + 1, NAME_MAX_LENGTH);
-    
-    // Finden einer freien INode
-    int free_inode_index = find_free_inode(fs);
+    // Finden einer freien INode, möglichst nahe beim übergeordneten Ordner
+    int free_inode_index = find_free_inode(fs, parent_inode_index);
     
     if (free_inode_index == -1) {
         return -1;
     }
     
-    // Überprüfen, ob genügend INodes vorhanden sind
-    if (free_inode_index >= fs->s_block->num_blocks) {
-        return -1;
-    }
+    // Den neuen Knoten im Dateisystem erstellen
+    inode *new_inode = &(fs->inodes[free_inode_index]);
+    inode_init(new_inode);
+    new_inode->n_type = type;
+    memcpy(new_inode->name, name, NAME_MAX_LENGTH);
+    new_inode->parent = parent_inode_index;
     
-    // Den neuen Ordner im Dateisystem erstellen
-    inode* new_dir_inode = &(fs->inodes[free_inode_index]);
-    new_dir_inode->n_type = directory;
-    strncpy(new_dir_inode->name, dir_name, NAME_MAX_LENGTH);
-    new_dir_inode->parent = fs->root_node;  // Derzeit wird der neue Ordner als direktes Kind des Wurzelverzeichnisses eingefügt
+    // Den neuen Knoten in den übergeordneten Ordner einfügen
+    parent_inode->direct_blocks[free_entry] = free_inode_index;
     
-    // Den neuen Ordner in den übergeordneten Ordner einfügen
-    inode* parent_inode = &(fs->inodes[fs->root_node]);
-    for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-        if (parent_inode->direct_blocks[i] == -1) {
-            parent_inode->direct_blocks[i] = free_inode_index;
-            break;
-        }
+    mark_inode_dirty(fs, free_inode_index);
+    mark_inode_dirty(fs, parent_inode_index);
+    return free_inode_index;
+}
+
+
+int fs_mkdir(file_system* fs, char* path) {
+    if (create_node(fs, path, directory) < 0) {
+        return -1;
     }
     
-    // Den freien Block aktualisieren
-    fs->free_list[free_inode_index] = 0;
-    fs->s_block->free_blocks--;
-    
     // Das Dateisystem speichern
-    fs_dump(fs, "filesystem.fs");
+    fs_persist(fs);
     
     return 0;
 }
 
 
+int fs_mkfile(file_system* fs, char* path_and_name) {
+    int ret = create_node(fs, path_and_name, reg_file);
+    if (ret < 0) {
+        return ret;
+    }
+    
+    // Das Dateisystem speichern
+    fs_persist(fs);
+    
+    return 0;
+}
 
 
 
 
-
-
-
-int fs_mkfile(file_system* fs, char* path_and_name) {
+/*
+ * Schreibt die Auflistung von path nach buffer, wenn sie samt Abschlusszeichen
+ * in size Bytes passt.
+ * Rückgabe: Länge der Auflistung ohne Abschlusszeichen oder -1 wenn path
+ * kein Verzeichnis ist
+ */
+static int format_listing(file_system *fs, char *path, char *buffer, size_t size) {
     // Überprüfen, ob das Dateisystem gültig ist
     if (fs == NULL) {
         return -1;
     }
     
     // Überprüfen, ob der Pfad gültig ist
-    if (path_and_name == NULL || strlen(path_and_name) == 0 || path_and_name[0] != '/') {
+    if (path == NULL || strlen(path) == 0 || path[0] != '/') {
         return -1;
     }
     
-    // Analyse des Pfads, um den übergeordneten Ordner und den Namen der neuen Datei zu extrahieren
-    char parent_path[NAME_MAX_LENGTH];
-    char file_name[NAME_MAX_LENGTH];
-    int path_length = strlen(path_and_name);
-    int last_slash_index = -1;
-    
-    for (int i = path_length - 1; i >= 0; i--) {
-        if (path_and_name[i] == '/') {
-            last_slash_index = i;
-            break;
-        }
-    }
-    
-    if (last_slash_index == -1) {
+    // Das aufzulistende Verzeichnis finden
+    int dir_inode_index = find_inode_by_path(fs, path);
+    if (dir_inode_index == -1) {
         return -1;
     }
     
-    strncpy(parent_path, path_and_name, last_slash_index);
-    parent_path[last_slash_index] = '\0';
-    strncpy(file_name, path_and_name + last_slash_index + 1, NAME_MAX_LENGTH);
+    inode *parent_inode = &(fs->inodes[dir_inode_index]);
     
-    // Finden einer freien INode
-    int free_inode_index = find_free_inode(fs);
-    
-    if (free_inode_index == -1) {
-        return -1;
-    }
-    
-    // Überprüfen, ob genügend INodes vorhanden sind
-    if (free_inode_index >= fs->s_block->num_blocks) {
+    // Überprüfen, ob der Pfad auf ein Verzeichnis zeigt
+    if (parent_inode->n_type != directory) {
         return -1;
     }
     
-    // Die neue Datei im Dateisystem erstellen
-    inode* new_file_inode = &(fs->inodes[free_inode_index]);
-    new_file_inode->n_type = reg_file;
-    strncpy(new_file_inode->name, file_name, NAME_MAX_LENGTH);
-    new_file_inode->parent = fs->root_node;
+    // Die Dateien und Verzeichnisse im übergeordneten Ordner sammeln und nach INode-Nummer sortieren
+    int children[DIRECT_BLOCKS_COUNT];
+    int num_elements = 0;
     
-    // Die neue Datei in den übergeordneten Ordner einfügen
-    inode* parent_inode = &(fs->inodes[fs->root_node]);
     for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-        if (parent_inode->direct_blocks[i] == -1) {
-            parent_inode->direct_blocks[i] = free_inode_index;
-            break;
+        if (parent_inode->direct_blocks[i] != -1) {
+            children[num_elements++] = parent_inode->direct_blocks[i];
         }
     }
     
-    // Den freien Block aktualisieren
-    fs->free_list[free_inode_index] = 0;
-    fs->s_block->free_blocks--;
+    // Die Elemente nach INode-Nummer sortieren
+    qsort(children, num_elements, sizeof(int), compare_elements);
     
-    // Das Dateisystem speichern
-    fs_dump(fs, "filesystem.fs");
+    // Länge der Auflistung bestimmen: "DIR " bzw. "FIL ", Name und Zeilenumbruch
+    size_t length = 0;
+    for (int i = 0; i < num_elements; i++) {
+        length += 5 + strnlen(fs->inodes[children[i]].name, NAME_MAX_LENGTH);
+    }
+    if (length + 1 > size) {
+        return length;
+    }
     
-    return 0;
+    // Die Zeilen direkt in den Puffer schreiben
+    char *position = buffer;
+    for (int i = 0; i < num_elements; i++) {
+        inode *element_inode = &(fs->inodes[children[i]]);
+        position += sprintf(position, "%s %.*s\n", element_inode->n_type == directory ? "DIR" : "FIL",
+                            NAME_MAX_LENGTH, element_inode->name);
+    }
+    *position = '\0';
+    
+    return length;
 }
 
 
-
-
 char *fs_list(file_system *fs, char *path) {
-    // Überprüfen, ob das Dateisystem gültig ist
-    if (fs == NULL) {
+    int length = format_listing(fs, path, NULL, 0);
+    if (length == -1) {
         return NULL;
     }
     
-    // Überprüfen, ob der Pfad gültig ist
-    if (path == NULL || strlen(path) == 0 || path[0] != '/') {
+    char *result = malloc(length + 1);  // +1 für das Abschlusszeichen
+    if (result == NULL) {
         return NULL;
     }
+    format_listing(fs, path, result, length + 1);
+    return result;
+}
+
+
+int fs_list_into(file_system *fs, char *path, char *buffer, size_t size) {
+    return format_listing(fs, path, buffer, size);
+}
+
+
+
+/*
+ * Sucht die reguläre Datei unter path
+ * Rückgabe: INode-Nummer oder -1
+ */
+static int find_file(file_system *fs, char *path) {
+    if (fs == NULL || path == NULL || strlen(path) == 0) {
+        return -1;
+    }
     
-    // Den übergeordneten Ordner finden
-    inode *parent_inode = NULL;
-    if (strcmp(path, "/") == 0) {
-        parent_inode = &(fs->inodes[fs->root_node]);
-    } else {
-        // Analyse des Pfads, um den übergeordneten Ordner zu finden
-        char parent_path[NAME_MAX_LENGTH];
-        char dir_name[NAME_MAX_LENGTH];
-        int path_length = strlen(path);
-        int last_slash_index = -1;
-        
-        for (int i = path_length - 1; i >= 0; i--) {
-            if (path[i] == '/') {
-                last_slash_index = i;
-                break;
-            }
-        }
-        
-        if (last_slash_index == -1) {
-            return NULL;
-        }
-        
-        strncpy(parent_path, path, last_slash_index);
-        parent_path[last_slash_index] = '\0';
-        strncpy(dir_name, path + last_slash_index + 1, NAME_MAX_LENGTH);
-        
-        // Den übergeordneten Ordner finden
-        int parent_inode_index = find_inode_by_path(fs, parent_path);
-        if (parent_inode_index == -1) {
-            return NULL;
-        }
-        
-        parent_inode = &(fs->inodes[parent_inode_index]);
-        
-        // Überprüfen, ob der übergeordnete Ordner ein Verzeichnis ist
-        if (parent_inode->n_type != directory) {
-            return NULL;
-        }
+    int file_inode_index = find_inode_by_path(fs, path);
+    if (file_inode_index == -1 || fs->inodes[file_inode_index].n_type != reg_file) {
+        return -1;
     }
     
-    // Die Dateien und Verzeichnisse im übergeordneten Ordner sammeln und nach INode-Nummer sortieren
-    int num_elements = 0;
-    int elements_capacity = 10;
-    char **elements = malloc(elements_capacity * sizeof(char *));
+    return file_inode_index;
+}
+
+
+/*
+ * Schreibt len Bytes ab offset in die Datei und speichert das Dateisystem.
+ * Bei aktivem Schreibpuffer landen Anhänge zuerst im Puffer der Datei
+ * Rückgabe: Anzahl geschriebener Bytes, -2 wenn sie nicht in die Datei passen
+ */
+static int write_at(file_system *fs, int file_inode_index, const uint8_t *buf, size_t len, size_t offset) {
+    if (fs->write_buffering && fs->txn == NULL && offset == fs->inodes[file_inode_index].size) {
+        return wbuf_append(fs, file_inode_index, buf, len);
+    }
     
-    for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
-        int inode_index = parent_inode->direct_blocks[i];
-        if (inode_index != -1) {
-            inode *element_inode = &(fs->inodes[inode_index]);
-            char *element_name = element_inode->name;
-            
-            char *formatted_element = malloc(NAME_MAX_LENGTH + 5);
-            if (element_inode->n_type == directory) {
-                snprintf(formatted_element, NAME_MAX_LENGTH + 5, "DIR %s", element_name);
-            } else {
-                snprintf(formatted_element, NAME_MAX_LENGTH + 5, "FIL %s", element_name);
-            }
-            
-            elements[num_elements] = formatted_element;
-            num_elements++;
-            
-            // Überprüfen, ob die Kapazität der Elemente-Liste erreicht ist und sie bei Bedarf erweitern
-            if (num_elements >= elements_capacity) {
-                elements_capacity *= 2;
-                elements = realloc(elements, elements_capacity * sizeof(char *));
-            }
-        }
+    // Auch ein fehlgeschlagener Versuch kann Blöcke belegt haben
+    int written = inode_pwrite(fs, file_inode_index, buf, len, offset);
+    fs_persist(fs);
+    return written;
+}
+
+
+int fs_writef(file_system *fs, char *filename, char *text) {
+    // Überprüfen, ob der Text gültig ist
+    if (text == NULL) {
+        return -1;
     }
     
-    // Die Elemente nach INode-Nummer sortieren
-    qsort(elements, num_elements, sizeof(char *), compare_elements);
+    // Die Datei finden
+    int file_inode_index = find_file(fs, filename);
+    if (file_inode_index == -1) {
+        return -1;
+    }
     
-    // Die Namen der Elemente in einen String zusammenführen
-    int string_length = 0;
-    for (int i = 0; i < num_elements; i++) {
-        string_length += strlen(elements[i]) + 1;  // +1 für das Zeilenumbruchzeichen
+    // Der Text wird ganz oder gar nicht angehängt
+    size_t text_length = strlen(text);
+    inode *file_inode = &(fs->inodes[file_inode_index]);
+    if (text_length > MAX_FILE_SIZE - file_inode->size) {
+        return -2;
     }
     
-    char *result = malloc(string_length + 1);  // +1 für das Abschlusszeichen
-    result[0] = '\0';
+    // Den Text an das Ende der Datei schreiben
+    return write_at(fs, file_inode_index, (uint8_t *)text, text_length, file_inode->size);
+}
+
+
+uint8_t *fs_readf(file_system *fs, char *filename, int *file_size) {
+    *file_size = 0;
     
-    for (int i = 0; i < num_elements; i++) {
-        strcat(result, elements[i]);
-        strcat(result, "\n");
+    // Die Datei finden
+    int file_inode_index = find_file(fs, filename);
+    if (file_inode_index == -1 || fs->inodes[file_inode_index].size == 0) {
+        return NULL;
     }
     
-    // Die Elemente-Liste und den übergeordneten Ordner freigeben
-    free(elements);
+    // +1 für ein Abschlusszeichen, damit der Inhalt auch als String lesbar ist
+    int size = fs->inodes[file_inode_index].size;
+    uint8_t *buffer = malloc(size + 1);
+    if (buffer == NULL) {
+        return NULL;
+    }
     
-    return result;
+    int read = inode_pread(fs, file_inode_index, buffer, size, 0);
+    if (read < 0) {
+        free(buffer);
+        return NULL;
+    }
+    *file_size = read;
+    buffer[read] = '\0';
+    return buffer;
+}
+
+
+int fs_readf_into(file_system *fs, char *filename, uint8_t *buffer, size_t size) {
+    int file_inode_index = find_file(fs, filename);
+    if (file_inode_index == -1) {
+        return -1;
+    }
+    
+    // Passt die Datei nicht in den Puffer, nur die benötigte Größe melden
+    size_t file_size = fs->inodes[file_inode_index].size;
+    if (file_size > size) {
+        return file_size;
+    }
+    return inode_pread(fs, file_inode_index, buffer, file_size, 0);
 }
 
 
+int fs_readv(file_system *fs, char *filename, struct iovec *iov) {
+    int file_inode_index = find_file(fs, filename);
+    if (file_inode_index == -1) {
+        return -1;
+    }
+    
+    return inode_spans(fs, file_inode_index, iov);
+}
 
-int fs_writef(file_system *fs, char *filename, char *text) {
-    // Überprüfen, ob das Dateisystem gültig ist
-    if (fs == NULL) {
+
+int fs_pwrite(file_system *fs, char *filename, const uint8_t *buf, size_t len, size_t offset) {
+    if (buf == NULL && len > 0) {
         return -1;
     }
     
-    // Überprüfen, ob der Dateiname und der Text gültig sind
-    if (filename == NULL || strlen(filename) == 0) {
+    // Die Datei finden
+    int file_inode_index = find_file(fs, filename);
+    if (file_inode_index == -1) {
         return -1;
     }
     
-    if (text == NULL) {
+    // Nur die betroffenen Blöcke werden geschrieben und gespeichert
+    return write_at(fs, file_inode_index, buf, len, offset);
+}
+
+
+int fs_pread(file_system *fs, char *filename, uint8_t *buf, size_t len, size_t offset) {
+    if (buf == NULL && len > 0) {
         return -1;
     }
     
-    // Den übergeordneten Ordner finden
-    char parent_path[NAME_MAX_LENGTH];
-    char file_name[NAME_MAX_LENGTH];
-    int last_slash_index = -1;
+    // Die Datei finden
+    int file_inode_index = find_file(fs, filename);
+    if (file_inode_index == -1) {
+        return -1;
+    }
     
-    int path_length = strlen(filename);
-    for (int i = path_length - 1; i >= 0; i--) {
-        if (filename[i] == '/') {
-            last_slash_index = i;
-            break;
-        }
+    return inode_pread(fs, file_inode_index, buf, len, offset);
+}
+
+
+
+
+fs_handle *fs_open(file_system *fs, char *filename, int flags) {
+    // Der Pfad wird nur hier aufgelöst
+    int file_inode_index = find_file(fs, filename);
+    if (file_inode_index == -1) {
+        return NULL;
     }
     
-    if (last_slash_index == -1) {
-        strncpy(file_name, filename, NAME_MAX_LENGTH);
-        strncpy(parent_path, "/", NAME_MAX_LENGTH);
-    } else {
-        strncpy(file_name, filename + last_slash_index + 1, NAME_MAX_LENGTH);
-        strncpy(parent_path, filename, last_slash_index);
-        parent_path[last_slash_index] = '\0';
+    fs_handle *handle = malloc(sizeof(fs_handle));
+    if (handle == NULL) {
+        return NULL;
     }
+    handle->inode = file_inode_index;
+    handle->offset = 0;
+    handle->flags = flags;
     
-    // Den übergeordneten Ordner finden
-    int parent_inode_index = find_inode_by_path(fs, parent_path);
-    if (parent_inode_index == -1) {
-        printf("Parent directory not found\n");
+    // Das Dateisystem kennt alle offenen Handles, damit fs_rm sie ungültig machen kann
+    handle->next = fs->handles;
+    fs->handles = handle;
+    return handle;
+}
+
+
+int fs_read(file_system *fs, fs_handle *handle, uint8_t *buf, size_t len) {
+    if (fs == NULL || handle == NULL || handle->inode == -1) {
         return -1;
     }
     
-    inode *parent_inode = &(fs->inodes[parent_inode_index]);
+    int read = inode_pread(fs, handle->inode, buf, len, handle->offset);
+    if (read > 0) {
+        handle->offset += read;
+    }
+    return read;
+}
+
+
+int fs_write(file_system *fs, fs_handle *handle, const uint8_t *buf, size_t len) {
+    if (fs == NULL || handle == NULL || handle->inode == -1) {
+        return -1;
+    }
     
-    // Überprüfen, ob der übergeordnete Ordner ein Verzeichnis ist
-    if (parent_inode->n_type != directory) {
+    if (handle->flags & FS_O_APPEND) {
+        handle->offset = fs->inodes[handle->inode].size;
+    }
+    
+    int written = write_at(fs, handle->inode, buf, len, handle->offset);
+    if (written > 0) {
+        handle->offset += written;
+    }
+    return written;
+}
+
+
+long fs_seek(file_system *fs, fs_handle *handle, long offset, int whence) {
+    if (fs == NULL || handle == NULL || handle->inode == -1) {
         return -1;
     }
     
-    // Die Datei in den übergeordneten Ordner finden
-    int file_inode_index = find_inode_by_name(fs, parent_inode, file_name);
-    if (file_inode_index == -1) {
+    long base;
+    switch (whence) {
+        case SEEK_SET:
+            base = 0;
+            break;
+        case SEEK_CUR:
+            base = handle->offset;
+            break;
+        case SEEK_END:
+            base = fs->inodes[handle->inode].size;
+            break;
+        default:
+            return -1;
+    }
+    
+    if (base + offset < 0 || base + offset > MAX_FILE_SIZE) {
+        return -1;
+    }
+    handle->offset = base + offset;
+    return handle->offset;
+}
+
+
+int fs_close(file_system *fs, fs_handle *handle) {
+    if (fs == NULL || handle == NULL) {
         return -1;
     }
     
-    inode *file_inode = &(fs->inodes[file_inode_index]);
+    // Das Handle aus der Liste des Dateisystems entfernen
+    for (fs_handle **h = &fs->handles; *h != NULL; h = &(*h)->next) {
+        if (*h == handle) {
+            *h = handle->next;
+            free(handle);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+
+
+int fs_rm(file_system *fs, char *path) {
+    if (fs == NULL || path == NULL) {
+        return -1;
+    }
     
-    // Überprüfen, ob die INode eine reguläre Datei ist
-    if (file_inode->n_type != reg_file) {
+    // Das Wurzelverzeichnis kann nicht gelöscht werden
+    int target = find_inode_by_path(fs, path);
+    if (target == -1 || target == fs->root_node) {
         return -1;
     }
     
-    // Den Text in die Datei schreiben
-    int text_length = strlen(text);
-    int remaining_length = text_length;
-    int block_index = 0;
+    // Den Teilbaum einmal durchlaufen und alle INodes einsammeln. Die Liste
+    // dient gleichzeitig als Arbeitsstapel: was hinter i steht, ist noch zu besuchen
+    int *subtree = malloc(fs->s_block->num_blocks * sizeof(int));
+    if (subtree == NULL) {
+        return -1;
+    }
+    int count = 0;
+    subtree[count++] = target;
+    for (int i = 0; i < count; i++) {
+        inode *node = &(fs->inodes[subtree[i]]);
+        if (node->n_type != directory) {
+            continue;
+        }
+        for (int j = 0; j < DIRECT_BLOCKS_COUNT; j++) {
+            int child = node->direct_blocks[j];
+            if (child != -1 && count < (int)fs->s_block->num_blocks) {
+                subtree[count++] = child;
+            }
+        }
+    }
     
-    while (remaining_length > 0) {
-        int data_block_index = file_inode->direct_blocks[block_index];
-        
-        if (data_block_index == -1) {
-            // Finden eines freien Datenblocks
-            data_block_index = find_free_block(fs);
-            
-            if (data_block_index == -1) {
-                return -1;
+    // Den Eintrag im übergeordneten Ordner entfernen. Der Ordner steht in der
+    // INode, der Pfad kann anders geschrieben sein (z.B. mit "/" am Ende)
+    int parent_inode_index = fs->inodes[target].parent;
+    if (parent_inode_index >= 0 && parent_inode_index < (int)fs->s_block->num_blocks) {
+        inode *parent_inode = &(fs->inodes[parent_inode_index]);
+        for (int j = 0; j < DIRECT_BLOCKS_COUNT; j++) {
+            if (parent_inode->direct_blocks[j] == target) {
+                parent_inode->direct_blocks[j] = -1;
             }
-            
-            // Den Datenblock in den direkten Blocks der INode speichern
-            file_inode->direct_blocks[block_index] = data_block_index;
-            
-            // Den freien Block in der Freiliste markieren
-            fs->free_list[data_block_index] = 0;
-            fs->s_block->free_blocks--;
         }
-        
-        // Den Text in den Datenblock schreiben
-        int write_length = remaining_length > BLOCK_SIZE ? BLOCK_SIZE : remaining_length;
-        strncpy(fs->data_blocks[data_block_index].block, text + (text_length - remaining_length), write_length);
-        remaining_length -= write_length;
-        
-        // Die Größe der Datei aktualisieren
-        file_inode->size += write_length;
-        
-        block_index++;
+        mark_inode_dirty(fs, parent_inode_index);
     }
     
-    // Das Dateisystem speichern
-    fs_dump(fs, "filesystem.fs");
+    // Blöcke und INodes des ganzen Teilbaums in einem Durchgang freigeben
+    for (int i = 0; i < count; i++) {
+        if (fs->inodes[subtree[i]].n_type == reg_file) {
+            inode_truncate(fs, subtree[i]);
+            close_handles(fs, subtree[i]);
+        }
+        inode_init(&(fs->inodes[subtree[i]]));
+        mark_inode_dirty(fs, subtree[i]);
+    }
+    free(subtree);
     
+    // Das Dateisystem einmal speichern
+    fs_persist(fs);
     return 0;
 }
 
 
-uint8_t *
-fs_readf(file_system *fs, char *filename, int *file_size)
-{
-	return NULL;	
-}
 
 
+/*
+ * Bereitet den Import von size Bytes nach int_path vor: eine vorhandene Datei
+ * wird geleert, sonst angelegt, und die benötigten Blöcke werden belegt.
+ * spans zeigt danach direkt auf die Blöcke, in die gelesen werden soll.
+ * Rückgabe: INode-Nummer, -1 wenn der Pfad ungültig ist, -2 wenn die Datei
+ * zu groß ist oder nicht genug Blöcke frei sind
+ */
+static int prepare_import(file_system *fs, char *int_path, off_t size, struct iovec *spans, int *needed) {
+    if (size > MAX_FILE_SIZE) {
+        return -2;
+    }
+    *needed = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    
+    // Eine vorhandene Datei wird überschrieben, sonst wird sie angelegt
+    int file_inode_index = find_inode_by_path(fs, int_path);
+    int own_blocks = 0;
+    if (file_inode_index != -1) {
+        if (fs->inodes[file_inode_index].n_type != reg_file) {
+            return -1;
+        }
+        for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
+            own_blocks += fs->inodes[file_inode_index].direct_blocks[i] != -1;
+        }
+    }
+    if (*needed > (int)fs->s_block->free_blocks + own_blocks) {
+        return -2;
+    }
+    if (file_inode_index == -1) {
+        file_inode_index = create_node(fs, int_path, reg_file);
+        if (file_inode_index < 0) {
+            return -1;
+        }
+    }
+    
+    // Die Blöcke vorab belegen
+    inode_truncate(fs, file_inode_index);
+    inode *file_inode = &(fs->inodes[file_inode_index]);
+    for (int i = 0; i < *needed; i++) {
+        int block = block_for_write(fs, file_inode, i);
+        if (block == -1) {
+            inode_truncate(fs, file_inode_index);
+            return -2;
+        }
+        spans[i].iov_base = fs->data_blocks[block].block;
+        spans[i].iov_len = BLOCK_SIZE;
+    }
+    // Die Datei kann seit stat gewachsen sein, es wird nur bis size gelesen
+    if (*needed > 0) {
+        spans[*needed - 1].iov_len = size - (off_t)(*needed - 1) * BLOCK_SIZE;
+    }
+    return file_inode_index;
+}
 
 
-int
-fs_rm(file_system *fs, char *path)
-{
-	return -1;
+/*
+ * Schließt einen Import ab, nachdem received Bytes in die Blöcke gelesen wurden
+ */
+static void finish_import(file_system *fs, int file_inode_index, int needed, ssize_t received) {
+    if (received < 0) {
+        inode_truncate(fs, file_inode_index);
+        return;
+    }
+    
+    // Blockgrößen setzen und Blöcke freigeben, falls die Datei inzwischen kürzer ist
+    inode *file_inode = &(fs->inodes[file_inode_index]);
+    for (int i = 0; i < needed; i++) {
+        int block = file_inode->direct_blocks[i];
+        size_t start = (size_t)i * BLOCK_SIZE;
+        if (start >= (size_t)received) {
+            block_release(fs, block);
+            file_inode->direct_blocks[i] = -1;
+        } else {
+            fs->data_blocks[block].size = received - start < BLOCK_SIZE ? received - start : BLOCK_SIZE;
+            dedup_block(fs, file_inode_index, i);
+        }
+    }
+    file_inode->size = received;
+    
+    // Gelesen wird unkomprimiert, komprimiert wird danach im Ganzen
+    if (fs->features & FS_FEATURE_COMPRESSION) {
+        compress_inode(fs, file_inode_index);
+    }
 }
 
 
+int fs_import(file_system *fs, char *int_path, char *ext_path) {
+    if (fs == NULL || int_path == NULL || ext_path == NULL) {
+        return -1;
+    }
+    
+    // Die externe Datei öffnen, ihre Größe bestimmt die benötigten Blöcke
+    int fd = open(ext_path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+    
+    // Die externe Datei direkt in die belegten Blöcke lesen, ohne
+    // Zwischenpuffer für die ganze Datei
+    struct iovec spans[DIRECT_BLOCKS_COUNT];
+    int needed;
+    int file_inode_index = prepare_import(fs, int_path, st.st_size, spans, &needed);
+    if (file_inode_index < 0) {
+        close(fd);
+        fs_persist(fs);
+        return file_inode_index;
+    }
+    ssize_t received = read_spans(fd, spans, needed);
+    close(fd);
+    finish_import(fs, file_inode_index, needed, received);
+    
+    fs_persist(fs);
+    return received < 0 ? -1 : 0;
+}
+
 
+/*
+ * Eine Datei des Verzeichnisbaums, deren Blöcke schon belegt sind
+ */
+typedef struct _import_job {
+    char *ext_path;
+    int inode;
+    int needed;
+    struct iovec spans[DIRECT_BLOCKS_COUNT];
+    ssize_t received;
+} import_job;
 
-int
-fs_import(file_system *fs, char *int_path, char *ext_path)
-{
-	return -1;
-}
+typedef struct _import_queue {
+    import_job *jobs;
+    int count;
+    int capacity;
+    atomic_int next;  // nächster Auftrag, den ein Thread übernimmt
+    int failed;
+} import_queue;
 
 
+/*
+ * Hängt name an path an, ohne einen doppelten Schrägstrich zu erzeugen
+ */
+static char *join_path(const char *path, const char *name) {
+    size_t length = strlen(path);
+    int slash = length == 0 || path[length - 1] != '/';
+    char *joined = malloc(length + slash + strlen(name) + 1);
+    if (joined != NULL) {
+        sprintf(joined, "%s%s%s", path, slash ? "/" : "", name);
+    }
+    return joined;
+}
 
 
-int
-fs_export(file_system *fs, char *int_path, char *ext_path)
-{
-	return -1;
-}
\ No newline at end of file
+/*
+ * Durchläuft ext_dir rekursiv, legt Verzeichnisse und Dateien unter int_dir
+ * an und belegt die Blöcke der Dateien. Gelesen wird erst danach.
+ */
+static void walk_import(file_system *fs, char *int_dir, char *ext_dir, import_queue *queue) {
+    DIR *dir = opendir(ext_dir);
+    if (dir == NULL) {
+        queue->failed++;
+        return;
+    }
+    
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        char *ext_path = join_path(ext_dir, entry->d_name);
+        char *int_path = join_path(int_dir, entry->d_name);
+        struct stat st;
+        if (ext_path == NULL || int_path == NULL || lstat(ext_path, &st) != 0) {
+            queue->failed++;
+        } else if (S_ISDIR(st.st_mode)) {
+            // Vorhandene Verzeichnisse werden wiederverwendet
+            int dir_inode_index = find_inode_by_path(fs, int_path);
+            if (dir_inode_index == -1) {
+                dir_inode_index = create_node(fs, int_path, directory);
+            }
+            if (dir_inode_index < 0 || fs->inodes[dir_inode_index].n_type != directory) {
+                queue->failed++;
+            } else {
+                walk_import(fs, int_path, ext_path, queue);
+            }
+        } else if (S_ISREG(st.st_mode)) {
+            if (queue->count == queue->capacity) {
+                int capacity = queue->capacity == 0 ? 64 : queue->capacity * 2;
+                import_job *jobs = realloc(queue->jobs, capacity * sizeof(import_job));
+                if (jobs == NULL) {
+                    queue->failed++;
+                    free(ext_path);
+                    free(int_path);
+                    continue;
+                }
+                queue->jobs = jobs;
+                queue->capacity = capacity;
+            }
+            import_job *job = &queue->jobs[queue->count];
+            job->inode = prepare_import(fs, int_path, st.st_size, job->spans, &job->needed);
+            if (job->inode < 0) {
+                queue->failed++;
+            } else {
+                job->ext_path = ext_path;
+                ext_path = NULL;
+                queue->count++;
+            }
+        }
+        free(ext_path);
+        free(int_path);
+    }
+    closedir(dir);
+}
+
+
+/*
+ * Thread: liest Dateien der Warteschlange in ihre Blöcke. Die Blöcke der
+ * Aufträge sind disjunkt, das Dateisystem selbst wird nicht verändert.
+ */
+static void *import_worker(void *arg) {
+    import_queue *queue = arg;
+    int i;
+    while ((i = atomic_fetch_add(&queue->next, 1)) < queue->count) {
+        import_job *job = &queue->jobs[i];
+        int fd = open(job->ext_path, O_RDONLY);
+        job->received = fd == -1 ? -1 : read_spans(fd, job->spans, job->needed);
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+    return NULL;
+}
+
+
+int fs_import_tree(file_system *fs, char *int_dir, char *ext_dir, int nthreads) {
+    if (fs == NULL || int_dir == NULL || ext_dir == NULL) {
+        return -1;
+    }
+    int dir_inode_index = find_inode_by_path(fs, int_dir);
+    struct stat st;
+    if (dir_inode_index == -1 || fs->inodes[dir_inode_index].n_type != directory
+        || stat(ext_dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return -1;
+    }
+    
+    fs_batch_begin(fs);
+    
+    // Verzeichnisse, INodes und Blöcke werden nacheinander angelegt
+    import_queue queue = { .jobs = NULL, .count = 0, .capacity = 0, .failed = 0 };
+    atomic_init(&queue.next, 0);
+    walk_import(fs, int_dir, ext_dir, &queue);
+    
+    // Das Lesen der Dateien übernehmen mehrere Threads
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    if (nthreads > queue.count) {
+        nthreads = queue.count;
+    }
+    pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+    int started = 0;
+    while (threads != NULL && started < nthreads
+           && pthread_create(&threads[started], NULL, import_worker, &queue) == 0) {
+        started++;
+    }
+    // Ohne Threads liest der aufrufende Thread selbst
+    if (started == 0) {
+        import_worker(&queue);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    
+    for (int i = 0; i < queue.count; i++) {
+        import_job *job = &queue.jobs[i];
+        finish_import(fs, job->inode, job->needed, job->received);
+        if (job->received < 0) {
+            queue.failed++;
+        }
+        free(job->ext_path);
+    }
+    free(queue.jobs);
+    
+    // Das Dateisystem wird einmal am Ende gespeichert
+    fs->dirty = 1;
+    if (fs_batch_commit(fs) != 0) {
+        return -1;
+    }
+    return queue.failed;
+}
+
+
+int fs_export(file_system *fs, char *int_path, char *ext_path) {
+    if (fs == NULL || ext_path == NULL) {
+        return -1;
+    }
+    
+    int file_inode_index = find_file(fs, int_path);
+    if (file_inode_index == -1) {
+        return -1;
+    }
+    
+    // Die Blöcke werden ohne Kopie gesammelt und mit einem writev geschrieben.
+    // Beschädigte Blöcke werden erkannt, bevor die externe Datei angelegt wird
+    struct iovec spans[FS_MAX_SPANS];
+    int count = inode_spans(fs, file_inode_index, spans);
+    if (count < 0) {
+        return count;
+    }
+    int fd = open(ext_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+    int status = write_spans(fd, spans, count);
+    if (close(fd) != 0) {
+        status = -1;
+    }
+    return status;
+}
+
+
+
+
+/*
+ * Eine Datei, die beim Export eines Verzeichnisbaums geschrieben wird
+ */
+typedef struct _export_job {
+    char *ext_path;
+    int inode;
+} export_job;
+
+typedef struct _export_queue {
+    file_system *fs;
+    export_job *jobs;
+    int count;
+    int capacity;
+    atomic_int next;    // nächster Auftrag, den ein Thread übernimmt
+    atomic_int failed;
+} export_queue;
+
+
+/*
+ * Durchläuft das interne Verzeichnis dir_inode_index über die Kind-Einträge,
+ * legt die Verzeichnisse auf dem Host an und sammelt die Dateien
+ */
+static void walk_export(file_system *fs, int dir_inode_index, char *ext_dir, export_queue *queue) {
+    if (mkdir(ext_dir, 0755) != 0 && errno != EEXIST) {
+        atomic_fetch_add(&queue->failed, 1);
+        return;
+    }
+    
+    inode *dir_inode = &(fs->inodes[dir_inode_index]);
+    for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
+        int child = dir_inode->direct_blocks[i];
+        if (child == -1) {
+            continue;
+        }
+        
+        // Namen sind nicht zwingend nullterminiert
+        char name[NAME_MAX_LENGTH + 1];
+        snprintf(name, sizeof(name), "%.*s", NAME_MAX_LENGTH, fs->inodes[child].name);
+        char *ext_path = join_path(ext_dir, name);
+        if (ext_path == NULL) {
+            atomic_fetch_add(&queue->failed, 1);
+            continue;
+        }
+        
+        if (fs->inodes[child].n_type == directory) {
+            walk_export(fs, child, ext_path, queue);
+        } else if (fs->inodes[child].n_type == reg_file) {
+            if (queue->count == queue->capacity) {
+                int capacity = queue->capacity == 0 ? 64 : queue->capacity * 2;
+                export_job *jobs = realloc(queue->jobs, capacity * sizeof(export_job));
+                if (jobs == NULL) {
+                    atomic_fetch_add(&queue->failed, 1);
+                    free(ext_path);
+                    continue;
+                }
+                queue->jobs = jobs;
+                queue->capacity = capacity;
+            }
+            queue->jobs[queue->count].ext_path = ext_path;
+            queue->jobs[queue->count].inode = child;
+            queue->count++;
+            continue;
+        }
+        free(ext_path);
+    }
+}
+
+
+/*
+ * Spans der Datei für einen Export-Thread. Komprimierte Dateien werden in
+ * content entpackt, da Spans in den gemeinsamen Cluster-Cache zeigen würden
+ */
+static int file_spans(file_system *fs, int file_inode_index, uint8_t *content, struct iovec *spans) {
+    if (!inode_compressed(fs, &(fs->inodes[file_inode_index]))) {
+        return inode_spans(fs, file_inode_index, spans);
+    }
+    int size = inode_pread(fs, file_inode_index, content, MAX_FILE_SIZE, 0);
+    if (size < 0) {
+        return size;
+    }
+    spans[0].iov_base = content;
+    spans[0].iov_len = size;
+    return 1;
+}
+
+
+/*
+ * Thread: schreibt Dateien der Warteschlange direkt aus ihren Blöcken. Das
+ * Dateisystem wird dabei nur gelesen.
+ */
+static void *export_worker(void *arg) {
+    export_queue *queue = arg;
+    int i;
+    while ((i = atomic_fetch_add(&queue->next, 1)) < queue->count) {
+        export_job *job = &queue->jobs[i];
+        struct iovec spans[FS_MAX_SPANS];
+        uint8_t content[MAX_FILE_SIZE];
+        int count = file_spans(queue->fs, job->inode, content, spans);
+        if (count < 0) {
+            atomic_fetch_add(&queue->failed, 1);
+            continue;
+        }
+        int fd = open(job->ext_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1 || write_spans(fd, spans, count) != 0) {
+            atomic_fetch_add(&queue->failed, 1);
+        }
+        if (fd != -1 && close(fd) != 0) {
+            atomic_fetch_add(&queue->failed, 1);
+        }
+    }
+    return NULL;
+}
+
+
+int fs_export_tree(file_system *fs, char *int_dir, char *ext_dir, int nthreads) {
+    if (fs == NULL || int_dir == NULL || ext_dir == NULL) {
+        return -1;
+    }
+    int dir_inode_index = find_inode_by_path(fs, int_dir);
+    if (dir_inode_index == -1 || fs->inodes[dir_inode_index].n_type != directory) {
+        return -1;
+    }
+    
+    // Die Threads lesen nur, gepufferte Anhänge werden vorher geschrieben
+    if (wbuf_flush_all(fs) != 0) {
+        return -1;
+    }
+    
+    // Die Verzeichnisse werden nacheinander angelegt
+    export_queue queue = { .fs = fs, .jobs = NULL, .count = 0, .capacity = 0 };
+    atomic_init(&queue.next, 0);
+    atomic_init(&queue.failed, 0);
+    walk_export(fs, dir_inode_index, ext_dir, &queue);
+    
+    // Das Schreiben der Dateien übernehmen mehrere Threads
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    if (nthreads > queue.count) {
+        nthreads = queue.count;
+    }
+    pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+    int started = 0;
+    while (threads != NULL && started < nthreads
+           && pthread_create(&threads[started], NULL, export_worker, &queue) == 0) {
+        started++;
+    }
+    // Ohne Threads schreibt der aufrufende Thread selbst
+    if (started == 0) {
+        export_worker(&queue);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    
+    for (int i = 0; i < queue.count; i++) {
+        free(queue.jobs[i].ext_path);
+    }
+    free(queue.jobs);
+    return atomic_load(&queue.failed);
+}
+
+
+/*
+ * Gleicht die interne Datei file_inode_index blockweise mit der Host-Datei
+ * ab. Nur abweichende Blöcke werden geschrieben.
+ * Rückgabe: 0 bei Erfolg, -1 wenn die Host-Datei nicht gelesen oder die
+ * interne nicht geschrieben werden konnte
+ */
+static int sync_file(file_system *fs, int file_inode_index, char *ext_path) {
+    int fd = open(ext_path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    
+    // Eine Datei passt immer in MAX_FILE_SIZE, ein Byte mehr erkennt zu große
+    uint8_t content[MAX_FILE_SIZE + 1];
+    struct iovec span = { .iov_base = content, .iov_len = sizeof(content) };
+    ssize_t size = read_spans(fd, &span, 1);
+    close(fd);
+    if (size < 0 || size > MAX_FILE_SIZE) {
+        return -1;
+    }
+    
+    // Blöcke vergleichen, wie die Datei aus Sicht von fs_pread aussieht
+    inode *file_inode = &(fs->inodes[file_inode_index]);
+    int compressed = inode_compressed(fs, file_inode);
+    uint8_t current[MAX_FILE_SIZE];
+    if (compressed && inode_pread(fs, file_inode_index, current, MAX_FILE_SIZE, 0) < 0) {
+        return -1;
+    }
+    for (ssize_t offset = 0; offset < size; offset += BLOCK_SIZE) {
+        size_t length = size - offset < BLOCK_SIZE ? size - offset : BLOCK_SIZE;
+        int block = file_inode->direct_blocks[offset / BLOCK_SIZE];
+        size_t stored = file_inode->size > offset ? file_inode->size - offset : 0;
+        // Komprimierte Blöcke enthalten nicht den Inhalt, verglichen wird der gelesene
+        const uint8_t *old = compressed ? current + offset
+                                        : (block != -1 ? fs->data_blocks[block].block : NULL);
+        if (old != NULL && stored >= length && memcmp(old, content + offset, length) == 0) {
+            continue;
+        }
+        if (inode_pwrite(fs, file_inode_index, content + offset, length, offset) != (int)length) {
+            return -1;
+        }
+    }
+    return inode_shrink(fs, file_inode_index, size) == 0 ? 0 : -1;
+}
+
+
+/*
+ * Gleicht das interne Verzeichnis int_dir mit ext_dir ab
+ */
+static void sync_tree(file_system *fs, char *int_dir, char *ext_dir, int *failed) {
+    DIR *dir = opendir(ext_dir);
+    int dir_inode_index = find_inode_by_path(fs, int_dir);
+    if (dir == NULL || dir_inode_index == -1) {
+        if (dir != NULL) {
+            closedir(dir);
+        }
+        (*failed)++;
+        return;
+    }
+    
+    // Zuerst interne Einträge entfernen, die es auf dem Host nicht (mehr) gibt
+    // oder deren Art sich geändert hat. Das macht auch Platz im Verzeichnis
+    for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
+        int child = fs->inodes[dir_inode_index].direct_blocks[i];
+        if (child == -1) {
+            continue;
+        }
+        char name[NAME_MAX_LENGTH + 1];
+        snprintf(name, sizeof(name), "%.*s", NAME_MAX_LENGTH, fs->inodes[child].name);
+        struct stat st;
+        int keep = fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) == 0
+                   && ((S_ISDIR(st.st_mode) && fs->inodes[child].n_type == directory)
+                       || (S_ISREG(st.st_mode) && fs->inodes[child].n_type == reg_file));
+        if (!keep) {
+            char *int_path = join_path(int_dir, name);
+            if (int_path == NULL || fs_rm(fs, int_path) != 0) {
+                (*failed)++;
+            }
+            free(int_path);
+        }
+    }
+    
+    // Dann die Host-Einträge anlegen bzw. abgleichen
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        char *ext_path = join_path(ext_dir, entry->d_name);
+        char *int_path = join_path(int_dir, entry->d_name);
+        struct stat st;
+        if (ext_path == NULL || int_path == NULL || lstat(ext_path, &st) != 0) {
+            (*failed)++;
+        } else if (S_ISDIR(st.st_mode) || S_ISREG(st.st_mode)) {
+            enum node_type type = S_ISDIR(st.st_mode) ? directory : reg_file;
+            int node = find_inode_by_path(fs, int_path);
+            if (node == -1) {
+                node = create_node(fs, int_path, type);
+            }
+            if (node < 0) {
+                (*failed)++;
+            } else if (type == directory) {
+                sync_tree(fs, int_path, ext_path, failed);
+            } else if (sync_file(fs, node, ext_path) != 0) {
+                (*failed)++;
+            }
+        }
+        free(ext_path);
+        free(int_path);
+    }
+    closedir(dir);
+}
+
+
+int fs_sync_dir(file_system *fs, char *int_dir, char *ext_dir) {
+    if (fs == NULL || int_dir == NULL || ext_dir == NULL) {
+        return -1;
+    }
+    int dir_inode_index = find_inode_by_path(fs, int_dir);
+    struct stat st;
+    if (dir_inode_index == -1 || fs->inodes[dir_inode_index].n_type != directory
+        || stat(ext_dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return -1;
+    }
+    
+    // Alle Änderungen werden einmal am Ende gespeichert
+    fs_batch_begin(fs);
+    int failed = 0;
+    sync_tree(fs, int_dir, ext_dir, &failed);
+    fs->dirty = 1;
+    if (fs_batch_commit(fs) != 0) {
+        return -1;
+    }
+    return failed;
+}
+
+
+int fs_clone(file_system *fs, char *src, char *dst) {
+    int src_inode_index = find_file(fs, src);
+    if (src_inode_index == -1) {
+        return -1;
+    }
+    
+    // Die Kopie zeigt auf dieselben Blöcke, erst ein Schreibzugriff kopiert sie.
+    // Gepufferte Anhänge brauchen dafür zuerst ihre Blöcke
+    if (wbuf_flush_inode(fs, src_inode_index) != 0) {
+        return -1;
+    }
+    
+    int dst_inode_index = create_node(fs, dst, reg_file);
+    if (dst_inode_index < 0) {
+        return dst_inode_index;
+    }
+    
+    inode *src_inode = &(fs->inodes[src_inode_index]);
+    inode *dst_inode = &(fs->inodes[dst_inode_index]);
+    for (int i = 0; i < DIRECT_BLOCKS_COUNT; i++) {
+        if (src_inode->direct_blocks[i] != -1) {
+            block_share(fs, src_inode->direct_blocks[i]);
+        }
+        dst_inode->direct_blocks[i] = src_inode->direct_blocks[i];
+    }
+    dst_inode->size = src_inode->size;
+    dst_inode->flags = src_inode->flags;
+    
+    fs_persist(fs);
+    return 0;
+}
+
+
+/*
+ * Sucht einen Snapshot nach Namen
+ * Rückgabe: Zeiger auf den Verweis auf den Snapshot (zum Aushängen) oder NULL
+ */
+static fs_snapshot **find_snapshot(file_system *fs, char *name) {
+    if (fs == NULL || name == NULL) {
+        return NULL;
+    }
+    for (fs_snapshot **snap = &fs->snapshots; *snap != NULL; snap = &(*snap)->next) {
+        if (strncmp((*snap)->name, name, NAME_MAX_LENGTH) == 0) {
+            return snap;
+        }
+    }
+    return NULL;
+}
+
+
+/*
+ * Eine Sicht auf das Dateisystem, wie es beim Snapshot war. Sie teilt die
+ * Datenblöcke und darf nur gelesen werden
+ */
+static file_system snapshot_view(file_system *fs, fs_snapshot *snap) {
+    file_system view = *fs;
+    view.inodes = snap->inodes;
+    view.root_node = snap->root_node;
+    // Die Prüfsummen und Schreibpuffer gehören zu den aktuellen INodes
+    view.csum = NULL;
+    view.wbufs = NULL;
+    return view;
+}
+
+
+int fs_snapshot_create(file_system *fs, char *name) {
+    if (fs == NULL || name == NULL || strlen(name) == 0 || strlen(name) >= NAME_MAX_LENGTH || fs->txn != NULL) {
+        return -1;
+    }
+    if (find_snapshot(fs, name) != NULL) {
+        return -2;
+    }
+    
+    size_t inodes_length = fs->s_block->num_blocks * sizeof(inode);
+    fs_snapshot *snap = malloc(sizeof(fs_snapshot));
+    if (snap == NULL || (snap->inodes = malloc(inodes_length)) == NULL) {
+        free(snap);
+        return -1;
+    }
+    
+    // Nur die INodes werden kopiert. Die Blöcke werden geteilt und erst bei
+    // einem Schreibzugriff kopiert, der Platzbedarf wächst mit den Änderungen
+    if (wbuf_flush_all(fs) != 0) {
+        free(snap->inodes);
+        free(snap);
+        return -1;
+    }
+    memset(snap->name, 0, NAME_MAX_LENGTH);
+    strcpy(snap->name, name);
+    snap->root_node = fs->root_node;
+    memcpy(snap->inodes, fs->inodes, inodes_length);
+    share_blocks(fs, snap->inodes);
+    
+    // Hinten anhängen, damit die Snapshots nach Alter sortiert bleiben
+    snap->next = NULL;
+    fs_snapshot **tail = &fs->snapshots;
+    while (*tail != NULL) {
+        tail = &(*tail)->next;
+    }
+    *tail = snap;
+    
+    mark_trailer_dirty(fs);
+    return fs_persist(fs);
+}
+
+
+int fs_snapshot_delete(file_system *fs, char *name) {
+    fs_snapshot **link = find_snapshot(fs, name);
+    if (link == NULL || fs->txn != NULL) {
+        return -1;
+    }
+    
+    // Blöcke, die nur noch der Snapshot benutzt hat, werden frei
+    fs_snapshot *snap = *link;
+    *link = snap->next;
+    release_blocks(fs, snap->inodes);
+    free(snap->inodes);
+    free(snap);
+    
+    mark_trailer_dirty(fs);
+    return fs_persist(fs);
+}
+
+
+int fs_snapshot_restore(file_system *fs, char *name) {
+    fs_snapshot **link = find_snapshot(fs, name);
+    if (link == NULL || fs->txn != NULL) {
+        return -1;
+    }
+    fs_snapshot *snap = *link;
+    
+    // Die aktuellen Dateien geben ihre Blöcke ab und übernehmen die des Snapshots
+    if (wbuf_flush_all(fs) != 0) {
+        return -1;
+    }
+    release_blocks(fs, fs->inodes);
+    for (uint32_t i = 0; i < fs->s_block->num_blocks; i++) {
+        if (memcmp(&fs->inodes[i], &snap->inodes[i], sizeof(inode)) != 0) {
+            fs->inodes[i] = snap->inodes[i];
+            mark_inode_dirty(fs, i);
+        }
+    }
+    fs->root_node = snap->root_node;
+    share_blocks(fs, fs->inodes);
+    
+    // Offene Handles zeigen auf INodes, die es so nicht mehr gibt
+    for (fs_handle *handle = fs->handles; handle != NULL; handle = handle->next) {
+        handle->inode = -1;
+    }
+    
+    // Die ganze INode-Tabelle hat sich geändert
+    mark_all_dirty(fs);
+    return fs_persist(fs);
+}
+
+
+char *fs_snapshot_list(file_system *fs) {
+    if (fs == NULL) {
+        return NULL;
+    }
+    
+    size_t length = 0;
+    for (fs_snapshot *snap = fs->snapshots; snap != NULL; snap = snap->next) {
+        length += strnlen(snap->name, NAME_MAX_LENGTH) + 1;
+    }
+    char *result = malloc(length + 1);
+    if (result == NULL) {
+        return NULL;
+    }
+    char *position = result;
+    *position = '\0';
+    for (fs_snapshot *snap = fs->snapshots; snap != NULL; snap = snap->next) {
+        position += sprintf(position, "%.*s\n", NAME_MAX_LENGTH, snap->name);
+    }
+    return result;
+}
+
+
+char *fs_snapshot_ls(file_system *fs, char *name, char *path) {
+    fs_snapshot **link = find_snapshot(fs, name);
+    if (link == NULL) {
+        return NULL;
+    }
+    file_system view = snapshot_view(fs, *link);
+    return fs_list(&view, path);
+}
+
+
+uint8_t *fs_snapshot_readf(file_system *fs, char *name, char *filename, int *file_size) {
+    *file_size = 0;
+    fs_snapshot **link = find_snapshot(fs, name);
+    if (link == NULL) {
+        return NULL;
+    }
+    file_system view = snapshot_view(fs, *link);
+    return fs_readf(&view, filename, file_size);
+}
+
+
+int fs_set_dedup(file_system *fs, int enabled) {
+    // Ein Abbruch stellt nur INodes und Blöcke wieder her, nicht die Einstellungen
+    if (fs == NULL || fs->txn != NULL) {
+        return -1;
+    }
+    
+    if (enabled) {
+        if (dedup_enable(fs) != 0) {
+            return -1;
+        }
+        fs->features |= FS_FEATURE_DEDUP;
+    } else {
+        dedup_disable(fs);
+        fs->features &= ~FS_FEATURE_DEDUP;
+    }
+    
+    // Die Einstellung steht im Anhang des Abbilds
+    mark_trailer_dirty(fs);
+    return fs_persist(fs);
+}
+
+
+int fs_set_checksums(file_system *fs, int enabled) {
+    if (fs == NULL || fs->txn != NULL) {
+        return -1;
+    }
+    
+    if (enabled) {
+        if (fs->csum == NULL && checksums_enable(fs) != 0) {
+            return -1;
+        }
+        fs->features |= FS_FEATURE_CHECKSUMS;
+    } else {
+        checksums_disable(fs);
+        fs->features &= ~FS_FEATURE_CHECKSUMS;
+    }
+    
+    // Die Tabelle steht im Anhang des Abbilds
+    mark_trailer_dirty(fs);
+    return fs_persist(fs);
+}
+
+
+int fs_set_log(file_system *fs, int enabled) {
+    if (fs == NULL || fs->txn != NULL) {
+        return -1;
+    }
+    
+    if (enabled) {
+        if (!(fs->features & FS_FEATURE_LOG)) {
+            log_rewind(fs);
+        }
+        fs->features |= FS_FEATURE_LOG;
+    } else {
+        fs->features &= ~FS_FEATURE_LOG;
+    }
+    
+    // Die Einstellung steht im Anhang des Abbilds
+    mark_trailer_dirty(fs);
+    return fs_persist(fs);
+}
+
+
+/*
+ * Setzt die Flags aller INodes einer Tabelle zurück. Solange die Kompression
+ * aus war, wurden sie nicht gepflegt
+ */
+static void clear_inode_flags(inode *inodes, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        inodes[i].flags = 0;
+    }
+}
+
+
+int fs_set_compression(file_system *fs, int enabled) {
+    if (fs == NULL || fs->txn != NULL) {
+        return -1;
+    }
+    
+    uint32_t count = fs->s_block->num_blocks;
+    if (wbuf_flush_all(fs) != 0) {
+        return -1;
+    }
+    if (enabled) {
+        if (cluster_cache_alloc(fs) != 0) {
+            return -1;
+        }
+        if (!(fs->features & FS_FEATURE_COMPRESSION)) {
+            for (uint32_t i = 0; i < count; i++) {
+                if (fs->inodes[i].flags != 0) {
+                    fs->inodes[i].flags = 0;
+                    mark_inode_dirty(fs, i);
+                }
+            }
+            // Die Snapshots stehen im Anhang
+            for (fs_snapshot *snap = fs->snapshots; snap != NULL; snap = snap->next) {
+                clear_inode_flags(snap->inodes, count);
+            }
+            fs->features |= FS_FEATURE_COMPRESSION;
+        }
+        // Vorhandene Dateien werden komprimiert, soweit der Platz reicht
+        for (uint32_t i = 0; i < count; i++) {
+            if (fs->inodes[i].n_type == reg_file) {
+                compress_inode(fs, i);
+            }
+        }
+    } else if (fs->features & FS_FEATURE_COMPRESSION) {
+        // Snapshots lassen sich nicht umschreiben, ihre Dateien brauchen die Kompression
+        for (fs_snapshot *snap = fs->snapshots; snap != NULL; snap = snap->next) {
+            for (uint32_t i = 0; i < count; i++) {
+                if (snap->inodes[i].n_type == reg_file && (snap->inodes[i].flags & INODE_COMPRESSED)) {
+                    return -1;
+                }
+            }
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            if (fs->inodes[i].n_type == reg_file && decompress_inode(fs, i) != 0) {
+                fs_persist(fs);
+                return -2;
+            }
+        }
+        cluster_cache_free(fs);
+        fs->features &= ~FS_FEATURE_COMPRESSION;
+    }
+    
+    // Die Einstellung steht im Anhang des Abbilds
+    mark_trailer_dirty(fs);
+    return fs_persist(fs);
+}
+
+
+int fs_set_write_buffering(file_system *fs, int enabled) {
+    if (fs == NULL) {
+        return -1;
+    }
+    
+    // Nur eine Einstellung der laufenden Sitzung, nicht des Abbilds
+    fs->write_buffering = enabled != 0;
+    return enabled ? 0 : fs_persist(fs);
+}
+
+
+int fs_flush(file_system *fs) {
+    if (fs == NULL) {
+        return -1;
+    }
+    
+    // fs_persist schreibt zuerst die Puffer in ihre Blöcke
+    return fs_persist(fs);
+}
+
+
+int fs_batch_begin(file_system *fs) {
+    if (fs == NULL) {
+        return -1;
+    }
+    
+    fs->batch_depth++;
+    return 0;
+}
+
+
+int fs_batch_commit(file_system *fs) {
+    if (fs == NULL || fs->batch_depth == 0) {
+        return -1;
+    }
+    // Batches außerhalb einer offenen Transaktion enden erst nach ihr
+    if (fs->txn != NULL && fs->batch_depth <= fs->txn->batch_depth) {
+        return -1;
+    }
+    
+    // Erst der äußerste Batch schreibt das Dateisystem
+    if (--fs->batch_depth > 0 || !fs->dirty) {
+        return 0;
+    }
+    
+    fs->dirty = 0;
+    return fs_persist(fs);
+}
+
+
+int fs_batch_exec(file_system *fs, fs_op *ops, int count) {
+    if (fs_batch_begin(fs) != 0) {
+        return -1;
+    }
+    
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        switch (ops[i].op) {
+            case FS_BATCH_MKDIR:
+                ops[i].status = fs_mkdir(fs, ops[i].path);
+                break;
+            case FS_BATCH_MKFILE:
+                ops[i].status = fs_mkfile(fs, ops[i].path);
+                break;
+            case FS_BATCH_WRITEF:
+                ops[i].status = fs_writef(fs, ops[i].path, ops[i].arg);
+                break;
+            case FS_BATCH_RM:
+                ops[i].status = fs_rm(fs, ops[i].path);
+                break;
+            case FS_BATCH_IMPORT:
+                ops[i].status = fs_import(fs, ops[i].path, ops[i].arg);
+                break;
+            case FS_BATCH_EXPORT:
+                ops[i].status = fs_export(fs, ops[i].path, ops[i].arg);
+                break;
+            default:
+                ops[i].status = -1;
+                break;
+        }
+        
+        // fs_writef liefert die Anzahl geschriebener Zeichen, alle anderen 0
+        if (ops[i].status < 0) {
+            failed++;
+        }
+    }
+    
+    if (fs_batch_commit(fs) != 0) {
+        return -1;
+    }
+    
+    return failed;
+}
+
+
+
+
+int fs_txn_begin(file_system *fs) {
+    if (fs == NULL || fs->txn != NULL) {
+        return -1;
+    }
+    
+    uint32_t size = fs->s_block->num_blocks;
+    fs_txn *txn = malloc(sizeof(fs_txn));
+    uint8_t *free_list = malloc(size);
+    inode *inodes = malloc(size * sizeof(inode));
+    // Innerhalb der Transaktion wird nicht gepuffert
+    if (txn == NULL || free_list == NULL || inodes == NULL || wbuf_flush_all(fs) != 0) {
+        free(txn);
+        free(free_list);
+        free(inodes);
+        return -1;
+    }
+    
+    // Die Operationen arbeiten ab jetzt auf Kopien, der bisherige Zustand bleibt für abort erhalten.
+    memcpy(free_list, fs->free_list, size);
+    memcpy(inodes, fs->inodes, size * sizeof(inode));
+    txn->s_block = *fs->s_block;
+    txn->free_list = fs->free_list;
+    txn->inodes = fs->inodes;
+    txn->root_node = fs->root_node;
+    txn->dirty = fs->dirty;
+    
+    fs->free_list = free_list;
+    fs->inodes = inodes;
+    fs->txn = txn;
+    
+    // Bis zum Ende der Transaktion wird nichts geschrieben
+    fs->batch_depth++;
+    txn->batch_depth = fs->batch_depth;
+    return 0;
+}
+
+
+int fs_txn_commit(file_system *fs) {
+    // In der Transaktion geöffnete Batches müssen zuerst enden
+    if (fs == NULL || fs->txn == NULL || fs->batch_depth != fs->txn->batch_depth) {
+        return -1;
+    }
+    
+    // Das Abbild in einem Schritt ersetzen. Schlägt das fehl, bleibt die Transaktion offen
+    if (fs->batch_depth == 1) {
+        if (fs->path == NULL || fs_dump_atomic(fs, fs->path) != 0) {
+            return -1;
+        }
+        fs->dirty = 0;
+    } else {
+        // Ein umschließender Batch schreibt das Dateisystem
+        fs->dirty = 1;
+    }
+    
+    fs->batch_depth--;
+    free(fs->txn->free_list);
+    free(fs->txn->inodes);
+    free(fs->txn);
+    fs->txn = NULL;
+    return 0;
+}
+
+
+int fs_txn_abort(file_system *fs) {
+    if (fs == NULL || fs->txn == NULL) {
+        return -1;
+    }
+    
+    // Zum Zustand vom Beginn der Transaktion zurückkehren. Die Datenblöcke dieses
+    // Zustands wurden nie verändert, neu belegte Blöcke sind dort wieder frei
+    fs_txn *txn = fs->txn;
+    free(fs->free_list);
+    free(fs->inodes);
+    fs->free_list = txn->free_list;
+    fs->inodes = txn->inodes;
+    *fs->s_block = txn->s_block;
+    fs->root_node = txn->root_node;
+    fs->dirty = txn->dirty;
+    // Auch die in der Transaktion geöffneten Batches sind verworfen
+    fs->batch_depth = txn->batch_depth - 1;
+    
+    free(txn);
+    fs->txn = NULL;
+    
+    // Offene Handles können auf INodes zeigen, die es so nicht mehr gibt
+    for (fs_handle *handle = fs->handles; handle != NULL; handle = handle->next) {
+        handle->inode = -1;
+    }
+    
+    // Die Referenzzähler gehören zu den verworfenen INodes
+    fs_rebuild_refs(fs);
+    return 0;
+}
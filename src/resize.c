@@ -0,0 +1,298 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/filesystem.h"
+#include "../lib/operations.h"
+
+/*
+ * fs_resize changes the image in place where its layout allows it. Images written by
+ * fs_resize have room to grow in their free list and inode table (table_capacity, see
+ * filesystem.h), the data blocks come last: the new entries go into that room and
+ * behind the data blocks, a shrunk image is cut off after its new last block. Only the
+ * entries moved out of the tail, the new entries and the trailer are written. An image
+ * in the plain layout, or one whose tables are full, is written once as a whole with
+ * room for twice the size.
+ * Shrinking first moves what lives in the tail into free entries below the new size.
+ */
+
+/*
+ * brings the flags of a dirty set from old_size to size numbers. The numbers past size
+ * are dropped, what they stood for was moved below it
+ */
+static int resize_dirty_set(dirty_set* set, uint32_t old_size, uint32_t size){
+	uint32_t kept = 0;
+	for (uint32_t i=0; i<set->count; i++) {
+		uint32_t n = set->list[i];
+		if(n < size){
+			set->list[kept++] = n;
+		}else{
+			set->flags[n / 8] &= ~(1 << (n % 8));
+		}
+	}
+	set->count = kept;
+	uint32_t old_bytes = (old_size + 7) / 8;
+	uint32_t bytes = (size + 7) / 8;
+	if(resize_array(&set->flags, old_bytes, bytes, sizeof(uint8_t)) != 0){
+		return -1;
+	}
+	if(bytes > old_bytes){
+		memset(set->flags + old_bytes, 0, bytes - old_bytes);
+	}
+	return 0;
+}
+
+
+/*
+ * moves the used inodes numbered size.. of a table into free inodes below size and
+ * updates the directory entries, parent links and the root. map[i - size] receives
+ * the new number of inode i. The changed inodes of the live table (fs != NULL) are
+ * marked dirty
+ */
+static void move_inodes(file_system* fs, inode* table, int* root_node, uint32_t old_size, uint32_t size, int* map){
+	uint32_t target = 0;
+	for (uint32_t i=size; i<old_size; i++) {
+		map[i - size] = -1;
+		if(table[i].n_type == free_block){
+			continue;
+		}
+		while (table[target].n_type != free_block) {
+			target++;
+		}
+		table[target] = table[i];
+		inode_init(&table[i]);
+		map[i - size] = target;
+		if(fs != NULL){
+			mark_inode_dirty(fs, target);
+		}
+	}
+
+	for (uint32_t i=0; i<size; i++) {
+		inode* node = &table[i];
+		if(node->n_type == free_block){
+			continue;
+		}
+		int changed = 0;
+		if(node->parent >= (int)size){
+			node->parent = map[node->parent - size];
+			changed = 1;
+		}
+		for (int j=0; node->n_type == directory && j<DIRECT_BLOCKS_COUNT; j++) {
+			if(node->direct_blocks[j] >= (int)size){
+				node->direct_blocks[j] = map[node->direct_blocks[j] - size];
+				changed = 1;
+			}
+		}
+		if(changed && fs != NULL){
+			mark_inode_dirty(fs, i);
+		}
+	}
+	if(*root_node >= (int)size){
+		*root_node = map[*root_node - size];
+	}
+}
+
+
+/*
+ * points the file blocks of a table numbered size.. to their new place, marking the
+ * changed inodes of the live table (fs != NULL) dirty
+ */
+static void move_block_refs(file_system* fs, inode* table, uint32_t old_size, uint32_t size, const int* map){
+	for (uint32_t i=0; i<old_size; i++) {
+		if(table[i].n_type != reg_file){
+			continue;
+		}
+		int changed = 0;
+		for (int j=0; j<DIRECT_BLOCKS_COUNT; j++) {
+			if(table[i].direct_blocks[j] >= (int)size){
+				table[i].direct_blocks[j] = map[table[i].direct_blocks[j] - size];
+				changed = 1;
+			}
+		}
+		if(changed && fs != NULL){
+			mark_inode_dirty(fs, i);
+		}
+	}
+}
+
+
+static uint32_t count_used_inodes(inode* table, uint32_t size){
+	uint32_t used = 0;
+	for (uint32_t i=0; i<size; i++) {
+		used += table[i].n_type != free_block;
+	}
+	return used;
+}
+
+
+//the inode lives in the tail or points into it
+static int touches_tail(inode* node, uint32_t index, uint32_t size){
+	if(node->n_type == free_block){
+		return 0;
+	}
+	if(index >= size || node->parent >= (int)size){
+		return 1;
+	}
+	for (int j=0; j<DIRECT_BLOCKS_COUNT; j++) {
+		if(node->direct_blocks[j] >= (int)size){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/*
+ * moves everything living at or past size below it
+ * @return 0 on success, -2 if it doesn't fit, -3 if an entry to be moved or changed
+ * doesn't match its checksum, -1 if out of memory
+ */
+static int evacuate_tail(file_system* fs, uint32_t size){
+	uint32_t old_size = fs->s_block->num_blocks;
+	if(old_size - fs->s_block->free_blocks > size || count_used_inodes(fs->inodes, old_size) > size){
+		return -2;
+	}
+	for (fs_snapshot* snap = fs->snapshots; snap != NULL; snap = snap->next) {
+		if(count_used_inodes(snap->inodes, old_size) > size){
+			return -2;
+		}
+	}
+	//the moved and changed entries get new checksums, a damaged one would pass as
+	//correct afterwards
+	for (uint32_t i=0; i<old_size; i++) {
+		if(touches_tail(&fs->inodes[i], i, size) && checksum_verify_inode(fs, i) != 0){
+			return -3;
+		}
+		if(i >= size && fs->free_list[i] == 0 && checksum_verify_block(fs, i) != 0){
+			return -3;
+		}
+	}
+	int* map = malloc((old_size - size) * sizeof(int));
+	if(map == NULL){
+		return -1;
+	}
+
+	//blocks first, the inodes pointing to them may move afterwards
+	uint32_t target = 0;
+	for (uint32_t i=size; i<old_size; i++) {
+		map[i - size] = -1;
+		if(fs->free_list[i] != 0){
+			continue;
+		}
+		while (fs->free_list[target] == 0) {
+			target++;
+		}
+		fs->data_blocks[target] = fs->data_blocks[i];
+		fs->free_list[target] = 0;
+		fs->free_list[i] = 1;
+		fs->refs[target] = fs->refs[i];
+		fs->refs[i] = 0;
+		dedup_move(fs, i, target);
+		mark_block_dirty(fs, target);
+		map[i - size] = target;
+	}
+	move_block_refs(fs, fs->inodes, old_size, size, map);
+	for (fs_snapshot* snap = fs->snapshots; snap != NULL; snap = snap->next) {
+		move_block_refs(NULL, snap->inodes, old_size, size, map);
+	}
+
+	for (fs_snapshot* snap = fs->snapshots; snap != NULL; snap = snap->next) {
+		move_inodes(NULL, snap->inodes, &snap->root_node, old_size, size, map);
+	}
+	move_inodes(fs, fs->inodes, &fs->root_node, old_size, size, map);
+	for (fs_handle* handle = fs->handles; handle != NULL; handle = handle->next) {
+		if(handle->inode >= (int)size){
+			handle->inode = map[handle->inode - size];
+		}
+	}
+	free(map);
+	return 0;
+}
+
+
+/*
+ * brings every per-entry array to size entries, new entries are free. A failed
+ * resize leaves some arrays larger than needed, nothing else
+ */
+static int resize_arrays(file_system* fs, uint32_t size){
+	uint32_t old_size = fs->s_block->num_blocks;
+	int ok = resize_array(&fs->free_list, old_size, size, sizeof(uint8_t)) == 0
+		&& resize_array(&fs->inodes, old_size, size, sizeof(inode)) == 0
+		&& resize_array(&fs->data_blocks, old_size, size, sizeof(data_block)) == 0
+		&& resize_array(&fs->refs, old_size, size, sizeof(uint32_t)) == 0
+		&& resize_array(&fs->inode_gen, old_size, size, sizeof(uint32_t)) == 0
+		&& resize_array(&fs->block_gen, old_size, size, sizeof(uint32_t)) == 0
+		&& resize_dirty_set(&fs->dirty_inodes, old_size, size) == 0
+		&& resize_dirty_set(&fs->dirty_blocks, old_size, size) == 0;
+	for (fs_snapshot* snap = fs->snapshots; ok && snap != NULL; snap = snap->next) {
+		ok = resize_array(&snap->inodes, old_size, size, sizeof(inode)) == 0;
+	}
+	if(!ok){
+		return -1;
+	}
+
+	for (fs_snapshot* snap = fs->snapshots; snap != NULL; snap = snap->next) {
+		for (uint32_t i=old_size; i<size; i++) {
+			inode_init(&snap->inodes[i]);
+		}
+	}
+	for (uint32_t i=old_size; i<size; i++) {
+		fs->free_list[i] = 1;
+		inode_init(&fs->inodes[i]);
+		memset(&fs->data_blocks[i], 0, sizeof(data_block));
+		fs->refs[i] = 0;
+		fs->inode_gen[i] = fs->generation;
+		fs->block_gen[i] = fs->generation;
+	}
+	return checksums_resize(fs, old_size, size) == 0 && dedup_resize(fs, old_size, size) == 0 ? 0 : -1;
+}
+
+
+int fs_resize(file_system *fs, uint32_t num_blocks){
+	//block numbers are ints, and the tables get room for twice the size
+	if(fs == NULL || num_blocks == 0 || num_blocks > INT32_MAX / 2 || fs->txn != NULL || fs->batch_depth > 0){
+		return -1;
+	}
+	uint32_t old_size = fs->s_block->num_blocks;
+	if(num_blocks == old_size){
+		return 0;
+	}
+	//the blocks set aside for buffered appends have to be counted as used
+	if(wbuf_flush_all(fs) != 0){
+		return -1;
+	}
+	//both know entries by their number
+	cluster_cache_clear(fs);
+	inode_index_drop(fs);
+	if(num_blocks < old_size){
+		int status = evacuate_tail(fs, num_blocks);
+		if(status != 0){
+			return status;
+		}
+	}
+	if(resize_arrays(fs, num_blocks) != 0){
+		//what was moved out of the tail still has to be written
+		mark_all_dirty(fs);
+		return -1;
+	}
+	fs->s_block->num_blocks = num_blocks;
+	//the tail is free after evacuating it, and so are the new entries
+	if(num_blocks > old_size){
+		fs->s_block->free_blocks += num_blocks - old_size;
+	}else{
+		fs->s_block->free_blocks -= old_size - num_blocks;
+	}
+	//it moves with the end of the data blocks, and its per-entry tables change size
+	mark_trailer_dirty(fs);
+
+	if(num_blocks > fs->table_capacity){
+		fs->table_capacity = num_blocks > old_size ? 2 * num_blocks : old_size;
+		mark_all_dirty(fs);
+		return fs_dump_atomic(fs, fs->path);
+	}
+	if(num_blocks > old_size && image_extend(fs, old_size) != 0){
+		mark_all_dirty(fs);
+		return fs_dump_atomic(fs, fs->path);
+	}
+	return fs_persist(fs);
+}
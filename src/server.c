@@ -0,0 +1,498 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../lib/filesystem.h"
+#include "../lib/operations.h"
+#include "../lib/protocol.h"
+#include "../lib/server.h"
+#include "../lib/utils.h"
+
+#define MAX_EVENTS 64
+#define READ_CHUNK 65536
+//stop reading requests of a client that doesn't collect its responses
+#define OUT_HIGH_WATER (4 * 1024 * 1024)
+//in log mode, after this long without requests the log is cleaned in steps of LOG_IDLE_BUDGET blocks
+#define LOG_IDLE_MS 200
+#define LOG_IDLE_BUDGET 64
+
+typedef struct _buffer{
+	uint8_t* data;
+	size_t len;
+	size_t cap;
+} buffer;
+
+typedef struct _connection{
+	int fd;
+	int eof; //peer has shut down its sending side
+	int batch_depth; //batches opened by this client and not yet committed
+	uint32_t events; //currently registered epoll events
+	buffer in; //received, not yet executed requests
+	buffer out; //responses not yet sent
+	size_t out_off; //bytes of out already sent
+	struct _connection* prev;
+	struct _connection* next;
+} connection;
+
+static volatile sig_atomic_t stop_serving = 0;
+
+static void handle_stop(int sig){
+	stop_serving = 1;
+}
+
+
+static int buffer_reserve(buffer* b, size_t extra){
+	if(b->len + extra <= b->cap){
+		return 0;
+	}
+	size_t cap = b->cap ? b->cap : 4096;
+	while (cap < b->len + extra) {
+		cap *= 2;
+	}
+	uint8_t* data = realloc(b->data, cap);
+	if(data == NULL){
+		return -1;
+	}
+	b->data = data;
+	b->cap = cap;
+	return 0;
+}
+
+
+static int buffer_append(buffer* b, const void* src, size_t n){
+	if(n == 0){
+		return 0;
+	}
+	if(buffer_reserve(b, n) != 0){
+		return -1;
+	}
+	memcpy(b->data + b->len, src, n);
+	b->len += n;
+	return 0;
+}
+
+
+static int reply(connection* c, uint32_t id, int32_t status, const void* payload, uint32_t len){
+	fs_resp_header header = { .len = len, .id = id, .status = status };
+	if(buffer_append(&c->out, &header, sizeof(header)) != 0){
+		return -1;
+	}
+	return buffer_append(&c->out, payload, len);
+}
+
+
+/*
+ * Splits a request payload into its NUL-terminated arguments and the trailing data.
+ * The arguments point into the payload, nothing is copied.
+ */
+static int split_args(uint8_t* payload, uint32_t len, uint16_t nargs, char** args, uint8_t** data, uint32_t* data_len){
+	if(nargs > FS_PROTO_MAX_ARGS){
+		return -1;
+	}
+	uint32_t pos = 0;
+	for (int i=0; i<nargs; i++) {
+		uint8_t* nul = memchr(payload + pos, '\0', len - pos);
+		if(nul == NULL){
+			return -1;
+		}
+		args[i] = (char*)payload + pos;
+		pos = (uint32_t)(nul - payload) + 1;
+	}
+	*data = payload + pos;
+	*data_len = len - pos;
+	return 0;
+}
+
+
+static int execute(file_system* fs, connection* c, const fs_req_header* header, uint8_t* payload){
+	char* args[FS_PROTO_MAX_ARGS];
+	uint8_t* data;
+	uint32_t data_len;
+	static const uint16_t required_args[] = {
+		[FS_OP_MKDIR] = 1, [FS_OP_MKFILE] = 1, [FS_OP_LIST] = 1, [FS_OP_WRITEF] = 1,
+		[FS_OP_READF] = 1, [FS_OP_RM] = 1, [FS_OP_IMPORT] = 2, [FS_OP_EXPORT] = 2,
+		[FS_OP_DUMP] = 0, [FS_OP_BATCH_BEGIN] = 0, [FS_OP_BATCH_COMMIT] = 0,
+		[FS_OP_PWRITE] = 1, [FS_OP_PREAD] = 1, [FS_OP_FSCK] = 0,
+	};
+
+	if(header->op < FS_OP_MKDIR || header->op >= sizeof(required_args) / sizeof(required_args[0])
+	   || split_args(payload, header->len, header->nargs, args, &data, &data_len) != 0
+	   || header->nargs < required_args[header->op]){
+		return reply(c, header->id, FS_PROTO_BAD_REQUEST, NULL, 0);
+	}
+
+	switch (header->op) {
+		case FS_OP_MKDIR:
+			return reply(c, header->id, fs_mkdir(fs, args[0]), NULL, 0);
+		case FS_OP_MKFILE:
+			return reply(c, header->id, fs_mkfile(fs, args[0]), NULL, 0);
+		case FS_OP_LIST: {
+			char* listing = fs_list(fs, args[0]);
+			if(listing == NULL){
+				return reply(c, header->id, -1, NULL, 0);
+			}
+			int ret = reply(c, header->id, 0, listing, strlen(listing));
+			free(listing);
+			return ret;
+		}
+		case FS_OP_WRITEF: {
+			//fs_writef wants a C string, the data on the wire isn't terminated
+			char* text = malloc(data_len + 1);
+			if(text == NULL){
+				return -1;
+			}
+			memcpy(text, data, data_len);
+			text[data_len] = '\0';
+			int ret = reply(c, header->id, fs_writef(fs, args[0], text), NULL, 0);
+			free(text);
+			return ret;
+		}
+		case FS_OP_READF: {
+			int file_size = 0;
+			uint8_t* content = fs_readf(fs, args[0], &file_size);
+			if(content == NULL){
+				//an empty file reads as NULL, too
+				int status = find_inode_by_path(fs, args[0]) == -1 ? -1 : 0;
+				return reply(c, header->id, status, NULL, 0);
+			}
+			int ret = reply(c, header->id, file_size, content, file_size);
+			free(content);
+			return ret;
+		}
+		case FS_OP_RM:
+			return reply(c, header->id, fs_rm(fs, args[0]), NULL, 0);
+		case FS_OP_IMPORT:
+			return reply(c, header->id, fs_import(fs, args[0], args[1]), NULL, 0);
+		case FS_OP_EXPORT:
+			return reply(c, header->id, fs_export(fs, args[0], args[1]), NULL, 0);
+		case FS_OP_DUMP:
+			return reply(c, header->id, fs_persist(fs), NULL, 0);
+		case FS_OP_BATCH_BEGIN: {
+			int status = fs_batch_begin(fs);
+			if(status == 0){
+				c->batch_depth++;
+			}
+			return reply(c, header->id, status, NULL, 0);
+		}
+		case FS_OP_BATCH_COMMIT:
+			if(c->batch_depth == 0){
+				return reply(c, header->id, -1, NULL, 0);
+			}
+			c->batch_depth--;
+			return reply(c, header->id, fs_batch_commit(fs), NULL, 0);
+		case FS_OP_PWRITE: {
+			fs_proto_range range;
+			if(data_len < sizeof(range)){
+				return reply(c, header->id, FS_PROTO_BAD_REQUEST, NULL, 0);
+			}
+			memcpy(&range, data, sizeof(range));
+			int status = fs_pwrite(fs, args[0], data + sizeof(range), data_len - sizeof(range), range.offset);
+			return reply(c, header->id, status, NULL, 0);
+		}
+		case FS_OP_PREAD: {
+			fs_proto_range range;
+			if(data_len < sizeof(range)){
+				return reply(c, header->id, FS_PROTO_BAD_REQUEST, NULL, 0);
+			}
+			memcpy(&range, data, sizeof(range));
+			if(range.len > MAX_FILE_SIZE){
+				range.len = MAX_FILE_SIZE;
+			}
+			//read straight into the response buffer
+			if(buffer_reserve(&c->out, sizeof(fs_resp_header) + range.len) != 0){
+				return -1;
+			}
+			uint8_t* content = c->out.data + c->out.len + sizeof(fs_resp_header);
+			int status = fs_pread(fs, args[0], content, range.len, range.offset);
+			fs_resp_header response = { .len = status > 0 ? status : 0, .id = header->id, .status = status };
+			memcpy(c->out.data + c->out.len, &response, sizeof(response));
+			c->out.len += sizeof(response) + response.len;
+			return 0;
+		}
+		case FS_OP_FSCK: {
+			//a repair would change the filesystem under the other clients
+			fs_fsck_report report;
+			int status = fs_fsck(fs, 0, 0, &report);
+			return reply(c, header->id, status, &report, status < 0 ? 0 : sizeof(report));
+		}
+	}
+	return reply(c, header->id, FS_PROTO_BAD_REQUEST, NULL, 0);
+}
+
+
+/*
+ * Executes every complete request in the input buffer. Pipelined requests are
+ * answered in order; a partial request stays buffered until the rest arrives.
+ */
+static int process_input(file_system* fs, connection* c){
+	size_t consumed = 0;
+	while (c->in.len - consumed >= sizeof(fs_req_header) && c->out.len < OUT_HIGH_WATER) {
+		fs_req_header header;
+		memcpy(&header, c->in.data + consumed, sizeof(header));
+		if(header.len > FS_PROTO_MAX_PAYLOAD){
+			return -1;
+		}
+		if(c->in.len - consumed - sizeof(header) < header.len){
+			break;
+		}
+		if(execute(fs, c, &header, c->in.data + consumed + sizeof(header)) != 0){
+			return -1;
+		}
+		consumed += sizeof(header) + header.len;
+	}
+	memmove(c->in.data, c->in.data + consumed, c->in.len - consumed);
+	c->in.len -= consumed;
+	return 0;
+}
+
+
+static int flush_output(connection* c){
+	while (c->out_off < c->out.len) {
+		ssize_t sent = send(c->fd, c->out.data + c->out_off, c->out.len - c->out_off, MSG_NOSIGNAL);
+		if(sent < 0){
+			if(errno == EAGAIN || errno == EWOULDBLOCK){
+				return 0;
+			}
+			if(errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		c->out_off += sent;
+	}
+	c->out.len = 0;
+	c->out_off = 0;
+	return 0;
+}
+
+
+static int update_interest(int epfd, connection* c){
+	uint32_t events = 0;
+	if(!c->eof && c->out.len < OUT_HIGH_WATER){
+		events |= EPOLLIN;
+	}
+	if(c->out.len > 0){
+		events |= EPOLLOUT;
+	}
+	if(events == c->events){
+		return 0;
+	}
+	struct epoll_event ev = { .events = events, .data.ptr = c };
+	c->events = events;
+	return epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+
+static void close_connection(file_system* fs, int epfd, connection** list, connection* c){
+	//a client that goes away must not keep the others from being persisted
+	while (c->batch_depth > 0) {
+		fs_batch_commit(fs);
+		c->batch_depth--;
+	}
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	if(c->prev){
+		c->prev->next = c->next;
+	}else{
+		*list = c->next;
+	}
+	if(c->next){
+		c->next->prev = c->prev;
+	}
+	free(c->in.data);
+	free(c->out.data);
+	free(c);
+}
+
+
+static void accept_connections(int epfd, int listen_fd, connection** list){
+	while (1) {
+		int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(fd < 0){
+			return;
+		}
+		connection* c = calloc(1, sizeof(connection));
+		if(c == NULL){
+			close(fd);
+			return;
+		}
+		c->fd = fd;
+		c->events = EPOLLIN;
+		struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+		if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0){
+			close(fd);
+			free(c);
+			continue;
+		}
+		c->next = *list;
+		if(*list){
+			(*list)->prev = c;
+		}
+		*list = c;
+	}
+}
+
+
+/*
+ * Handles one readiness notification of a client.
+ * Returns -1 if the connection has to be closed.
+ */
+static int handle_connection(file_system* fs, int epfd, connection* c, uint32_t events){
+	if(events & EPOLLIN){
+		if(buffer_reserve(&c->in, READ_CHUNK) != 0){
+			return -1;
+		}
+		ssize_t received = read(c->fd, c->in.data + c->in.len, c->in.cap - c->in.len);
+		if(received > 0){
+			c->in.len += received;
+		}else if(received == 0){
+			c->eof = 1;
+		}else if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+			return -1;
+		}
+	}else if(events & (EPOLLERR | EPOLLHUP)){
+		return -1;
+	}
+
+	//responses that didn't fit before may have made room for more requests
+	if(process_input(fs, c) != 0 || flush_output(c) != 0){
+		return -1;
+	}
+	if(c->out.len < OUT_HIGH_WATER && process_input(fs, c) != 0){
+		return -1;
+	}
+	if(c->eof && c->out.len == 0){
+		return -1;
+	}
+	return update_interest(epfd, c);
+}
+
+
+/*
+ * removes a socket left behind by a server that is gone. The socket of a server that
+ * still answers, and anything that isn't a socket, is left alone
+ * @return 0 if the path is free now, -1 else
+ */
+static int remove_stale_socket(const struct sockaddr_un* addr){
+	struct stat st;
+	if(lstat(addr->sun_path, &st) != 0){
+		return 0;
+	}
+	if(!S_ISSOCK(st.st_mode)){
+		fprintf(stderr, "%s exists and is not a socket\n", addr->sun_path);
+		return -1;
+	}
+	int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(probe < 0){
+		perror("socket");
+		return -1;
+	}
+	//a full backlog (EAGAIN) is a live server as well
+	int stale = connect(probe, (const struct sockaddr*)addr, sizeof(*addr)) != 0 && errno == ECONNREFUSED;
+	close(probe);
+	if(!stale){
+		fprintf(stderr, "%s: a server is already listening\n", addr->sun_path);
+		return -1;
+	}
+	unlink(addr->sun_path);
+	return 0;
+}
+
+
+int fs_serve(file_system* fs, const char* socket_path){
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(socket_path) >= sizeof(addr.sun_path)){
+		fprintf(stderr, "Socket path too long: %s\n", socket_path);
+		return -1;
+	}
+	strcpy(addr.sun_path, socket_path);
+
+	if(remove_stale_socket(&addr) != 0){
+		return -1;
+	}
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(listen_fd < 0){
+		perror("socket");
+		return -1;
+	}
+	if(bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, SOMAXCONN) != 0){
+		perror(socket_path);
+		close(listen_fd);
+		return -1;
+	}
+
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+	if(epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev) != 0){
+		perror("epoll");
+		close(listen_fd);
+		unlink(socket_path);
+		return -1;
+	}
+
+	//no SA_RESTART: a signal has to interrupt epoll_wait
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	LOG("Serving filesystem\n");
+
+	connection* connections = NULL;
+	struct epoll_event events[MAX_EVENTS];
+	int log_clean = 1; //the log may need cleaning, set again by every request
+	while (!stop_serving) {
+		int timeout = log_clean && (fs->features & FS_FEATURE_LOG) ? LOG_IDLE_MS : -1;
+		if(fs->wbuf_since != 0 && (timeout == -1 || timeout > WBUF_MAX_AGE_MS)){
+			timeout = WBUF_MAX_AGE_MS;
+		}
+		int n = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+		if(n < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			perror("epoll_wait");
+			break;
+		}
+		if(n == 0){
+			//idle: persist buffered appends, clean the log until there is nothing left to move
+			wbuf_expire(fs);
+			if(fs->features & FS_FEATURE_LOG){
+				log_clean = fs_log_clean(fs, LOG_IDLE_BUDGET) > 0;
+			}
+			continue;
+		}
+		log_clean = 1;
+		for (int i=0; i<n; i++) {
+			connection* c = events[i].data.ptr;
+			if(c == NULL){
+				accept_connections(epfd, listen_fd, &connections);
+			}else if(handle_connection(fs, epfd, c, events[i].events) != 0){
+				close_connection(fs, epfd, &connections, c);
+			}
+		}
+	}
+
+	while (connections) {
+		close_connection(fs, epfd, &connections, connections);
+	}
+	close(epfd);
+	close(listen_fd);
+	unlink(socket_path);
+	fs_persist(fs);
+	LOG("Stopped serving filesystem\n");
+	return 0;
+}
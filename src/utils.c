@@ -4,5 +4,6 @@ void printhelp(){
 	printf("Usage:\n"
 	"-l, --load <filename>\n\tLoads an existing filesystem\n"
 	"-c, --create <filename> <size>\n\tCreates a new filesystem with given filename and size (in Bytes)\n"
+	"-s, --serve <filename> <socket>\n\tServes an existing filesystem to local clients over a UNIX domain socket\n"
 	"-h, --help\n\tPrint this help\n");
 }
@@ -0,0 +1,226 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../lib/filesystem.h"
+
+/*
+ * While write buffering is on, small appends to a file are collected in a write
+ * buffer instead of being copied into blocks one by one. The inode's size grows right
+ * away, the blocks behind the buffered bytes are only allocated when the buffer is
+ * flushed: all at once, as one contiguous run if there is one. A flush happens when
+ * the buffer is full, when the file is read or written otherwise, and before anything
+ * is persisted. Once the first buffered append is older than WBUF_MAX_AGE_MS, the next
+ * append persists; there is no timer, only the server checks the age while it is idle.
+ * The free blocks a flush will need are set aside when appending, so flushing doesn't
+ * run out of space; if it fails anyway, the appends stay buffered.
+ */
+
+
+static uint64_t now_ms(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+static write_buffer** find_buffer(file_system* fs, int inode_number){
+	write_buffer** link = &fs->wbufs;
+	while (*link != NULL && (*link)->inode != inode_number) {
+		link = &(*link)->next;
+	}
+	return link;
+}
+
+
+//number of blocks the range [offset, offset + len) touches
+static uint32_t blocks_touched(size_t offset, size_t len){
+	return len == 0 ? 0 : (offset + len - 1) / BLOCK_SIZE - offset / BLOCK_SIZE + 1;
+}
+
+
+/*
+ * gives the empty slots of the range one contiguous run of blocks, behind the last
+ * block of the file if possible. Without such a run block_for_write allocates them
+ * one by one
+ */
+static void place_range(file_system* fs, int inode_number, size_t offset, size_t len){
+	inode* node = &fs->inodes[inode_number];
+	int first = offset / BLOCK_SIZE;
+	int last = (offset + len - 1) / BLOCK_SIZE;
+	int count = 0;
+	int near = 0;
+	for (int i=0; i<=last; i++) {
+		if(node->direct_blocks[i] == -1){
+			count += i >= first;
+		}else if(i <= first){
+			near = node->direct_blocks[i] + 1;
+		}
+	}
+	int run = count > 0 ? block_alloc_run(fs, count, near) : -1;
+	if(run == -1){
+		return;
+	}
+	for (int i=first; i<=last; i++) {
+		if(node->direct_blocks[i] == -1){
+			node->direct_blocks[i] = run++;
+		}
+	}
+	mark_inode_dirty(fs, inode_number);
+}
+
+
+/*
+ * writes a buffer into its blocks. If that fails, the bytes that weren't written stay
+ * buffered and keep their reservation
+ */
+static int flush(file_system* fs, write_buffer** link){
+	write_buffer* wb = *link;
+	inode* node = &fs->inodes[wb->inode];
+	*link = wb->next;
+	fs->reserved_blocks -= wb->reserved;
+
+	//the blocks end where the buffer starts
+	node->size = wb->offset;
+	//the log allocates one block after the other anyway, and copies what it is given;
+	//compressed files only learn how many blocks they need when the clusters are stored
+	if(!(fs->features & (FS_FEATURE_LOG | FS_FEATURE_COMPRESSION))){
+		place_range(fs, wb->inode, wb->offset, wb->len);
+	}
+	int written = inode_pwrite(fs, wb->inode, wb->data, wb->len, wb->offset);
+	if(written == (int)wb->len){
+		free(wb);
+		return 0;
+	}
+
+	if(written > 0){
+		memmove(wb->data, wb->data + written, wb->len - written);
+		wb->offset += written;
+		wb->len -= written;
+	}
+	//the rest sets aside what is still free of the blocks it needs
+	uint32_t needed = blocks_touched(wb->offset, wb->len);
+	uint32_t unclaimed = fs->s_block->free_blocks > fs->reserved_blocks
+		? fs->s_block->free_blocks - fs->reserved_blocks : 0;
+	wb->reserved = needed < unclaimed ? needed : unclaimed;
+	fs->reserved_blocks += wb->reserved;
+	node->size = wb->offset + wb->len;
+	mark_inode_dirty(fs, wb->inode);
+	wb->next = *link;
+	*link = wb;
+	return written < 0 ? written : -2;
+}
+
+
+int wbuf_flush_inode(file_system* fs, int inode_number){
+	if(fs->wbufs == NULL){
+		return 0;
+	}
+	write_buffer** link = find_buffer(fs, inode_number);
+	return *link != NULL ? flush(fs, link) : 0;
+}
+
+
+int wbuf_flush_all(file_system* fs){
+	int status = 0;
+	write_buffer** link = &fs->wbufs;
+	while (*link != NULL) {
+		int result = flush(fs, link);
+		if(result != 0){
+			//the buffer is back in its place, the others are still tried
+			status = result;
+			link = &(*link)->next;
+		}
+	}
+	return status;
+}
+
+
+void wbuf_drop(file_system* fs, int inode_number){
+	if(fs->wbufs == NULL){
+		return;
+	}
+	write_buffer** link = find_buffer(fs, inode_number);
+	write_buffer* wb = *link;
+	if(wb != NULL){
+		*link = wb->next;
+		fs->reserved_blocks -= wb->reserved;
+		free(wb);
+	}
+}
+
+
+void wbuf_expire(file_system* fs){
+	if(fs->wbuf_since != 0 && now_ms() - fs->wbuf_since >= WBUF_MAX_AGE_MS){
+		fs_persist(fs);
+	}
+}
+
+
+//the append bypasses the buffer
+static int write_through(file_system* fs, int inode_number, const uint8_t* buf, size_t len, size_t offset){
+	int written = inode_pwrite(fs, inode_number, buf, len, offset);
+	fs_persist(fs);
+	return written;
+}
+
+
+int wbuf_append(file_system* fs, int inode_number, const uint8_t* buf, size_t len){
+	inode* node = &fs->inodes[inode_number];
+	size_t offset = node->size;
+	if(len > MAX_FILE_SIZE - offset){
+		return -2;
+	}
+	if(len == 0){
+		return 0;
+	}
+	if(len >= WBUF_SIZE){
+		return write_through(fs, inode_number, buf, len, offset);
+	}
+
+	write_buffer** link = find_buffer(fs, inode_number);
+	if(*link != NULL && (*link)->len + len > WBUF_SIZE){
+		//full: the buffered appends are written, this one starts a new buffer. Inside a
+		//batch fs_persist doesn't flush, so it is done here
+		int status = wbuf_flush_inode(fs, inode_number);
+		if(status != 0){
+			return status;
+		}
+		fs_persist(fs);
+		link = find_buffer(fs, inode_number);
+	}
+	write_buffer* wb = *link;
+	size_t start = wb != NULL ? wb->offset : offset;
+	size_t buffered = wb != NULL ? wb->len : 0;
+	uint32_t reserved = wb != NULL ? wb->reserved : 0;
+	uint32_t needed = blocks_touched(start, buffered + len) - reserved;
+	if(fs->s_block->free_blocks < fs->reserved_blocks + needed){
+		return write_through(fs, inode_number, buf, len, offset);
+	}
+	if(wb == NULL){
+		wb = malloc(sizeof(write_buffer));
+		if(wb == NULL){
+			return write_through(fs, inode_number, buf, len, offset);
+		}
+		wb->inode = inode_number;
+		wb->offset = offset;
+		wb->len = 0;
+		wb->reserved = 0;
+		wb->next = NULL;
+		*link = wb;
+	}
+
+	memcpy(wb->data + wb->len, buf, len);
+	wb->len += len;
+	wb->reserved += needed;
+	fs->reserved_blocks += needed;
+	node->size = offset + len;
+	mark_inode_dirty(fs, inode_number);
+
+	if(fs->wbuf_since == 0){
+		fs->wbuf_since = now_ms();
+	}
+	wbuf_expire(fs);
+	return len;
+}
@@ -0,0 +1,49 @@
+import ctypes
+from wrappers import *
+
+FS_BATCH_MKDIR = 1
+FS_BATCH_MKFILE = 2
+
+class FsOp(ctypes.Structure):
+    _fields_ = [
+        ("op", ctypes.c_int),
+        ("path", ctypes.c_char_p),
+        ("arg", ctypes.c_char_p),
+        ("status", ctypes.c_int)
+    ]
+
+
+class Test_Batch:
+    # Executes several operations in one batch, including nested ones and one that fails
+    # Expected outcome:
+    # * the number of failed operations is returned
+    # * every operation reports its own status
+    # * nested entries are placed below their parent
+    def test_batch_exec(self):
+        fs = setup(10)
+        ops = (FsOp * 4)(
+            FsOp(FS_BATCH_MKDIR, b"/dir", None, 99),
+            FsOp(FS_BATCH_MKFILE, b"/dir/fil", None, 99),
+            FsOp(FS_BATCH_MKFILE, b"/dir/fil", None, 99),
+            FsOp(FS_BATCH_MKDIR, b"/missing/dir", None, 99))
+        retval = libc.fs_batch_exec(ctypes.byref(fs), ops, 4)
+        assert retval == 2
+        assert [op.status for op in ops] == [0, 0, -2, -1]
+        assert fs.inodes[1].direct_blocks[0] == 2
+        assert fs.inodes[2].parent == 1
+        assert fs.inodes[2].name.decode("utf-8") == "fil"
+
+    # Changes made during an open batch only reach the image on commit
+    def test_batch_persists_on_commit(self):
+        fs = setup(5)
+        assert libc.fs_batch_begin(ctypes.byref(fs)) == 0
+        libc.fs_mkdir(ctypes.byref(fs), ctypes.c_char_p(bytes("/dir","UTF-8")))
+        assert load_image().inodes[1].n_type == 3
+
+        assert libc.fs_batch_commit(ctypes.byref(fs)) == 0
+        assert load_image().inodes[1].n_type == 2
+
+    # Committing without an open batch fails
+    def test_batch_commit_without_begin(self):
+        fs = setup(5)
+        assert libc.fs_batch_commit(ctypes.byref(fs)) == -1
@@ -0,0 +1,108 @@
+import ctypes
+from wrappers import *
+
+FS_FILE = "./mypyfiles.fs"
+FS_SIZE = 10
+INODE_SIZE = 92
+BLOCK_RECORD_SIZE = 1032
+
+class ScrubReport(ctypes.Structure):
+    _fields_ = [
+        ("bad_inodes", ctypes.c_uint32),
+        ("bad_blocks", ctypes.c_uint32)
+    ]
+
+
+# flips a byte of the content of data block block in the image file
+def corrupt_block(block):
+    offset = 8 + FS_SIZE + FS_SIZE * INODE_SIZE + block * BLOCK_RECORD_SIZE + 8
+    with open(FS_FILE, "r+b") as f:
+        f.seek(offset)
+        byte = f.read(1)
+        f.seek(offset)
+        f.write(bytes([byte[0] ^ 0xFF]))
+
+class Test_Checksum:
+    # The standard CRC32C check value
+    def test_crc32c(self):
+        libc.crc32c.restype = ctypes.c_uint32
+        assert libc.crc32c(ctypes.c_uint32(0), c_str("123456789"), ctypes.c_size_t(9)) == 0xE3069283
+
+    # Changes made with checksums on are persisted with their checksums and
+    # read back without complaint after loading
+    def test_checksum_roundtrip(self):
+        fs = setup(FS_SIZE)
+        assert libc.fs_set_checksums(ctypes.byref(fs), 1) == 0
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/fil"))
+        assert pwrite(fs, "/fil", b"A" * 2000) == 2000
+        assert pwrite(fs, "/fil", b"B", 1500) == 1
+        fs = load_image()
+        assert pread(fs, "/fil", 2000)[0] == 2000
+        assert libc.fs_scrub(ctypes.byref(fs), 0, None) == 0
+
+    # A block damaged in the image fails the read and is found by a scrub
+    def test_checksum_corrupt_block(self):
+        fs = setup(FS_SIZE)
+        libc.fs_set_checksums(ctypes.byref(fs), 1)
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/fil"))
+        pwrite(fs, "/fil", b"A" * 2000)
+        block = fs.inodes[1].direct_blocks[1]
+        corrupt_block(block)
+
+        report = ScrubReport()
+        assert libc.fs_scrub(ctypes.byref(fs), 3, ctypes.byref(report)) == 1
+        assert report.bad_blocks == 1 and report.bad_inodes == 0
+
+        fs = load_image()
+        assert pread(fs, "/fil", 2000)[0] == -3
+        assert pread(fs, "/fil", 1000)[0] == 1000 # the first block is intact
+        file_size = ctypes.c_int()
+        libc.fs_readf.restype = ctypes.c_char_p
+        assert libc.fs_readf(ctypes.byref(fs), c_str("/fil"), ctypes.byref(file_size)) is None
+
+    # Without checksums nothing is verified
+    def test_checksum_off(self):
+        fs = setup(FS_SIZE)
+        libc.fs_set_checksums(ctypes.byref(fs), 1)
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/fil"))
+        pwrite(fs, "/fil", b"A" * 100)
+        assert libc.fs_set_checksums(ctypes.byref(fs), 0) == 0
+        corrupt_block(fs.inodes[1].direct_blocks[0])
+        fs = load_image()
+        assert pread(fs, "/fil", 100)[0] == 100
+        assert libc.fs_scrub(ctypes.byref(fs), 0, None) == -1
+
+    # Rewriting the whole image (snapshot restore) keeps the checksums of
+    # entries never verified, a damaged block isn't taken as correct
+    def test_checksum_rewrite_keeps_damage(self):
+        fs = setup(FS_SIZE)
+        libc.fs_set_checksums(ctypes.byref(fs), 1)
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/fil"))
+        pwrite(fs, "/fil", b"A" * 2000)
+        assert libc.fs_snapshot_create(ctypes.byref(fs), c_str("snap")) == 0
+        corrupt_block(fs.inodes[1].direct_blocks[1])
+
+        fs = load_image()
+        assert libc.fs_snapshot_restore(ctypes.byref(fs), c_str("snap")) == 0
+        assert libc.fs_scrub(ctypes.byref(fs), 0, None) == 1
+        assert pread(fs, "/fil", 2000)[0] == -3
+        # growing moves nothing, the damage is still found afterwards
+        assert libc.fs_resize(ctypes.byref(fs), FS_SIZE + 5) == 0
+        assert pread(fs, "/fil", 2000)[0] == -3
+        fs = load_image()
+        assert pread(fs, "/fil", 2000)[0] == -3
+
+    # Shrinking doesn't move a damaged block
+    def test_checksum_resize_damaged_tail(self):
+        fs = setup(FS_SIZE)
+        libc.fs_set_checksums(ctypes.byref(fs), 1)
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/a"))
+        pwrite(fs, "/a", b"A" * 8000)
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/b"))
+        pwrite(fs, "/b", b"B" * 1000)
+        libc.fs_rm(ctypes.byref(fs), c_str("/a"))
+        corrupt_block(fs.inodes[2].direct_blocks[0])
+
+        fs = load_image()
+        assert libc.fs_resize(ctypes.byref(fs), 5) == -3
+        assert fs.s_block.contents.num_blocks == FS_SIZE
@@ -0,0 +1,48 @@
+import ctypes
+from wrappers import *
+
+
+def clone(fs, src, dst):
+    return libc.fs_clone(ctypes.byref(fs), ctypes.c_char_p(bytes(src,"UTF-8")), ctypes.c_char_p(bytes(dst,"UTF-8")))
+
+class Test_Clone:
+    # Clones a file spread over two blocks
+    # Expected outcome:
+    # * the clone has the same size and points to the same blocks
+    # * no data block is allocated
+    def test_clone_shares_blocks(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_data_block_with_string(block_num=0,string_data=LONG_DATA[:1024],parent_inode=1,parent_block_num=0,fs=fs)
+        fs = set_data_block_with_string(block_num=1,string_data=LONG_DATA[1024:],parent_inode=1,parent_block_num=1,fs=fs)
+        free_blocks = fs.s_block.contents.free_blocks
+
+        assert clone(fs, "/fil1", "/fil2") == 0
+        assert fs.inodes[2].name.decode("utf-8") == "fil2"
+        assert fs.inodes[2].size == len(LONG_DATA)
+        assert list(fs.inodes[2].direct_blocks[:2]) == [0, 1]
+        assert fs.s_block.contents.free_blocks == free_blocks
+
+    # Writing into the clone copies the block, the source keeps its content
+    # and the shared block survives removing one of the files
+    def test_clone_copy_on_write(self):
+        fs = setup(5)
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","UTF-8")))
+        pwrite(fs, "/fil1", b"template")
+        clone(fs, "/fil1", "/fil2")
+        assert pwrite(fs, "/fil2", b"T") == 1
+        assert pread(fs, "/fil1", 100)[1] == b"template"
+        assert pread(fs, "/fil2", 100)[1] == b"Template"
+
+        block = fs.inodes[1].direct_blocks[0]
+        clone(fs, "/fil1", "/fil3")
+        libc.fs_rm(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","UTF-8")))
+        assert fs.free_list[block] == 0
+        assert pread(fs, "/fil3", 100)[1] == b"template"
+
+    def test_clone_failing(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        assert clone(fs, "/missing", "/fil2") == -1
+        assert clone(fs, "/fil1", "/fil1") == -2
+        assert clone(fs, "/fil1", "/missing/fil2") == -1
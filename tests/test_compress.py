@@ -0,0 +1,93 @@
+import ctypes
+import os
+from wrappers import *
+
+
+def used_blocks(fs, inode):
+    return sum(fs.inodes[inode].direct_blocks[i] != -1 for i in range(12))
+
+TEXT = (LONG_DATA * 10)[:12288].encode()
+
+class Test_Compress:
+    # The codec restores what it compressed and rejects damaged input
+    def test_compress_codec(self):
+        for data in [b"", b"abc", b"a" * 5000, TEXT, os.urandom(3000)]:
+            packed = ctypes.create_string_buffer(len(data) + 64)
+            n = libc.lz_compress(ctypes.c_char_p(data), ctypes.c_size_t(len(data)), packed, ctypes.c_size_t(len(packed)))
+            assert n >= 0
+            out = ctypes.create_string_buffer(len(data) + 1)
+            assert libc.lz_decompress(packed, ctypes.c_size_t(n), out, ctypes.c_size_t(len(out))) == len(data)
+            assert out.raw[:len(data)] == data
+        packed = ctypes.create_string_buffer(100)
+        assert libc.lz_compress(ctypes.c_char_p(TEXT), ctypes.c_size_t(len(TEXT)), packed, ctypes.c_size_t(100)) == -1
+        out = ctypes.create_string_buffer(100)
+        assert libc.lz_decompress(ctypes.c_char_p(b"\x0f\x05\x00"), ctypes.c_size_t(3), out, ctypes.c_size_t(100)) == -1
+
+    # Text needs fewer blocks, reads and partial writes see the plain content
+    def test_compress_write(self):
+        fs = setup(20)
+        assert libc.fs_set_compression(ctypes.byref(fs), 1) == 0
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/text"))
+        assert pwrite(fs, "/text", TEXT) == len(TEXT)
+        assert used_blocks(fs, 1) == 3
+        assert fs.s_block.contents.free_blocks == 17
+        assert readf(fs, "/text") == TEXT
+
+        expected = TEXT[:5000] + b"X" * 10 + TEXT[5010:]
+        assert pwrite(fs, "/text", b"X" * 10, 5000) == 10
+        buf = ctypes.create_string_buffer(20)
+        assert libc.fs_pread(ctypes.byref(fs), c_str("/text"), buf, ctypes.c_size_t(20), ctypes.c_size_t(4995)) == 20
+        assert buf.raw == expected[4995:5015]
+
+        iov = (ctypes.c_void_p * 24)()
+        count = libc.fs_readv(ctypes.byref(fs), c_str("/text"), iov)
+        assert count == 12
+        assert b"".join(ctypes.string_at(iov[2 * i], iov[2 * i + 1]) for i in range(count)) == expected
+
+        fs = load_image()
+        assert readf(fs, "/text") == expected
+        assert libc.fs_fsck(ctypes.byref(fs), 0, 0, None) == 0
+
+    # Data that doesn't compress is stored as plain blocks
+    def test_compress_random(self):
+        fs = setup(20)
+        assert libc.fs_set_compression(ctypes.byref(fs), 1) == 0
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/rand"))
+        data = os.urandom(6000).replace(b"\0", b"1")
+        assert pwrite(fs, "/rand", data) == len(data)
+        assert used_blocks(fs, 1) == 6
+        assert readf(load_image(), "/rand") == data
+
+    # Switching on compresses existing files, switching off stores them plainly again
+    def test_compress_switch(self, tmp_path):
+        fs = setup(20)
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/text"))
+        pwrite(fs, "/text", TEXT)
+        assert used_blocks(fs, 1) == 12
+        assert libc.fs_set_compression(ctypes.byref(fs), 1) == 0
+        assert used_blocks(fs, 1) == 3
+        assert libc.fs_export(ctypes.byref(fs), c_str("/text"), c_str(str(tmp_path / "text"))) == 0
+        assert (tmp_path / "text").read_bytes() == TEXT
+
+        fs = load_image()
+        assert libc.fs_set_compression(ctypes.byref(fs), 0) == 0
+        assert used_blocks(fs, 1) == 12
+        fs = load_image()
+        assert readf(fs, "/text") == TEXT
+        assert libc.fs_fsck(ctypes.byref(fs), 0, 0, None) == 0
+
+    # Inside a transaction the blocks of the previous state can't be reused, a
+    # write that doesn't fit fails without changing the file
+    def test_compress_txn_full(self):
+        fs = setup(5)
+        assert libc.fs_set_compression(ctypes.byref(fs), 1) == 0
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/a"))
+        data = os.urandom(5120).replace(b"\0", b"1")
+        assert pwrite(fs, "/a", data) == len(data)
+        assert fs.s_block.contents.free_blocks == 0
+
+        assert libc.fs_txn_begin(ctypes.byref(fs)) == 0
+        assert pwrite(fs, "/a", TEXT[:4096]) == -2
+        assert readf(fs, "/a") == data
+        assert libc.fs_txn_abort(ctypes.byref(fs)) == 0
+        assert libc.fs_fsck(ctypes.byref(fs), 0, 0, None) == 0
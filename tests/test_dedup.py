@@ -0,0 +1,57 @@
+import ctypes
+from wrappers import *
+
+BLOCK = b"A" * 1024
+
+
+class Test_Dedup:
+    # Writes the same full block into two files
+    # Expected outcome:
+    # * both files point to the same data block, only one block is used
+    def test_dedup_shares_blocks(self):
+        fs = setup(5)
+        assert libc.fs_set_dedup(ctypes.byref(fs), 1) == 0
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_fil(name="fil2",inode=2,parent=0,parent_block=1,fs=fs)
+        assert pwrite(fs, "/fil1", BLOCK) == 1024
+        assert pwrite(fs, "/fil2", BLOCK) == 1024
+        assert fs.inodes[1].direct_blocks[0] == fs.inodes[2].direct_blocks[0]
+        assert fs.s_block.contents.free_blocks == 4
+
+    # Writing into a shared block copies it, the other file keeps its content
+    def test_dedup_copy_on_write(self):
+        fs = setup(5)
+        libc.fs_set_dedup(ctypes.byref(fs), 1)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_fil(name="fil2",inode=2,parent=0,parent_block=1,fs=fs)
+        pwrite(fs, "/fil1", BLOCK)
+        pwrite(fs, "/fil2", BLOCK)
+        assert pwrite(fs, "/fil2", b"B") == 1
+        assert fs.inodes[1].direct_blocks[0] != fs.inodes[2].direct_blocks[0]
+        assert pread(fs, "/fil1", 1024)[1] == BLOCK
+        assert pread(fs, "/fil2", 2)[1] == b"BA"
+
+    # Removing one of the files keeps the shared block for the other one
+    def test_dedup_rm(self):
+        fs = setup(5)
+        libc.fs_set_dedup(ctypes.byref(fs), 1)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_fil(name="fil2",inode=2,parent=0,parent_block=1,fs=fs)
+        pwrite(fs, "/fil1", BLOCK)
+        pwrite(fs, "/fil2", BLOCK)
+        block = fs.inodes[1].direct_blocks[0]
+        libc.fs_rm(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","UTF-8")))
+        assert fs.free_list[block] == 0
+        libc.fs_rm(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil2","UTF-8")))
+        assert fs.free_list[block] == 1
+
+    # The setting and the sharing survive reloading the image
+    def test_dedup_persists(self):
+        fs = setup(5)
+        libc.fs_set_dedup(ctypes.byref(fs), 1)
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","UTF-8")))
+        pwrite(fs, "/fil1", BLOCK)
+        loaded = load_image()
+        libc.fs_mkfile(ctypes.byref(loaded), ctypes.c_char_p(bytes("/fil2","UTF-8")))
+        pwrite(loaded, "/fil2", BLOCK)
+        assert loaded.inodes[1].direct_blocks[0] == loaded.inodes[2].direct_blocks[0]
@@ -0,0 +1,72 @@
+import ctypes
+from wrappers import *
+
+class DefragReport(ctypes.Structure):
+    _fields_ = [
+        ("score_before", ctypes.c_uint32),
+        ("score_after", ctypes.c_uint32),
+        ("moved_blocks", ctypes.c_uint32),
+        ("pinned_blocks", ctypes.c_uint32)
+    ]
+
+
+def defrag(fs, budget=0):
+    report = DefragReport()
+    retval = libc.fs_defrag(ctypes.byref(fs), ctypes.c_uint32(budget), ctypes.byref(report))
+    return retval, report
+
+# three files written block by block in turns, so their blocks interleave
+def fragmented_fs():
+    fs = setup(20)
+    names = ["/a", "/b", "/c"]
+    for name in names:
+        libc.fs_mkfile(ctypes.byref(fs), c_str(name))
+    for i in range(4):
+        for k, name in enumerate(names):
+            pwrite(fs, name, bytes([65 + k + i]) * 1024, i * 1024)
+    return fs
+
+def contents():
+    return [b"".join(bytes([65 + k + i]) * 1024 for i in range(4)) for k in range(3)]
+
+class Test_Defrag:
+    # Every file ends up contiguous, the content is unchanged
+    def test_defrag(self):
+        fs = fragmented_fs()
+        retval, report = defrag(fs)
+        assert report.score_before == 1000
+        assert report.score_after == 0
+        assert retval == report.moved_blocks and retval > 0
+        for k in range(3):
+            blocks = fs.inodes[k + 1].direct_blocks
+            assert [blocks[i] for i in range(4)] == [blocks[0] + i for i in range(4)]
+
+        fs = load_image()
+        for k, name in enumerate(["/a", "/b", "/c"]):
+            assert readf(fs, name) == contents()[k]
+        assert libc.fs_fsck(ctypes.byref(fs), 0, 0, None) == 0
+        assert defrag(fs)[0] == 0
+
+    # A budget limits the moves of one call, the next calls continue
+    def test_defrag_budget(self):
+        fs = fragmented_fs()
+        retval, report = defrag(fs, 2)
+        assert retval == 2
+        while retval > 0:
+            retval, report = defrag(fs, 2)
+            assert retval <= 2
+        assert report.score_after == 0
+        for k, name in enumerate(["/a", "/b", "/c"]):
+            assert readf(fs, name) == contents()[k]
+
+    # Blocks shared by a clone are left in place
+    def test_defrag_shared(self):
+        fs = fragmented_fs()
+        assert libc.fs_clone(ctypes.byref(fs), c_str("/b"), c_str("/d")) == 0
+        shared = [fs.inodes[2].direct_blocks[i] for i in range(4)]
+        retval, report = defrag(fs)
+        assert report.pinned_blocks == 4
+        assert [fs.inodes[2].direct_blocks[i] for i in range(4)] == shared
+        assert readf(fs, "/a") == contents()[0]
+        assert readf(fs, "/d") == contents()[1]
+        assert libc.fs_fsck(ctypes.byref(fs), 0, 0, None) == 0
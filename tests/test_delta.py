@@ -0,0 +1,56 @@
+import ctypes
+import os
+from wrappers import *
+
+BASE_FS_FILE = "./deltabase.fs"
+DELTA_FILE = "./delta_test.delta"
+
+
+def create(path, size):
+    creator = libc.fs_create
+    creator.restype = ctypes.POINTER(FileSystem)
+    return creator(c_str(path), size).contents
+
+
+class Test_Delta:
+    # Applies a full delta and then an incremental one to a fresh image
+    # Expected outcome:
+    # * after each apply the target image equals the source image
+    # * the incremental delta only contains the changed inode and block
+    def test_delta_full_and_incremental(self):
+        fs = setup(10)
+        libc.fs_mkdir(ctypes.byref(fs), c_str("/dir"))
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/dir/fil"))
+        pwrite(fs, "/dir/fil", b"x" * 3000)
+        generation = libc.fs_delta_export(ctypes.byref(fs), 0, c_str(DELTA_FILE))
+        assert generation == 1
+
+        base = create(BASE_FS_FILE, 10)
+        assert libc.fs_delta_apply(ctypes.byref(base), c_str(DELTA_FILE)) == 0
+
+        pwrite(fs, "/dir/fil", b"y", 10)
+        assert libc.fs_delta_export(ctypes.byref(fs), generation, c_str(DELTA_FILE)) == 2
+        assert os.path.getsize(DELTA_FILE) < 2 * 1032 # one inode, one block
+        assert libc.fs_delta_apply(ctypes.byref(base), c_str(DELTA_FILE)) == 0
+
+        libc.fs_list.restype = ctypes.c_char_p
+        assert libc.fs_list(ctypes.byref(base), c_str("/dir")) == b"FIL fil\n"
+        # the images only differ in their own generation stamps after the data blocks
+        image_size = 8 + 10 + 10 * 92 + 10 * 1032
+        assert open("./mypyfiles.fs","rb").read()[:image_size] == open(BASE_FS_FILE,"rb").read()[:image_size]
+        os.remove(BASE_FS_FILE)
+        os.remove(DELTA_FILE)
+
+    # A delta that does not follow the last applied one is rejected
+    def test_delta_wrong_base(self):
+        fs = setup(5)
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/fil"))
+        generation = libc.fs_delta_export(ctypes.byref(fs), 0, c_str(DELTA_FILE))
+        pwrite(fs, "/fil", b"data")
+        libc.fs_delta_export(ctypes.byref(fs), generation, c_str(DELTA_FILE))
+
+        base = create(BASE_FS_FILE, 5)
+        assert libc.fs_delta_apply(ctypes.byref(base), c_str(DELTA_FILE)) == -2
+        assert libc.fs_delta_apply(ctypes.byref(base), c_str("./missing.delta")) == -1
+        os.remove(BASE_FS_FILE)
+        os.remove(DELTA_FILE)
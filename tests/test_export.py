@@ -0,0 +1,57 @@
+import ctypes
+import os
+import shutil
+from wrappers import *
+
+
+class Test_Exp:
+    # Exports a file spread over two unconsecutive blocks
+    # Expected behaviour:
+    #  * The operation is successful, therefor retval is 0
+    #  * the host file holds the content of both blocks in file order
+    def test_export_simple(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_data_block_with_string(block_num=4,string_data=LONG_DATA[:1024],parent_inode=1,parent_block_num=0,fs=fs)
+        fs = set_data_block_with_string(block_num=3,string_data=LONG_DATA[1024:],parent_inode=1,parent_block_num=1,fs=fs)
+        retval = libc.fs_export(ctypes.byref(fs),ctypes.c_char_p(bytes("/fil1","UTF-8")),ctypes.c_char_p(bytes(DEFAULT_TEST_FILE_NAME,"utf-8")))
+
+        assert retval == 0
+        assert read_temp_file() == LONG_DATA
+        delete_temp_file()
+
+    # An existing host file is replaced, an empty internal file leaves an empty host file
+    def test_export_empty_file(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        create_temp_file(data=SHORT_DATA)
+        retval = libc.fs_export(ctypes.byref(fs),ctypes.c_char_p(bytes("/fil1","UTF-8")),ctypes.c_char_p(bytes(DEFAULT_TEST_FILE_NAME,"utf-8")))
+
+        assert retval == 0
+        assert read_temp_file() == ""
+        delete_temp_file()
+
+    # Exporting a missing file or a directory fails
+    def test_export_failing(self):
+        fs = setup(5)
+        fs = set_dir(name="dir1",inode=1,parent=0,parent_block=0,fs=fs)
+        for path in ["/missing", "/dir1"]:
+            retval = libc.fs_export(ctypes.byref(fs),ctypes.c_char_p(bytes(path,"UTF-8")),ctypes.c_char_p(bytes(DEFAULT_TEST_FILE_NAME,"utf-8")))
+            assert retval == -1
+
+    # Exports a directory tree with several threads
+    # Expected behaviour:
+    #  * the host tree mirrors the internal one, including empty directories
+    def test_export_tree(self):
+        fs = setup(10)
+        fs = set_dir(name="dir1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_dir(name="sub",inode=2,parent=1,parent_block=0,fs=fs)
+        fs = set_dir(name="empty",inode=3,parent=1,parent_block=1,fs=fs)
+        fs = set_fil(name="fil1",inode=4,parent=2,parent_block=0,fs=fs)
+        fs = set_data_block_with_string(block_num=0,string_data=SHORT_DATA,parent_inode=4,parent_block_num=0,fs=fs)
+        retval = libc.fs_export_tree(ctypes.byref(fs),ctypes.c_char_p(bytes("/dir1","UTF-8")),ctypes.c_char_p(bytes("./export_tree","utf-8")),4)
+
+        assert retval == 0
+        assert os.path.isdir("./export_tree/empty")
+        assert read_temp_file("./export_tree/sub/fil1") == SHORT_DATA
+        shutil.rmtree("./export_tree")
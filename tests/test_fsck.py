@@ -0,0 +1,85 @@
+import ctypes
+from wrappers import *
+
+class FsckReport(ctypes.Structure):
+    _fields_ = [
+        ("bad_links", ctypes.c_uint32),
+        ("orphans", ctypes.c_uint32),
+        ("bad_block_refs", ctypes.c_uint32),
+        ("free_but_used", ctypes.c_uint32),
+        ("leaked_blocks", ctypes.c_uint32),
+        ("bad_free_count", ctypes.c_uint32)
+    ]
+
+def fsck(fs, repair, nthreads=0):
+    report = FsckReport()
+    retval = libc.fs_fsck(ctypes.byref(fs), ctypes.c_int(repair), ctypes.c_int(nthreads), ctypes.byref(report))
+    return retval, report
+
+
+class Test_Fsck:
+    # A filesystem built through the operations is consistent
+    def test_fsck_clean(self):
+        fs = setup(10)
+        libc.fs_mkdir(ctypes.byref(fs), ctypes.c_char_p(b"/dir"))
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(b"/dir/fil"))
+        pwrite(fs, "/dir/fil", b"A" * 2000)
+        retval, report = fsck(fs, 0)
+        assert retval == 0
+        assert report.leaked_blocks == 0 and report.bad_links == 0
+
+    # Leaked block, used block in the free list and a wrong free count are
+    # reported without being changed, repair rebuilds the free list
+    def test_fsck_free_list(self):
+        fs = setup(10)
+        fs = set_fil(name="fil",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_data_block_with_string(block_num=3, string_data="abc", parent_inode=1, parent_block_num=0, fs=fs)
+        fs.free_list[5] = 0
+        fs.free_list[3] = 1
+        retval, report = fsck(fs, 0)
+        assert retval == 3
+        assert report.free_but_used == 1
+        assert report.leaked_blocks == 1
+        assert report.bad_free_count == 1
+        assert fs.free_list[5] == 0
+
+        retval, report = fsck(fs, 1)
+        assert retval == 3
+        assert fs.free_list[5] == 1
+        assert fs.free_list[3] == 0
+        assert fs.s_block.contents.free_blocks == 9
+        assert fsck(fs, 0)[0] == 0
+
+    # Orphaned inodes and bad links are found by the tree walk, with any
+    # number of threads
+    def test_fsck_links(self):
+        fs = setup(10)
+        fs = set_dir(name="dir",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_fil(name="fil",inode=2,parent=0,parent_block=0,fs=fs)
+        fs.inodes[1].direct_blocks[0] = 2
+        fs.inodes[0].direct_blocks[0] = 1
+        fs.inodes[1].direct_blocks[1] = 7
+        fs.inodes[1].direct_blocks[2] = 50
+        fs = set_fil(name="orphan",inode=4,parent=0,parent_block=0,fs=fs)
+        fs.inodes[0].direct_blocks[0] = 1
+        for nthreads in (1, 3, 16):
+            retval, report = fsck(fs, 0, nthreads)
+            assert report.bad_links == 3
+            assert report.orphans == 1
+
+        retval, report = fsck(fs, 1)
+        assert fs.inodes[2].parent == 1
+        assert fs.inodes[1].direct_blocks[1] == -1
+        assert fs.inodes[1].direct_blocks[2] == -1
+        assert fs.inodes[4].n_type == NodeType.free_block
+        assert fsck(fs, 0)[0] == 0
+
+    # Block numbers out of range are dropped from the file
+    def test_fsck_bad_block_ref(self):
+        fs = setup(5)
+        fs = set_fil(name="fil",inode=1,parent=0,parent_block=0,fs=fs)
+        fs.inodes[1].direct_blocks[0] = 1000
+        retval, report = fsck(fs, 1)
+        assert report.bad_block_refs == 1
+        assert fs.inodes[1].direct_blocks[0] == -1
+        assert fsck(fs, 0)[0] == 0
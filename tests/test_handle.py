@@ -0,0 +1,76 @@
+import ctypes
+from wrappers import *
+
+FS_O_APPEND = 1
+SEEK_SET = 0
+SEEK_END = 2
+
+libc.fs_open.restype = ctypes.c_void_p
+libc.fs_seek.restype = ctypes.c_long
+
+def fs_open(fs, path, flags=0):
+    return ctypes.c_void_p(libc.fs_open(ctypes.byref(fs), ctypes.c_char_p(bytes(path,"UTF-8")), flags))
+
+def fs_write(fs, handle, data):
+    return libc.fs_write(ctypes.byref(fs), handle, ctypes.c_char_p(data), ctypes.c_size_t(len(data)))
+
+def fs_read(fs, handle, length):
+    buf = ctypes.create_string_buffer(length)
+    retval = libc.fs_read(ctypes.byref(fs), handle, buf, ctypes.c_size_t(length))
+    return retval, buf.raw[:max(retval, 0)]
+
+class Test_Handle:
+    # Appends many small records through one handle
+    # Expected outcome:
+    # * every write returns the record length
+    # * the file holds all records in order
+    def test_handle_append(self):
+        fs = setup(5)
+        fs = set_fil(name="log",inode=1,parent=0,parent_block=0,fs=fs)
+        handle = fs_open(fs, "/log", FS_O_APPEND)
+        assert handle.value is not None
+        for i in range(100):
+            assert fs_write(fs, handle, b"record%02d\n" % i) == 9
+        assert fs.inodes[1].size == 900
+        assert libc.fs_seek(ctypes.byref(fs), handle, 0, SEEK_SET) == 0
+        assert fs_read(fs, handle, 18) == (18, b"record00\nrecord01\n")
+        assert libc.fs_close(ctypes.byref(fs), handle) == 0
+
+    # Reads and writes advance the offset, seek moves it
+    def test_handle_seek(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        handle = fs_open(fs, "/fil1")
+        assert fs_write(fs, handle, b"0123456789") == 10
+        assert libc.fs_seek(ctypes.byref(fs), handle, -4, SEEK_END) == 6
+        assert fs_read(fs, handle, 10) == (4, b"6789")
+        assert fs_read(fs, handle, 10) == (0, b"")
+        assert libc.fs_seek(ctypes.byref(fs), handle, -1, SEEK_SET) == -1
+        libc.fs_close(ctypes.byref(fs), handle)
+
+    # Opening something that is not a regular file fails
+    def test_handle_open_missing(self):
+        fs = setup(5)
+        assert fs_open(fs, "/missing").value is None
+        assert fs_open(fs, "/").value is None
+
+    # Removing the file invalidates its open handles
+    def test_handle_after_rm(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        handle = fs_open(fs, "/fil1")
+        assert libc.fs_rm(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","UTF-8"))) == 0
+        assert fs_write(fs, handle, b"data") == -1
+        assert libc.fs_close(ctypes.byref(fs), handle) == 0
+
+    # Aborting a transaction invalidates the open handles
+    def test_handle_after_txn_abort(self):
+        fs = setup(5)
+        assert libc.fs_txn_begin(ctypes.byref(fs)) == 0
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/t","UTF-8")))
+        handle = fs_open(fs, "/t")
+        assert libc.fs_txn_abort(ctypes.byref(fs)) == 0
+        assert fs_write(fs, handle, b"x" * 100) == -1
+        assert fs.inodes[1].size == 0
+        assert libc.fs_fsck(ctypes.byref(fs), 0, 0, None) == 0
+        assert libc.fs_close(ctypes.byref(fs), handle) == 0
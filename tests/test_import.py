@@ -1,4 +1,6 @@
 import ctypes
+import os
+import shutil
 from wrappers import *
 
 
@@ -45,4 +47,57 @@ class Test_Imp:
         delete_temp_file()
 
 
-    # TODO: add test for failing operations
+    # Imports into a path that does not exist yet
+    # Expected behaviour:
+    #  * the file is created in the given directory and filled
+    def test_import_creates_file(self):
+        fs = setup(5)
+        filename = create_temp_file(data=SHORT_DATA)
+        retval = libc.fs_import(ctypes.byref(fs),ctypes.c_char_p(bytes("/new","UTF-8")),ctypes.c_char_p(bytes(filename,"utf-8")))
+
+        assert retval == 0
+        assert fs.inodes[1].name.decode("utf-8") == "new"
+        assert fs.inodes[0].direct_blocks[0] == 1
+        assert fs.inodes[1].size == len(SHORT_DATA)
+        delete_temp_file()
+
+    # Failing imports leave the filesystem alone
+    #  * a missing host file returns -1
+    #  * a file that needs more blocks than are free returns -2
+    def test_import_failing(self):
+        fs = setup(2)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        retval = libc.fs_import(ctypes.byref(fs),ctypes.c_char_p(bytes("/fil1","UTF-8")),ctypes.c_char_p(bytes("./missing_file","utf-8")))
+        assert retval == -1
+
+        filename = create_temp_file(data=LONG_DATA * 3)
+        retval = libc.fs_import(ctypes.byref(fs),ctypes.c_char_p(bytes("/fil1","UTF-8")),ctypes.c_char_p(bytes(filename,"utf-8")))
+        assert retval == -2
+        assert fs.inodes[1].size == 0
+        assert fs.free_list[0] == 1
+        delete_temp_file()
+
+
+    # Imports a host directory tree with several threads
+    # Expected behaviour:
+    #  * all directories and files are created below the target directory
+    #  * every file holds the content of its host file
+    def test_import_tree(self):
+        fs = setup(20)
+        fs = set_dir(name="dst",inode=1,parent=0,parent_block=0,fs=fs)
+        os.makedirs("./import_tree/sub")
+        create_temp_file(data=SHORT_DATA, filename="./import_tree/a")
+        create_temp_file(data=LONG_DATA, filename="./import_tree/sub/b")
+        retval = libc.fs_import_tree(ctypes.byref(fs),ctypes.c_char_p(bytes("/dst","UTF-8")),ctypes.c_char_p(bytes("./import_tree","utf-8")),4)
+        shutil.rmtree("./import_tree")
+
+        assert retval == 0
+        libc.fs_readf.restype = ctypes.c_char_p
+        size = ctypes.c_int(0)
+        assert libc.fs_readf(ctypes.byref(fs),ctypes.c_char_p(bytes("/dst/a","UTF-8")),ctypes.byref(size)).decode("utf-8") == SHORT_DATA
+        assert libc.fs_readf(ctypes.byref(fs),ctypes.c_char_p(bytes("/dst/sub/b","UTF-8")),ctypes.byref(size)).decode("utf-8") == LONG_DATA
+
+    def test_import_tree_missing_dir(self):
+        fs = setup(5)
+        retval = libc.fs_import_tree(ctypes.byref(fs),ctypes.c_char_p(bytes("/","UTF-8")),ctypes.c_char_p(bytes("./missing_dir","utf-8")),4)
+        assert retval == -1
@@ -35,3 +35,27 @@ class Test_List:
         libc.fs_list.restype = ctypes.c_char_p
         retval = libc.fs_list(ctypes.byref(fs), ctypes.c_char_p(bytes("/","UTF-8")))
         assert retval.decode("utf-8") == "DIR Dir1\nDIR Dir2\nDIR Dir3\nFIL Fil1\nFIL Fil2\n"
+
+    # Lists into a caller buffer that is first too small, then large enough
+    # Expected outcome:
+    # * the required length is reported and the small buffer stays untouched
+    # * the listing ends up zero-terminated in the large buffer
+    def test_list_into(self):
+        fs = setup(10)
+        fs = set_dir(name="Dir1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_fil(name="Fil1",inode=2,parent=0,parent_block=1,fs=fs)
+
+        small = ctypes.create_string_buffer(8)
+        retval = libc.fs_list_into(ctypes.byref(fs), ctypes.c_char_p(bytes("/","UTF-8")), small, ctypes.c_size_t(8))
+        assert retval == 18
+        assert small.raw == b"\0" * 8
+
+        large = ctypes.create_string_buffer(64)
+        retval = libc.fs_list_into(ctypes.byref(fs), ctypes.c_char_p(bytes("/","UTF-8")), large, ctypes.c_size_t(64))
+        assert retval == 18
+        assert large.value.decode("utf-8") == "DIR Dir1\nFIL Fil1\n"
+
+    def test_list_into_nonexisting_dir(self):
+        fs = setup(5)
+        buf = ctypes.create_string_buffer(8)
+        assert libc.fs_list_into(ctypes.byref(fs), ctypes.c_char_p(bytes("/missing","UTF-8")), buf, ctypes.c_size_t(8)) == -1
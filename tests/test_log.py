@@ -0,0 +1,61 @@
+import ctypes
+from wrappers import *
+
+
+# /keep has blocks 0 and 1, ten removed files had the rest of the first segment
+def log_fs():
+    fs = setup(70)
+    assert libc.fs_set_log(ctypes.byref(fs), 1) == 0
+    libc.fs_mkfile(ctypes.byref(fs), c_str("/keep"))
+    pwrite(fs, "/keep", b"K" * 2048)
+    for i in range(10):
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/tmp%d" % i))
+        pwrite(fs, "/tmp%d" % i, b"T" * 3072)
+    for i in range(10):
+        libc.fs_rm(ctypes.byref(fs), c_str("/tmp%d" % i))
+    return fs
+
+class Test_Log:
+    # Overwrites go to the head of the log and free the old block, also after loading
+    def test_log_append(self):
+        fs = setup(20)
+        assert libc.fs_set_log(ctypes.byref(fs), 1) == 0
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/fil"))
+        pwrite(fs, "/fil", b"A" * 1024)
+        assert fs.inodes[1].direct_blocks[0] == 0
+        for i in range(3):
+            pwrite(fs, "/fil", bytes([66 + i]), 10)
+            assert fs.inodes[1].direct_blocks[0] == i + 1
+            assert fs.free_list[i] == 1
+        assert fs.s_block.contents.free_blocks == 19
+
+        fs = load_image()
+        assert readf(fs, "/fil") == b"A" * 10 + b"D" + b"A" * 1013
+        pwrite(fs, "/fil", b"E", 10)
+        assert fs.inodes[1].direct_blocks[0] == 4
+        assert libc.fs_fsck(ctypes.byref(fs), 0, 0, None) == 0
+
+    # The cleaner empties a segment with few live blocks by moving them to the head
+    def test_log_clean(self):
+        fs = log_fs()
+        assert libc.fs_log_clean(ctypes.byref(fs), 0) == 2
+        assert [fs.free_list[i] for i in range(32)] == [1] * 32
+        assert [fs.inodes[1].direct_blocks[i] for i in range(2)] == [32, 33]
+        assert libc.fs_log_clean(ctypes.byref(fs), 0) == 0
+
+        fs = load_image()
+        assert readf(fs, "/keep") == b"K" * 2048
+        assert libc.fs_fsck(ctypes.byref(fs), 0, 0, None) == 0
+
+    # A budget limits the moves, shared blocks pin their segment, no cleaning without the log
+    def test_log_clean_limits(self):
+        fs = log_fs()
+        assert libc.fs_log_clean(ctypes.byref(fs), 1) == 1
+        assert libc.fs_log_clean(ctypes.byref(fs), 1) == 1
+        assert libc.fs_log_clean(ctypes.byref(fs), 1) == 0
+
+        fs = log_fs()
+        assert libc.fs_clone(ctypes.byref(fs), c_str("/keep"), c_str("/copy")) == 0
+        assert libc.fs_log_clean(ctypes.byref(fs), 0) == 0
+        assert libc.fs_set_log(ctypes.byref(fs), 0) == 0
+        assert libc.fs_log_clean(ctypes.byref(fs), 0) == -1
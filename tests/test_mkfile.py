@@ -68,3 +68,29 @@ class Test_Mkfile:
             assert fs.inodes[i].name.decode("utf-8") =="" 
             assert fs.inodes[i].n_type == 3 # meaning it is marked as free block
 
+
+    # New inodes are placed in the group of 64 inodes of their parent directory
+    # * inodes 1-64 are used by /d0-/d5 and their files, /d0/sub gets inode 65
+    # * /d1/f0 is removed, freeing inode 18
+    # Expected outcome
+    # * a file in /d0/sub gets inode 66 next to its parent, not the lowest free one
+    # * a file in /d2 (inode 3) gets inode 18
+    def test_mkfile_near_parent(self):
+        fs = setup(200)
+        for d in range(6):
+            libc.fs_mkdir(ctypes.byref(fs), ctypes.c_char_p(bytes("/d%d" % d,"UTF-8")))
+        for d in range(5):
+            for f in range(11):
+                libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/d%d/f%d" % (d, f),"UTF-8")))
+        for f in range(3):
+            libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/d5/f%d" % f,"UTF-8")))
+        libc.fs_mkdir(ctypes.byref(fs), ctypes.c_char_p(bytes("/d0/sub","UTF-8")))
+        assert fs.inodes[65].name.decode("utf-8") == "sub"
+        assert fs.inodes[18].name.decode("utf-8") == "f0"
+        libc.fs_rm(ctypes.byref(fs), ctypes.c_char_p(bytes("/d1/f0","UTF-8")))
+
+        assert libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/d0/sub/new","UTF-8"))) == 0
+        assert fs.inodes[66].name.decode("utf-8") == "new"
+        assert libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/d2/new","UTF-8"))) == 0
+        assert fs.inodes[18].name.decode("utf-8") == "new"
+        assert fs.inodes[18].parent == 3
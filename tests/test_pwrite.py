@@ -0,0 +1,72 @@
+import ctypes
+from wrappers import *
+
+
+class Test_Pwrite:
+    # Writes data containing zero bytes
+    # Expected outcome:
+    # * all bytes are written and read back, nothing is cut off at the first zero byte
+    def test_pwrite_binary(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        data = b"abc\0def\0\0ghi"
+        assert pwrite(fs, "/fil1", data, 0) == len(data)
+        assert fs.inodes[1].size == len(data)
+        assert pread(fs, "/fil1", 100, 0) == (len(data), data)
+
+    # Overwrites a range in the middle of a file spanning three blocks
+    # Expected outcome:
+    # * only the addressed range changes
+    # * no block is added
+    def test_pwrite_overwrite_range(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        data = bytes(LONG_DATA * 3, "utf-8")[:3000]
+        assert pwrite(fs, "/fil1", data, 0) == 3000
+        assert pwrite(fs, "/fil1", b"XXXX", 1022) == 4
+        assert fs.inodes[1].size == 3000
+        assert fs.inodes[1].direct_blocks[3] == -1
+        assert pread(fs, "/fil1", 3000, 0)[1] == data[:1022] + b"XXXX" + data[1026:]
+
+    # Writes behind the end of a file
+    # Expected outcome:
+    # * only the block at the written offset is allocated
+    # * the gap reads as zeros
+    def test_pwrite_sparse(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        assert pwrite(fs, "/fil1", b"end", 3 * BLOCK_SIZE + 10) == 3
+        assert fs.inodes[1].direct_blocks[0] == -1
+        assert fs.inodes[1].direct_blocks[3] == 0
+        assert fs.inodes[1].size == 3 * BLOCK_SIZE + 13
+        assert pread(fs, "/fil1", 20, 3 * BLOCK_SIZE) == (13, b"\0" * 10 + b"end")
+
+    # A range that doesn't fit into the direct blocks is rejected
+    def test_pwrite_too_large(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        assert pwrite(fs, "/fil1", b"x", DIRECT_BLOCKS_COUNT * BLOCK_SIZE) == -2
+        assert pwrite(fs, "/missing", b"x", 0) == -1
+
+    # The changed blocks are written to the image, which reads back the same data
+    def test_pwrite_persisted(self):
+        fs = setup(5)
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","UTF-8")))
+        assert pwrite(fs, "/fil1", b"hello\0world", 1500) == 11
+        assert pread(load_image(), "/fil1", 11, 1500) == (11, b"hello\0world")
+
+    # Blocks of a removed file are used again by a sparse write
+    # * /old fills blocks 0 and 1 with 'X' and is removed
+    # * /new gets a byte at 5000 and 10 bytes at 1000, the latter in a reused block
+    # Expected outcome:
+    # * the rest of the reused block reads as zeros, not as the content of /old
+    def test_pwrite_reused_block(self):
+        fs = setup(10)
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(b"/old"))
+        assert pwrite(fs, "/old", b"X" * 2048, 0) == 2048
+        libc.fs_rm(ctypes.byref(fs), ctypes.c_char_p(b"/old"))
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(b"/new"))
+        assert pwrite(fs, "/new", b"Z", 5000) == 1
+        assert pwrite(fs, "/new", b"A" * 10, 1000) == 10
+        assert pread(fs, "/new", 100, 1010) == (100, b"\0" * 100)
+        assert pread(load_image(), "/new", 5001, 0) == (5001, b"\0" * 1000 + b"A" * 10 + b"\0" * 3990 + b"Z")
@@ -3,6 +3,12 @@ from wrappers import *
 
 libc.fs_readf.restype = ctypes.c_char_p
 
+class Iovec(ctypes.Structure):
+    _fields_ = [
+        ("iov_base", ctypes.c_void_p),
+        ("iov_len", ctypes.c_size_t)
+    ]
+
 class Test_Readf:
     # Sets up a single file with some short data then uses the readf-function to retrieve tat data
     # Expected outcome:
@@ -61,3 +67,50 @@ class Test_Readf:
         assert file_length.value == 0
         assert retval == None
 
+
+    # Reads into a reused buffer that is first too small, then large enough
+    # Expected outcome:
+    #  * the required size is reported and the small buffer stays untouched
+    #  * the content ends up in the large buffer
+    def test_readf_into(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_data_block_with_string(block_num=0,string_data=LONG_DATA[:1024],parent_inode=1,parent_block_num=0,fs=fs)
+        fs = set_data_block_with_string(block_num=1,string_data=LONG_DATA[1024:],parent_inode=1,parent_block_num=1,fs=fs)
+
+        small = ctypes.create_string_buffer(16)
+        retval = libc.fs_readf_into(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","utf-8")), small, ctypes.c_size_t(16))
+        assert retval == len(LONG_DATA)
+        assert small.raw == b"\0" * 16
+
+        large = ctypes.create_string_buffer(4096)
+        retval = libc.fs_readf_into(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","utf-8")), large, ctypes.c_size_t(4096))
+        assert retval == len(LONG_DATA)
+        assert large.raw[:retval].decode("utf-8") == LONG_DATA
+
+    def test_readf_into_nonexisting_file(self):
+        fs = setup(5)
+        buf = ctypes.create_string_buffer(16)
+        assert libc.fs_readf_into(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","utf-8")), buf, ctypes.c_size_t(16)) == -1
+
+    # Reads a file spread over two blocks as spans
+    # Expected outcome:
+    #  * one span per block, in file order, pointing at the block data
+    def test_readv_spans(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_data_block_with_string(block_num=4,string_data=LONG_DATA[:1024],parent_inode=1,parent_block_num=0,fs=fs)
+        fs = set_data_block_with_string(block_num=3,string_data=LONG_DATA[1024:],parent_inode=1,parent_block_num=1,fs=fs)
+
+        spans = (Iovec * 12)()
+        retval = libc.fs_readv(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","utf-8")), spans)
+
+        assert retval == 2
+        assert [span.iov_len for span in spans[:2]] == [1024, len(LONG_DATA) - 1024]
+        content = b"".join(ctypes.string_at(span.iov_base, span.iov_len) for span in spans[:2])
+        assert content.decode("utf-8") == LONG_DATA
+
+    def test_readv_nonexisting_file(self):
+        fs = setup(5)
+        spans = (Iovec * 12)()
+        assert libc.fs_readv(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","utf-8")), spans) == -1
@@ -85,3 +85,21 @@ class Test_Rem:
         assert fs.inodes[0].direct_blocks[1] == -1
         assert fs.inodes[0].direct_blocks[2] == -1
 
+
+    def test_rem_nonexisting_and_root(self):
+        fs = setup(5)
+        fs = set_dir(name="newDir",inode=1,parent=0,parent_block=0,fs=fs)
+        assert libc.fs_rm(ctypes.byref(fs), ctypes.c_char_p(bytes("/missing","UTF-8"))) == -1
+        assert libc.fs_rm(ctypes.byref(fs), ctypes.c_char_p(bytes("/","UTF-8"))) == -1
+        assert fs.inodes[0].direct_blocks[0] == 1
+
+    def test_rem_trailing_slash(self):
+        fs = setup(5)
+        fs = set_dir(name="newDir",inode=1,parent=0,parent_block=0,fs=fs)
+        retval = libc.fs_rm(ctypes.byref(fs), ctypes.c_char_p(bytes("/newDir/","UTF-8")))
+        assert retval == 0
+        assert fs.inodes[1].n_type == 3
+        assert fs.inodes[0].direct_blocks[0] == -1
+        assert libc.fs_mkdir(ctypes.byref(fs), ctypes.c_char_p(bytes("/z","UTF-8"))) == 0
+        libc.fs_list.restype = ctypes.c_char_p
+        assert libc.fs_list(ctypes.byref(fs), ctypes.c_char_p(bytes("/","UTF-8"))) == b"DIR z\n"
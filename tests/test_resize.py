@@ -0,0 +1,120 @@
+import ctypes
+import os
+from wrappers import *
+
+FS_FILE = "./mypyfiles.fs"
+
+
+# the size of an image without trailer, capacity is the room in its tables
+# (0 in the plain layout of fs_create)
+def image_size(num_blocks, capacity=0):
+    if capacity == 0:
+        return 8 + num_blocks * (1 + 92 + 1032)
+    return 12 + capacity * (1 + 92) + num_blocks * 1032
+
+class Test_Resize:
+    # Growing adds free blocks and inodes, the files stay as they are
+    def test_resize_grow(self):
+        fs = setup(5)
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/fil"))
+        pwrite(fs, "/fil", b"A" * 3000)
+        assert libc.fs_resize(ctypes.byref(fs), 12) == 0
+        assert fs.s_block.contents.num_blocks == 12
+        assert fs.s_block.contents.free_blocks == 9
+        assert os.path.getsize(FS_FILE) == image_size(12, 24)
+
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/fil2"))
+        assert pwrite(fs, "/fil2", b"B" * 8000) == 8000
+        fs = load_image()
+        assert readf(fs, "/fil") == b"A" * 3000
+        assert readf(fs, "/fil2") == b"B" * 8000
+        assert libc.fs_fsck(ctypes.byref(fs), 0, 0, None) == 0
+
+    # Shrinking moves the blocks and inodes living in the cut off tail
+    # Expected outcome:
+    # * the content, the directory tree and an open handle survive
+    # * the image has the new size and is consistent
+    def test_resize_shrink(self):
+        fs = setup(20)
+        for i in range(6):
+            libc.fs_mkfile(ctypes.byref(fs), c_str("/f%d" % i))
+            pwrite(fs, "/f%d" % i, bytes([65 + i]) * 2048)
+        libc.fs_mkdir(ctypes.byref(fs), c_str("/dir"))
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/dir/last"))
+        pwrite(fs, "/dir/last", b"Z" * 1500)
+        libc.fs_open.restype = ctypes.c_void_p
+        handle = libc.fs_open(ctypes.byref(fs), c_str("/dir/last"), 0)
+        for i in range(5):
+            libc.fs_rm(ctypes.byref(fs), c_str("/f%d" % i))
+
+        assert libc.fs_resize(ctypes.byref(fs), 6) == 0
+        assert fs.s_block.contents.num_blocks == 6
+        assert fs.s_block.contents.free_blocks == 2
+        assert os.path.getsize(FS_FILE) == image_size(6, 20)
+        buf = ctypes.create_string_buffer(10)
+        assert libc.fs_read(ctypes.byref(fs), ctypes.c_void_p(handle), buf, ctypes.c_size_t(10)) == 10
+        assert buf.raw == b"Z" * 10
+
+        fs = load_image()
+        assert readf(fs, "/f5") == b"F" * 2048
+        assert readf(fs, "/dir/last") == b"Z" * 1500
+        assert libc.fs_fsck(ctypes.byref(fs), 0, 0, None) == 0
+
+    # A size too small for the data is rejected without changing anything
+    def test_resize_too_small(self):
+        fs = setup(10)
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/fil"))
+        pwrite(fs, "/fil", b"A" * 5000)
+        assert libc.fs_resize(ctypes.byref(fs), 4) == -2
+        assert fs.s_block.contents.num_blocks == 10
+        assert os.path.getsize(FS_FILE) == image_size(10)
+
+    # Snapshots keep their files when their blocks move
+    def test_resize_shrink_snapshot(self):
+        fs = setup(12)
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/a"))
+        pwrite(fs, "/a", b"x" * 100)
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/b"))
+        pwrite(fs, "/b", b"y" * 5000)
+        assert libc.fs_snapshot_create(ctypes.byref(fs), c_str("snap")) == 0
+        libc.fs_rm(ctypes.byref(fs), c_str("/a"))
+        assert libc.fs_resize(ctypes.byref(fs), 7) == 0
+
+        fs = load_image()
+        file_size = ctypes.c_int()
+        libc.fs_snapshot_readf.restype = ctypes.c_char_p
+        assert libc.fs_snapshot_readf(ctypes.byref(fs), c_str("snap"), c_str("/a"), ctypes.byref(file_size)) == b"x" * 100
+        assert readf(fs, "/b") == b"y" * 5000
+        assert libc.fs_fsck(ctypes.byref(fs), 0, 0, None) == 0
+
+    # Once the tables have room, the image grows and shrinks in place
+    # Expected outcome:
+    # * the first resize writes a new image, the following ones change the file itself
+    # * growing appends empty blocks, shrinking cuts the file after the last block
+    def test_resize_in_place(self):
+        fs = setup(5)
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/fil"))
+        pwrite(fs, "/fil", b"A" * 3000)
+        assert libc.fs_resize(ctypes.byref(fs), 8) == 0
+        image = os.stat(FS_FILE).st_ino
+
+        assert libc.fs_resize(ctypes.byref(fs), 16) == 0
+        assert os.stat(FS_FILE).st_ino == image
+        assert os.path.getsize(FS_FILE) == image_size(16, 16)
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/fil2"))
+        assert pwrite(fs, "/fil2", b"B" * 12000) == 12000
+        libc.fs_rm(ctypes.byref(fs), c_str("/fil"))
+
+        assert libc.fs_resize(ctypes.byref(fs), 13) == 0
+        assert os.stat(FS_FILE).st_ino == image
+        assert os.path.getsize(FS_FILE) == image_size(13, 16)
+        fs = load_image()
+        assert fs.s_block.contents.num_blocks == 13
+        assert readf(fs, "/fil2") == b"B" * 12000
+        assert libc.fs_fsck(ctypes.byref(fs), 0, 0, None) == 0
+
+        # past the room in the tables the image is written anew
+        assert libc.fs_resize(ctypes.byref(fs), 20) == 0
+        assert os.stat(FS_FILE).st_ino != image
+        assert os.path.getsize(FS_FILE) == image_size(20, 40)
+        assert readf(load_image(), "/fil2") == b"B" * 12000
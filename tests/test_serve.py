@@ -0,0 +1,117 @@
+import ctypes
+import os
+import socket
+import struct
+import subprocess
+import time
+from wrappers import *
+
+SERVE_FS_FILE = "./servefiles.fs"
+SERVE_SOCKET = "./serve_test.sock"
+
+FS_OP_MKDIR = 1
+FS_OP_MKFILE = 2
+FS_OP_LIST = 3
+FS_OP_DUMP = 9
+FS_PROTO_BAD_REQUEST = -100
+
+
+def request(req_id, op, args=(), data=b""):
+    payload = b"".join(bytes(a, "utf-8") + b"\0" for a in args) + data
+    return struct.pack("=IIHH", len(payload), req_id, op, len(args)) + payload
+
+
+def response(sock):
+    header = b""
+    while len(header) < 12:
+        header += sock.recv(12 - len(header))
+    length, req_id, status = struct.unpack("=IIi", header)
+    payload = b""
+    while len(payload) < length:
+        payload += sock.recv(length - len(payload))
+    return req_id, status, payload
+
+
+# the socket file exists from bind on, connecting works once the server listens
+def connect():
+    for _ in range(100):
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        try:
+            sock.connect(SERVE_SOCKET)
+            return sock
+        except (FileNotFoundError, ConnectionRefusedError):
+            sock.close()
+            time.sleep(0.01)
+    raise TimeoutError(SERVE_SOCKET)
+
+
+class Test_Serve:
+    def start(self):
+        libc.fs_create(ctypes.c_char_p(bytes(SERVE_FS_FILE, "UTF-8")), 10)
+        server = subprocess.Popen(["./build/ha2", "--serve", SERVE_FS_FILE, SERVE_SOCKET], stderr=subprocess.DEVNULL)
+        return server, connect()
+
+    def stop(self, server, sock):
+        sock.close()
+        server.terminate()
+        server.wait()
+        os.remove(SERVE_FS_FILE)
+
+    # Sends several requests at once and only then reads the responses
+    # Expected outcome:
+    # * every request is answered, in the order it was sent
+    # * the listing reflects the requests executed before it
+    def test_serve_pipelined(self):
+        server, sock = self.start()
+        sock.sendall(request(1, FS_OP_MKDIR, ["/dir"]) +
+                     request(2, FS_OP_MKFILE, ["/fil"]) +
+                     request(3, FS_OP_LIST, ["/"]))
+        assert response(sock) == (1, 0, b"")
+        assert response(sock) == (2, 0, b"")
+        assert response(sock) == (3, 0, b"DIR dir\nFIL fil\n")
+        self.stop(server, sock)
+
+    # A request with an unknown opcode is rejected without closing the connection
+    def test_serve_bad_request(self):
+        server, sock = self.start()
+        sock.sendall(request(7, 4711) + request(8, FS_OP_LIST, ["/"]))
+        assert response(sock) == (7, FS_PROTO_BAD_REQUEST, b"")
+        assert response(sock) == (8, 0, b"")
+        self.stop(server, sock)
+
+    # Changes made through the server end up in the served image
+    def test_serve_persists(self):
+        server, sock = self.start()
+        sock.sendall(request(1, FS_OP_MKDIR, ["/dir"]) + request(2, FS_OP_DUMP))
+        response(sock)
+        assert response(sock) == (2, 0, b"")
+
+        loader = libc.fs_load
+        loader.restype = ctypes.POINTER(FileSystem)
+        fs = loader(ctypes.c_char_p(bytes(SERVE_FS_FILE, "UTF-8"))).contents
+        assert fs.inodes[1].name.decode("utf-8") == "dir"
+        assert fs.inodes[0].direct_blocks[0] == 1
+        self.stop(server, sock)
+
+    # A second server on the same socket
+    # Expected outcome:
+    # * it fails, the socket stays with the running server
+    def test_serve_socket_in_use(self):
+        server, sock = self.start()
+        second = subprocess.run(["./build/ha2", "--serve", SERVE_FS_FILE, SERVE_SOCKET], stderr=subprocess.DEVNULL, timeout=5)
+        assert second.returncode != 0
+        other = connect()
+        other.sendall(request(1, FS_OP_LIST, ["/"]))
+        assert response(other) == (1, 0, b"")
+        other.close()
+        self.stop(server, sock)
+
+    # A socket left behind by a server that is gone is replaced
+    def test_serve_stale_socket(self):
+        stale = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        stale.bind(SERVE_SOCKET)
+        stale.close()
+        server, sock = self.start()
+        sock.sendall(request(1, FS_OP_LIST, ["/"]))
+        assert response(sock) == (1, 0, b"")
+        self.stop(server, sock)
@@ -0,0 +1,66 @@
+import ctypes
+from wrappers import *
+
+libc.fs_snapshot_readf.restype = ctypes.c_char_p
+libc.fs_snapshot_list.restype = ctypes.c_char_p
+
+
+def snapshot_readf(fs, name, path):
+    size = ctypes.c_int(0)
+    return libc.fs_snapshot_readf(ctypes.byref(fs), c_str(name), c_str(path), ctypes.byref(size))
+
+class Test_Snapshot:
+    # Changes a file after a snapshot
+    # Expected outcome:
+    # * the snapshot still reads the old content, the file the new one
+    # * only the changed block is copied
+    def test_snapshot_copy_on_write(self):
+        fs = setup(5)
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/fil1"))
+        pwrite(fs, "/fil1", b"old")
+        assert libc.fs_snapshot_create(ctypes.byref(fs), c_str("before")) == 0
+        free_blocks = fs.s_block.contents.free_blocks
+
+        pwrite(fs, "/fil1", b"new")
+        assert snapshot_readf(fs, "before", "/fil1") == b"old"
+        assert fs.s_block.contents.free_blocks == free_blocks - 1
+
+    # Restoring brings back removed files, deleting frees the copied blocks
+    def test_snapshot_restore_and_delete(self):
+        fs = setup(5)
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/fil1"))
+        pwrite(fs, "/fil1", b"data")
+        libc.fs_snapshot_create(ctypes.byref(fs), c_str("snap"))
+        libc.fs_rm(ctypes.byref(fs), c_str("/fil1"))
+        libc.fs_mkdir(ctypes.byref(fs), c_str("/dir"))
+        assert fs.s_block.contents.free_blocks == 4
+
+        assert libc.fs_snapshot_restore(ctypes.byref(fs), c_str("snap")) == 0
+        libc.fs_list.restype = ctypes.c_char_p
+        assert libc.fs_list(ctypes.byref(fs), c_str("/")) == b"FIL fil1\n"
+
+        assert libc.fs_snapshot_delete(ctypes.byref(fs), c_str("snap")) == 0
+        libc.fs_rm(ctypes.byref(fs), c_str("/fil1"))
+        assert fs.s_block.contents.free_blocks == 5
+
+    # Snapshots are stored in the image and listed by age
+    def test_snapshot_persists(self):
+        fs = setup(5)
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/fil1"))
+        pwrite(fs, "/fil1", b"first")
+        libc.fs_snapshot_create(ctypes.byref(fs), c_str("one"))
+        pwrite(fs, "/fil1", b"second")
+        libc.fs_snapshot_create(ctypes.byref(fs), c_str("two"))
+
+        loaded = load_image()
+        assert libc.fs_snapshot_list(ctypes.byref(loaded)) == b"one\ntwo\n"
+        assert snapshot_readf(loaded, "one", "/fil1") == b"first"
+        assert snapshot_readf(loaded, "two", "/fil1") == b"second"
+
+    def test_snapshot_failing(self):
+        fs = setup(5)
+        assert libc.fs_snapshot_create(ctypes.byref(fs), c_str("snap")) == 0
+        assert libc.fs_snapshot_create(ctypes.byref(fs), c_str("snap")) == -2
+        assert libc.fs_snapshot_create(ctypes.byref(fs), c_str("")) == -1
+        assert libc.fs_snapshot_restore(ctypes.byref(fs), c_str("missing")) == -1
+        assert libc.fs_snapshot_delete(ctypes.byref(fs), c_str("missing")) == -1
@@ -0,0 +1,53 @@
+import ctypes
+import os
+import shutil
+from wrappers import *
+
+SYNC_DIR = "./sync_tree"
+
+
+class Test_Sync:
+    # Syncs a host tree, changes one block, removes a file and syncs again
+    # Expected outcome:
+    # * the first sync creates everything
+    # * the second sync only rewrites the changed block, the unchanged block keeps its number
+    # * the removed file is removed internally as well
+    def test_sync_changes(self):
+        fs = setup(20)
+        os.makedirs(SYNC_DIR + "/sub")
+        create_temp_file(data=LONG_DATA, filename=SYNC_DIR + "/a")
+        create_temp_file(data=SHORT_DATA, filename=SYNC_DIR + "/sub/b")
+        assert libc.fs_sync_dir(ctypes.byref(fs), c_str("/"), c_str(SYNC_DIR)) == 0
+        assert readf(fs, "/a").decode("utf-8") == LONG_DATA
+        file_a = [i for i in range(20) if fs.inodes[i].name == b"a"][0]
+        first_block = fs.inodes[file_a].direct_blocks[0]
+        second_block = fs.inodes[file_a].direct_blocks[1]
+
+        changed = LONG_DATA[:1024] + LONG_DATA[1024:].upper()
+        create_temp_file(data=changed, filename=SYNC_DIR + "/a")
+        os.remove(SYNC_DIR + "/sub/b")
+        assert libc.fs_sync_dir(ctypes.byref(fs), c_str("/"), c_str(SYNC_DIR)) == 0
+        shutil.rmtree(SYNC_DIR)
+
+        assert readf(fs, "/a").decode("utf-8") == changed
+        assert fs.inodes[file_a].direct_blocks[0] == first_block
+        assert fs.inodes[file_a].direct_blocks[1] == second_block
+        libc.fs_list.restype = ctypes.c_char_p
+        assert libc.fs_list(ctypes.byref(fs), c_str("/sub")) == b""
+
+    # A shorter host file cuts the internal one and frees its tail blocks
+    def test_sync_shrinks(self):
+        fs = setup(5)
+        os.makedirs(SYNC_DIR)
+        create_temp_file(data=LONG_DATA, filename=SYNC_DIR + "/a")
+        libc.fs_sync_dir(ctypes.byref(fs), c_str("/"), c_str(SYNC_DIR))
+        create_temp_file(data=SHORT_DATA, filename=SYNC_DIR + "/a")
+        assert libc.fs_sync_dir(ctypes.byref(fs), c_str("/"), c_str(SYNC_DIR)) == 0
+        shutil.rmtree(SYNC_DIR)
+
+        assert readf(fs, "/a").decode("utf-8") == SHORT_DATA
+        assert fs.s_block.contents.free_blocks == 4
+
+    def test_sync_missing_dir(self):
+        fs = setup(5)
+        assert libc.fs_sync_dir(ctypes.byref(fs), c_str("/"), c_str("./missing_dir")) == -1
@@ -0,0 +1,88 @@
+import ctypes
+from wrappers import *
+
+
+class Test_Txn:
+    # Creates a directory and a file inside a transaction, then aborts it
+    # Expected outcome:
+    # * every inode is back in its previous state
+    # * nothing was written to the image
+    def test_txn_abort_create(self):
+        fs = setup(5)
+        assert libc.fs_txn_begin(ctypes.byref(fs)) == 0
+        libc.fs_mkdir(ctypes.byref(fs), ctypes.c_char_p(bytes("/dir","UTF-8")))
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/dir/fil","UTF-8")))
+        assert fs.inodes[2].n_type == 1
+        assert libc.fs_txn_abort(ctypes.byref(fs)) == 0
+        assert fs.inodes[0].direct_blocks[0] == -1
+        assert fs.inodes[1].n_type == 3
+        assert fs.inodes[2].n_type == 3
+        assert load_image().inodes[1].n_type == 3
+
+    # Writes into a file that already holds data, then aborts
+    # Expected outcome:
+    # * the block of the previous state was copied instead of modified
+    # * after the abort the file points to its old, unchanged block again
+    def test_txn_abort_write(self):
+        fs = setup(5)
+        fs = set_fil(name="fil1",inode=1,parent=0,parent_block=0,fs=fs)
+        fs = set_data_block_with_string(block_num=0,string_data="I am old",parent_inode=1,parent_block_num=0,fs=fs)
+        assert libc.fs_txn_begin(ctypes.byref(fs)) == 0
+        libc.fs_writef(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil1","UTF-8")), ctypes.c_char_p(bytes("new","UTF-8")))
+        assert fs.inodes[1].direct_blocks[0] != 0
+        assert libc.fs_txn_abort(ctypes.byref(fs)) == 0
+        assert fs.inodes[1].direct_blocks[0] == 0
+        assert fs.free_list[0] == 0
+        assert fs.free_list[1] == 1
+        outstring = ctypes.c_char_p(ctypes.addressof(fs.data_blocks[0].block)).value
+        assert outstring.decode("utf-8") == "I am old"
+
+    # Changes of a committed transaction are in the image
+    def test_txn_commit(self):
+        fs = setup(5)
+        assert libc.fs_txn_begin(ctypes.byref(fs)) == 0
+        libc.fs_mkdir(ctypes.byref(fs), ctypes.c_char_p(bytes("/dir","UTF-8")))
+        assert load_image().inodes[1].n_type == 3
+        assert libc.fs_txn_commit(ctypes.byref(fs)) == 0
+        assert load_image().inodes[1].n_type == 2
+        assert fs.inodes[1].n_type == 2
+
+    # Only one transaction can be open at a time
+    def test_txn_nested(self):
+        fs = setup(5)
+        assert libc.fs_txn_begin(ctypes.byref(fs)) == 0
+        assert libc.fs_txn_begin(ctypes.byref(fs)) == -1
+        assert libc.fs_txn_abort(ctypes.byref(fs)) == 0
+        assert libc.fs_txn_abort(ctypes.byref(fs)) == -1
+
+    # A batch commit can't end the transaction or a batch around it
+    # Expected outcome:
+    # * the batch commit inside the transaction fails and writes nothing
+    # * after the abort batches work as before
+    def test_txn_batch_commit(self):
+        fs = setup(5)
+        assert libc.fs_txn_begin(ctypes.byref(fs)) == 0
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/uncommitted","UTF-8")))
+        assert libc.fs_batch_commit(ctypes.byref(fs)) == -1
+        assert load_image().inodes[1].n_type == 3
+        assert libc.fs_batch_begin(ctypes.byref(fs)) == 0
+        assert libc.fs_txn_commit(ctypes.byref(fs)) == -1
+        assert libc.fs_txn_abort(ctypes.byref(fs)) == 0
+        assert libc.fs_batch_commit(ctypes.byref(fs)) == -1
+        assert libc.fs_batch_begin(ctypes.byref(fs)) == 0
+        libc.fs_mkfile(ctypes.byref(fs), ctypes.c_char_p(bytes("/fil","UTF-8")))
+        assert libc.fs_batch_commit(ctypes.byref(fs)) == 0
+        assert load_image().inodes[1].n_type == 1
+
+    # Switches features inside a transaction
+    # Expected outcome:
+    # * dedup, checksums and the log can't be switched while it is open
+    # * after the abort they can
+    def test_txn_settings(self):
+        fs = setup(5)
+        assert libc.fs_txn_begin(ctypes.byref(fs)) == 0
+        assert libc.fs_set_dedup(ctypes.byref(fs), 1) == -1
+        assert libc.fs_set_checksums(ctypes.byref(fs), 1) == -1
+        assert libc.fs_set_log(ctypes.byref(fs), 1) == -1
+        assert libc.fs_txn_abort(ctypes.byref(fs)) == 0
+        assert libc.fs_set_dedup(ctypes.byref(fs), 1) == 0
@@ -0,0 +1,112 @@
+import ctypes
+import time
+from wrappers import *
+
+
+def writef(fs, path, text):
+    return libc.fs_writef(ctypes.byref(fs), c_str(path), c_str(text))
+
+
+def buffered_fs(size, names):
+    fs = setup(size)
+    for name in names:
+        libc.fs_mkfile(ctypes.byref(fs), c_str(name))
+    assert libc.fs_set_write_buffering(ctypes.byref(fs), 1) == 0
+    return fs
+
+class Test_Writeback:
+    # Interleaved small appends stay in memory and get one contiguous run per file
+    def test_writeback_coalesce(self):
+        fs = buffered_fs(20, ["/a", "/b"])
+        for i in range(20):
+            assert writef(fs, "/a", "a" * 100) == 100
+            assert writef(fs, "/b", "b" * 100) == 100
+        assert fs.inodes[1].size == 2000
+        assert fs.inodes[1].direct_blocks[0] == -1
+        assert readf(load_image(), "/a") is None
+
+        assert libc.fs_flush(ctypes.byref(fs)) == 0
+        assert [fs.inodes[1].direct_blocks[i] for i in range(2)] == [0, 1]
+        assert [fs.inodes[2].direct_blocks[i] for i in range(2)] == [2, 3]
+        fs = load_image()
+        assert readf(fs, "/a") == b"a" * 2000
+        assert readf(fs, "/b") == b"b" * 2000
+        assert libc.fs_fsck(ctypes.byref(fs), 0, 0, None) == 0
+
+    # Reads and other writes see the buffered appends, removing a file drops them
+    def test_writeback_read(self):
+        fs = buffered_fs(10, ["/a", "/b"])
+        writef(fs, "/a", "hello ")
+        writef(fs, "/a", "world")
+        buf = ctypes.create_string_buffer(11)
+        assert libc.fs_pread(ctypes.byref(fs), c_str("/a"), buf, ctypes.c_size_t(11), ctypes.c_size_t(0)) == 11
+        assert buf.raw == b"hello world"
+        writef(fs, "/a", "!")
+        assert libc.fs_pwrite(ctypes.byref(fs), c_str("/a"), c_str("W"), ctypes.c_size_t(1), ctypes.c_size_t(6)) == 1
+        assert readf(fs, "/a") == b"hello World!"
+
+        writef(fs, "/b", "x" * 3000)
+        libc.fs_rm(ctypes.byref(fs), c_str("/b"))
+        assert fs.s_block.contents.free_blocks == 9
+        fs = load_image()
+        assert readf(fs, "/a") == b"hello World!"
+
+    # Blocks promised to a buffer aren't given to other files
+    def test_writeback_reserve(self):
+        fs = buffered_fs(3, ["/a", "/b"])
+        for i in range(3):
+            assert writef(fs, "/a", "a" * 1000) == 1000
+        assert writef(fs, "/b", "b" * 100) == -2
+        assert libc.fs_flush(ctypes.byref(fs)) == 0
+        assert readf(load_image(), "/a") == b"a" * 3000
+
+    # Buffered appends are persisted by the first append after WBUF_MAX_AGE_MS
+    def test_writeback_timer(self):
+        fs = buffered_fs(10, ["/a"])
+        writef(fs, "/a", "first ")
+        time.sleep(0.15)
+        writef(fs, "/a", "second")
+        assert readf(load_image(), "/a") == b"first second"
+
+    # Inside a batch a full buffer is flushed into its blocks before the next one starts
+    def test_writeback_batch(self):
+        fs = buffered_fs(20, ["/a"])
+        assert libc.fs_batch_begin(ctypes.byref(fs)) == 0
+        for i in range(5):
+            assert writef(fs, "/a", chr(65 + i) * 1000) == 1000
+        assert readf(fs, "/a") == b"".join(bytes([65 + i]) * 1000 for i in range(5))
+        assert libc.fs_batch_commit(ctypes.byref(fs)) == 0
+        fs = load_image()
+        assert readf(fs, "/a") == b"".join(bytes([65 + i]) * 1000 for i in range(5))
+        assert libc.fs_fsck(ctypes.byref(fs), 0, 0, None) == 0
+
+    # A flush that fails keeps the buffered appends
+    # Expected outcome:
+    # * the cluster the append goes into is damaged, so the flush fails
+    # * the append stays buffered and is tried again by the next flush
+    def test_writeback_flush_fails(self):
+        fs = setup(10)
+        libc.fs_set_checksums(ctypes.byref(fs), 1)
+        libc.fs_set_compression(ctypes.byref(fs), 1)
+        libc.fs_mkfile(ctypes.byref(fs), c_str("/a"))
+        assert pwrite(fs, "/a", b"abc" * 100) == 300
+        fs = load_image()
+        fs.data_blocks[fs.inodes[1].direct_blocks[0]].block[0] ^= 0xFF
+        assert libc.fs_set_write_buffering(ctypes.byref(fs), 1) == 0
+        assert writef(fs, "/a", "more") == 4
+        assert libc.fs_flush(ctypes.byref(fs)) == -1
+        assert fs.inodes[1].size == 304
+        assert libc.fs_flush(ctypes.byref(fs)) == -1
+
+    # A check without repair leaves buffered appends in memory
+    # Expected outcome:
+    # * no problem is found, the blocks set aside count as free
+    # * the appends are still buffered, no block was allocated
+    def test_writeback_fsck_report(self):
+        fs = buffered_fs(10, ["/a"])
+        assert writef(fs, "/a", "a" * 1500) == 1500
+        assert libc.fs_fsck(ctypes.byref(fs), 0, 0, None) == 0
+        assert fs.inodes[1].direct_blocks[0] == -1
+        assert fs.s_block.contents.free_blocks == 10
+        assert libc.fs_flush(ctypes.byref(fs)) == 0
+        assert readf(load_image(), "/a") == b"a" * 1500
@@ -81,6 +81,29 @@ def set_fil(name: str, inode: int, parent: int, parent_block: int, fs):
     fs.inodes[parent].direct_blocks[parent_block] = inode
     return fs
 
+def c_str(s):
+    return ctypes.c_char_p(bytes(s,"UTF-8"))
+
+# loads the image setup (or an earlier test) left behind
+def load_image():
+    loader = libc.fs_load
+    loader.restype = ctypes.POINTER(FileSystem)
+    return loader(c_str("./mypyfiles.fs")).contents
+
+def pwrite(fs, path, data, offset=0):
+    return libc.fs_pwrite(ctypes.byref(fs), c_str(path), ctypes.c_char_p(data), ctypes.c_size_t(len(data)), ctypes.c_size_t(offset))
+
+# returns fs_pread's return value and the bytes it read
+def pread(fs, path, length, offset=0):
+    buf = ctypes.create_string_buffer(length)
+    retval = libc.fs_pread(ctypes.byref(fs), c_str(path), buf, ctypes.c_size_t(length), ctypes.c_size_t(offset))
+    return retval, buf.raw[:max(retval, 0)]
+
+def readf(fs, path):
+    file_size = ctypes.c_int()
+    libc.fs_readf.restype = ctypes.c_char_p
+    return libc.fs_readf(ctypes.byref(fs), c_str(path), ctypes.byref(file_size))
+
 #set (overwrites) data block with abitrary data
 
 #block_num addresses the location in the data_blocks array, whereas parent_block_num adresses the direct_blocks array in the parent inode